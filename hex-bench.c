@@ -0,0 +1,1474 @@
+/*
+ * hex-bench -- benchmarks for the hex viewer
+ *
+ * Copyright (c) 2016 - 2024, Přemysl Eric Janouch <p@janouch.name>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ *
+ */
+
+// The whole program is pulled in, so that its stages can be run one by one
+#define main app_main
+#include "hex.c"
+#undef main
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#ifndef WITH_LUA
+#error Benchmarks need Lua support
+#endif // ! WITH_LUA
+
+// --- Input generators --------------------------------------------------------
+
+// All inputs are little-endian, and their sizes are multiplied by the scale.
+
+static void
+bench_le (struct str *out, uint64_t value, int bytes)
+{
+	while (bytes--)
+	{
+		str_append_c (out, value);
+		value >>= 8;
+	}
+}
+
+static void
+bench_flush (struct str *buf, FILE *fp)
+{
+	if (fwrite (buf->str, 1, buf->len, fp) != buf->len)
+		exit_fatal ("cannot write input: %s", strerror (errno));
+	str_reset (buf);
+}
+
+/// A relocatable object with a lot of small sections, all of them named
+static void
+bench_generate_elf (FILE *fp, double scale)
+{
+	// Section indexes above SHN_LORESERVE would need extended numbering
+	size_t sections = MIN (65000, MAX (3, 60000 * scale));
+
+	struct str names = str_make ();
+	str_append_c (&names, 0);
+
+	const int data_len = 16;
+	uint64_t data_offset = 64;
+	uint64_t names_offset = data_offset + (sections - 2) * data_len;
+	for (size_t i = 1; i < sections - 1; i++)
+	{
+		str_append_printf (&names, ".s%zu", i);
+		str_append_c (&names, 0);
+	}
+	size_t names_name = names.len;
+	str_append (&names, ".shstrtab");
+	str_append_c (&names, 0);
+	uint64_t headers_offset = (names_offset + names.len + 7) / 8 * 8;
+
+	struct str out = str_make ();
+	str_append_data (&out, "\x7f" "ELF\x02\x01\x01\x00\x00", 9);
+	bench_le (&out, 0, 7);
+	bench_le (&out, 1 /* ET_REL */, 2);
+	bench_le (&out, 62 /* EM_X86_64 */, 2);
+	bench_le (&out, 1, 4);
+	bench_le (&out, 0, 8);
+	bench_le (&out, 0, 8);
+	bench_le (&out, headers_offset, 8);
+	bench_le (&out, 0, 4);
+	bench_le (&out, 64, 2);
+	bench_le (&out, 56, 2);
+	bench_le (&out, 0, 2);
+	bench_le (&out, 64, 2);
+	bench_le (&out, sections, 2);
+	bench_le (&out, sections - 1, 2);
+
+	for (size_t i = 1; i < sections - 1; i++)
+		bench_le (&out, i, data_len);
+	str_append_str (&out, &names);
+	while (out.len < headers_offset)
+		str_append_c (&out, 0);
+
+	bench_le (&out, 0, 64);
+	for (size_t i = 1, name = 1; i < sections; i++)
+	{
+		bool last = i == sections - 1;
+		bench_le (&out, last ? names_name : name, 4);
+		bench_le (&out, last ? 3 /* SHT_STRTAB */ : 1 /* SHT_PROGBITS */, 4);
+		bench_le (&out, last ? 0 : 2 /* SHF_ALLOC */, 8);
+		bench_le (&out, 0, 8);
+		bench_le (&out, last ? names_offset
+			: data_offset + (i - 1) * data_len, 8);
+		bench_le (&out, last ? names.len : (size_t) data_len, 8);
+		bench_le (&out, 0, 4);
+		bench_le (&out, 0, 4);
+		bench_le (&out, 1, 8);
+		bench_le (&out, 0, 8);
+		name += strlen (names.str + name) + 1;
+	}
+	bench_flush (&out, fp);
+	str_free (&out);
+	str_free (&names);
+}
+
+/// A minimal Ethernet frame carrying a UDP datagram
+static const uint8_t g_bench_frame[60] =
+{
+	0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x02, 0, 0, 0, 0, 1, 0x08, 0,
+	0x45, 0, 0, 46, 0, 0, 0x40, 0, 64, 17, 0, 0, 10, 0, 0, 1, 10, 0, 0, 2,
+	0x30, 0x39, 0x30, 0x39, 0, 26, 0, 0,
+};
+
+/// A capture of minimal Ethernet frames carrying UDP datagrams
+static void
+bench_generate_pcap (FILE *fp, double scale)
+{
+	size_t packets = MAX (1, 1000000 * scale);
+
+	struct str out = str_make ();
+	bench_le (&out, 0xa1b2c3d4, 4);
+	bench_le (&out, 2, 2);
+	bench_le (&out, 4, 2);
+	bench_le (&out, 0, 4);
+	bench_le (&out, 0, 4);
+	bench_le (&out, 65535, 4);
+	bench_le (&out, 1 /* ETHERNET */, 4);
+	for (size_t i = 0; i < packets; i++)
+	{
+		bench_le (&out, 1700000000 + i / 1000, 4);
+		bench_le (&out, i % 1000 * 1000, 4);
+		bench_le (&out, sizeof g_bench_frame, 4);
+		bench_le (&out, sizeof g_bench_frame, 4);
+		str_append_data (&out, g_bench_frame, sizeof g_bench_frame);
+		if (out.len >= 1 << 20)
+			bench_flush (&out, fp);
+	}
+	bench_flush (&out, fp);
+	str_free (&out);
+}
+
+/// The same capture, only in the next generation format
+static void
+bench_generate_pcapng (FILE *fp, double scale)
+{
+	size_t packets = MAX (1, 1000000 * scale);
+
+	struct str out = str_make ();
+	bench_le (&out, 0x0a0d0d0a, 4);
+	bench_le (&out, 28, 4);
+	bench_le (&out, 0x1a2b3c4d, 4);
+	bench_le (&out, 1, 2);
+	bench_le (&out, 0, 2);
+	bench_le (&out, UINT64_MAX, 8);
+	bench_le (&out, 28, 4);
+
+	bench_le (&out, 1 /* IDB */, 4);
+	bench_le (&out, 20, 4);
+	bench_le (&out, 1 /* ETHERNET */, 2);
+	bench_le (&out, 0, 2);
+	bench_le (&out, 65535, 4);
+	bench_le (&out, 20, 4);
+	for (size_t i = 0; i < packets; i++)
+	{
+		uint64_t usec = (1700000000 + i / 1000) * 1000000ULL + i % 1000 * 1000;
+		bench_le (&out, 6 /* EPB */, 4);
+		bench_le (&out, 32 + sizeof g_bench_frame, 4);
+		bench_le (&out, 0, 4);
+		bench_le (&out, usec >> 32, 4);
+		bench_le (&out, usec, 4);
+		bench_le (&out, sizeof g_bench_frame, 4);
+		bench_le (&out, sizeof g_bench_frame, 4);
+		str_append_data (&out, g_bench_frame, sizeof g_bench_frame);
+		bench_le (&out, 32 + sizeof g_bench_frame, 4);
+		if (out.len >= 1 << 20)
+			bench_flush (&out, fp);
+	}
+	bench_flush (&out, fp);
+	str_free (&out);
+}
+
+static uint32_t
+bench_crc32 (const void *data, size_t len)
+{
+	static uint32_t table[256];
+	if (!table[1])
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			uint32_t c = i;
+			for (int k = 0; k < 8; k++)
+				c = c & 1 ? 0xedb88320 ^ c >> 1 : c >> 1;
+			table[i] = c;
+		}
+
+	uint32_t crc = 0xffffffff;
+	for (const uint8_t *p = data; len--; p++)
+		crc = table[(crc ^ *p) & 0xff] ^ crc >> 8;
+	return ~crc;
+}
+
+/// Store an entry both as a local file header with its data,
+/// and as a central directory record
+static void
+bench_zip_entry (struct str *out, struct str *cd,
+	const char *name, const void *data, size_t len)
+{
+	uint32_t crc = bench_crc32 (data, len);
+	size_t name_len = strlen (name);
+	uint64_t offset = out->len;
+
+	bench_le (out, 0x04034b50, 4);
+	bench_le (out, 20, 2);
+	bench_le (out, 0, 2);
+	bench_le (out, 0 /* stored */, 2);
+	bench_le (out, 0, 2);
+	bench_le (out, 0x21, 2);
+	bench_le (out, crc, 4);
+	bench_le (out, len, 4);
+	bench_le (out, len, 4);
+	bench_le (out, name_len, 2);
+	bench_le (out, 0, 2);
+	str_append (out, name);
+	str_append_data (out, data, len);
+
+	bench_le (cd, 0x02014b50, 4);
+	bench_le (cd, 20, 2);
+	bench_le (cd, 20, 2);
+	bench_le (cd, 0, 2);
+	bench_le (cd, 0, 2);
+	bench_le (cd, 0, 2);
+	bench_le (cd, 0x21, 2);
+	bench_le (cd, crc, 4);
+	bench_le (cd, len, 4);
+	bench_le (cd, len, 4);
+	bench_le (cd, name_len, 2);
+	bench_le (cd, 0, 2);
+	bench_le (cd, 0, 2);
+	bench_le (cd, 0, 2);
+	bench_le (cd, 0, 2);
+	bench_le (cd, 0, 4);
+	bench_le (cd, offset, 4);
+	str_append (cd, name);
+}
+
+/// Archives stored within archives, each level also having many small files
+static void
+bench_generate_zip (FILE *fp, double scale)
+{
+	size_t files = MIN (65000, MAX (1, 2000 * scale));
+	const int depth = 16;
+
+	struct str inner = str_make ();
+	for (int level = depth; level--; )
+	{
+		struct str out = str_make (), cd = str_make ();
+		size_t entries = files;
+		for (size_t i = 0; i < files; i++)
+		{
+			char name[32];
+			snprintf (name, sizeof name, "%d/file%zu.txt", level, i);
+			bench_zip_entry (&out, &cd, name, name, strlen (name));
+		}
+		if (inner.len)
+		{
+			bench_zip_entry (&out, &cd, "inner.zip", inner.str, inner.len);
+			entries++;
+		}
+
+		uint64_t cd_offset = out.len;
+		str_append_str (&out, &cd);
+		bench_le (&out, 0x06054b50, 4);
+		bench_le (&out, 0, 2);
+		bench_le (&out, 0, 2);
+		bench_le (&out, entries, 2);
+		bench_le (&out, entries, 2);
+		bench_le (&out, cd.len, 4);
+		bench_le (&out, cd_offset, 4);
+		bench_le (&out, 0, 2);
+
+		str_free (&cd);
+		str_free (&inner);
+		inner = out;
+	}
+	bench_flush (&inner, fp);
+	str_free (&inner);
+}
+
+/// A document made of many small dictionary objects, with a classic xref
+static void
+bench_generate_pdf (FILE *fp, double scale)
+{
+	size_t objects = MAX (1, 200000 * scale);
+
+	struct str out = str_make ();
+	str_append (&out, "%PDF-1.4\n");
+
+	uint64_t *offsets = xcalloc (objects, sizeof *offsets);
+	for (size_t i = 0; i < objects; i++)
+	{
+		offsets[i] = out.len;
+		str_append_printf (&out, "%zu 0 obj\n<< /Type /Bench /N %zu"
+			" /Name (object %zu) /Array [1 2.5 /x true null] >>\nendobj\n",
+			i + 1, i, i);
+	}
+
+	uint64_t xref = out.len;
+	str_append_printf (&out, "xref\n0 %zu\n0000000000 65535 f \n",
+		objects + 1);
+	for (size_t i = 0; i < objects; i++)
+		str_append_printf (&out, "%010" PRIu64 " 00000 n \n", offsets[i]);
+	str_append_printf (&out, "trailer\n<< /Size %zu >>\nstartxref\n%" PRIu64
+		"\n%%%%EOF\n", objects + 1, xref);
+
+	bench_flush (&out, fp);
+	str_free (&out);
+	free (offsets);
+}
+
+/// A dictzip archive with a long Latin-1 filename and a header checksum
+static void
+bench_generate_gzip (FILE *fp, double scale)
+{
+	// The random access subfield has to fit within the extra field
+	size_t chunks = MIN (32000, MAX (1, 32000 * scale));
+	size_t name_len = MAX (1, 1000000 * scale);
+
+	struct str out = str_make ();
+	bench_le (&out, 0x088b1f, 3);
+	bench_le (&out, 0x02 /* FHCRC */ | 0x04 /* FEXTRA */ | 0x08 /* FNAME */, 1);
+	bench_le (&out, 0, 4);
+	bench_le (&out, 2, 1);
+	bench_le (&out, 3 /* Unix */, 1);
+
+	bench_le (&out, 4 + 6 + 2 * chunks, 2);
+	str_append (&out, "RA");
+	bench_le (&out, 6 + 2 * chunks, 2);
+	bench_le (&out, 1, 2);
+	bench_le (&out, 58315, 2);
+	bench_le (&out, chunks, 2);
+	for (size_t i = 0; i < chunks; i++)
+		bench_le (&out, 5 + 16, 2);
+
+	for (size_t i = 0; i < name_len; i++)
+		str_append_c (&out, i % 2 ? 'a' : '\xe9');
+	str_append_c (&out, 0);
+	bench_le (&out, bench_crc32 (out.str, out.len), 2);
+
+	// Each chunk is a single non-final stored block
+	struct str data = str_make ();
+	for (size_t i = 0; i < chunks; i++)
+	{
+		const char *chunk = "0123456789abcdef";
+		bench_le (&out, 0, 1);
+		bench_le (&out, 16, 2);
+		bench_le (&out, 0xffff ^ 16, 2);
+		str_append_data (&out, chunk, 16);
+		str_append_data (&data, chunk, 16);
+	}
+	bench_le (&out, 0x0003, 2);
+	bench_le (&out, bench_crc32 (data.str, data.len), 4);
+	bench_le (&out, data.len, 4);
+
+	bench_flush (&out, fp);
+	str_free (&out);
+	str_free (&data);
+}
+
+/// A torrent-like dictionary with many keys, each holding a small list
+static void
+bench_generate_bencode (FILE *fp, double scale)
+{
+	size_t entries = MAX (1, 100000 * scale);
+
+	struct str out = str_make ();
+	str_append_c (&out, 'd');
+	for (size_t i = 0; i < entries; i++)
+	{
+		char key[32];
+		int len = snprintf (key, sizeof key, "key%zu", i);
+		str_append_printf (&out, "%d:%sli%zue4:spame", len, key, i);
+		if (out.len >= 1 << 20)
+			bench_flush (&out, fp);
+	}
+	str_append_c (&out, 'e');
+	bench_flush (&out, fp);
+	str_free (&out);
+}
+
+/// A dynamic VirtualBox disk image with a long, entirely unallocated
+/// block map, as its data would only take space
+static void
+bench_generate_vdi (FILE *fp, double scale)
+{
+	size_t blocks = MAX (1, 1000000 * scale);
+	const uint32_t header_size = 400, block_size = 1 << 20;
+
+	struct str out = str_make ();
+	str_append (&out, "<<< Oracle VM VirtualBox Disk Image >>>\n");
+	while (out.len < 64)
+		str_append_c (&out, 0);
+	bench_le (&out, 0xbeda107f, 4);
+	bench_le (&out, 1, 2);
+	bench_le (&out, 1, 2);
+	bench_le (&out, header_size, 4);
+	bench_le (&out, 1 /* dynamic */, 4);
+	bench_le (&out, 0, 4);
+	str_append (&out, "hex-bench");
+	while (out.len < 84 + 256)
+		str_append_c (&out, 0);
+
+	uint32_t offset_blocks = 1 << 20;
+	uint32_t offset_data = offset_blocks + (4 * blocks + 0xfffff) / 0x100000
+		* 0x100000;
+	bench_le (&out, offset_blocks, 4);
+	bench_le (&out, offset_data, 4);
+	bench_le (&out, 0, 4);
+	bench_le (&out, 0, 4);
+	bench_le (&out, 0, 4);
+	bench_le (&out, 512, 4);
+	bench_le (&out, 0, 4);
+	bench_le (&out, (uint64_t) blocks * block_size, 8);
+	bench_le (&out, block_size, 4);
+	bench_le (&out, 0, 4);
+	bench_le (&out, blocks, 4);
+	bench_le (&out, 0, 4);
+	for (int i = 0; i < 4 * 16; i++)
+		str_append_c (&out, 0x11 * (i / 16 + 1) + i % 16);
+
+	while (out.len < offset_blocks)
+		str_append_c (&out, 0);
+	for (size_t i = 0; i < blocks; i++)
+	{
+		bench_le (&out, UINT32_MAX /* unallocated */, 4);
+		if (out.len >= 1 << 20)
+			bench_flush (&out, fp);
+	}
+	bench_flush (&out, fp);
+	str_free (&out);
+}
+
+/// A cursor theme file with a long table of contents of tiny images
+static void
+bench_generate_xcursor (FILE *fp, double scale)
+{
+	size_t images = MAX (1, 200000 * scale);
+	const uint32_t side = 4, image_len = 36 + 4 * side * side;
+
+	struct str out = str_make ();
+	str_append (&out, "Xcur");
+	bench_le (&out, 16, 4);
+	bench_le (&out, 0x10000, 4);
+	bench_le (&out, images, 4);
+
+	uint64_t position = 16 + 12 * images;
+	for (size_t i = 0; i < images; i++)
+	{
+		bench_le (&out, 0xfffd0002 /* image */, 4);
+		bench_le (&out, side, 4);
+		bench_le (&out, position + i * image_len, 4);
+		if (out.len >= 1 << 20)
+			bench_flush (&out, fp);
+	}
+	for (size_t i = 0; i < images; i++)
+	{
+		bench_le (&out, 36, 4);
+		bench_le (&out, 0xfffd0002, 4);
+		bench_le (&out, side, 4);
+		bench_le (&out, 1, 4);
+		bench_le (&out, side, 4);
+		bench_le (&out, side, 4);
+		bench_le (&out, 0, 4);
+		bench_le (&out, 0, 4);
+		bench_le (&out, 50, 4);
+		for (uint32_t k = 0; k < side * side; k++)
+			bench_le (&out, 0xff000000 | (i + k) * 0x010101, 4);
+		if (out.len >= 1 << 20)
+			bench_flush (&out, fp);
+	}
+	bench_flush (&out, fp);
+	str_free (&out);
+}
+
+/// A zlib stream of stored blocks, of which only the header gets decoded
+static void
+bench_generate_zlib (FILE *fp, double scale)
+{
+	size_t chunks = MAX (1, 100000 * scale);
+
+	struct str out = str_make ();
+	bench_le (&out, 0x78, 1);
+	bench_le (&out, 0x01, 1);
+
+	uint32_t a = 1, b = 0;
+	for (size_t i = 0; i < chunks; i++)
+	{
+		const char *chunk = "0123456789abcdef";
+		bench_le (&out, i + 1 == chunks, 1);
+		bench_le (&out, 16, 2);
+		bench_le (&out, 0xffff ^ 16, 2);
+		str_append_data (&out, chunk, 16);
+		for (const char *p = chunk; *p; p++)
+		{
+			a = (a + (uint8_t) *p) % 65521;
+			b = (b + a) % 65521;
+		}
+		if (out.len >= 1 << 20)
+			bench_flush (&out, fp);
+	}
+
+	// Unlike everything else, the checksum is big-endian
+	uint32_t adler = b << 16 | a;
+	for (int i = 4; i--; )
+		str_append_c (&out, adler >> (8 * i));
+	bench_flush (&out, fp);
+	str_free (&out);
+}
+
+static struct bench_input
+{
+	const char *name;                   ///< Name of the input
+	const char *type;                   ///< Type without any autodetection
+	void (*generate) (FILE *fp, double scale);
+}
+g_bench_inputs[] =
+{
+	{ "elf",     NULL,      bench_generate_elf     },
+	{ "pcap",    NULL,      bench_generate_pcap    },
+	{ "pcapng",  NULL,      bench_generate_pcapng  },
+	{ "zip",     NULL,      bench_generate_zip     },
+	{ "pdf",     NULL,      bench_generate_pdf     },
+	{ "gzip",    NULL,      bench_generate_gzip    },
+	{ "bencode", "bencode", bench_generate_bencode },
+	{ "vdi",     NULL,      bench_generate_vdi     },
+	{ "xcursor", NULL,      bench_generate_xcursor },
+	{ "zlib",    "zlib",    bench_generate_zlib    },
+};
+
+// --- Stages ------------------------------------------------------------------
+
+enum bench_stage
+{
+	BENCH_PLUGINS,                      ///< Loading Lua plugins
+	BENCH_LOAD,                         ///< Mapping in or reading the input
+	BENCH_IDENTIFY,                     ///< Autodetecting the type
+	BENCH_DECODE,                       ///< Decoding as the detected type
+	BENCH_INDEX,                        ///< Sorting and flattening marks
+	BENCH_LAYOUT,                       ///< Laying out the first frame
+	BENCH_RENDER,                       ///< Rendering the first frame
+	BENCH_LOOKUP,                       ///< Looking up marks at random
+	BENCH_SCROLL,                       ///< Showing random further frames
+	BENCH_COUNT
+};
+
+static const char *g_bench_stage_names[BENCH_COUNT] =
+{
+	"plugins", "load", "identify", "decode", "index", "layout", "render",
+	"lookup", "scroll"
+};
+
+#define BENCH_LOOKUPS  1000000          ///< Marks to look up at random
+#define BENCH_SCROLLS  100              ///< Frames to show at random
+
+/// A cheap pseudorandom number generator, so that runs are reproducible
+static uint64_t
+bench_random (uint64_t *state)
+{
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+/// Measurements of a single input, negative times for stages not run
+struct bench_result
+{
+	int64_t usec[BENCH_COUNT];          ///< Time spent in each stage
+	char *type;                         ///< Detected type, if any
+	char *error;                        ///< Why the run was cut short
+};
+
+/// Run the identification the same way chunk:identify() does
+static char *
+bench_identify (struct app_lua *lua)
+{
+	lua_State *L = lua->L;
+	lua_pushcfunction (L, app_lua_error_handler);
+	lua_pushcfunction (L, app_lua_chunk_identify);
+
+	struct app_lua_chunk *chunk = app_lua_chunk_new (L);
+	chunk->offset = lua->data_offset;
+	chunk->len = lua->data_len;
+
+	char *type = NULL;
+	if (!lua_pcall (L, 1, 1, -3) && lua_type (L, -1) == LUA_TSTRING)
+		type = xstrdup (lua_tostring (L, -1));
+	lua_pop (L, 2);
+	return type;
+}
+
+/// Lay out and render the first frame within a pseudoterminal of our own,
+/// so that neither a terminal nor X11 are needed
+static bool
+bench_first_frame (struct bench_result *result)
+{
+	struct error *e = NULL;
+	if (!app_private_pty (REPLAY_ROWS, REPLAY_COLS, &e))
+	{
+		cstr_set (&result->error, xstrdup (e->message));
+		error_free (e);
+		return false;
+	}
+
+	setenv ("TERM", "xterm", true);
+	xui_preinit ();
+	xui_start (&g.poller, false, g.attrs, N_ELEMENTS (g.attrs));
+
+	struct widget *w = g_xui.ui->label (0, XUI_ATTR_MONOSPACE, "8");
+	g.digitw = w->width;
+	widget_destroy (w);
+
+	int64_t start = app_clock_usec ();
+	app_layout ();
+	int64_t layout = app_clock_usec ();
+	g_xui.ui->render ();
+	int64_t end = app_clock_usec ();
+
+	result->usec[BENCH_LAYOUT] = layout - start;
+	result->usec[BENCH_RENDER] = end - layout;
+
+	// Jumping all over the data is what huge pages should help with
+	uint64_t state = 1;
+	start = app_clock_usec ();
+	for (int i = 0; g.data_len && i < BENCH_SCROLLS; i++)
+	{
+		int64_t offset = bench_random (&state) % g.data_len;
+		g.view_top = g.data_offset + offset / ROW_SIZE * ROW_SIZE;
+		(void) app_fix_view_range ();
+		app_layout ();
+		g_xui.ui->render ();
+	}
+	result->usec[BENCH_SCROLL] = app_clock_usec () - start;
+	xui_stop ();
+	return true;
+}
+
+/// Take an input through all stages, much like the main program would
+static void
+bench_run (const struct bench_input *input, const char *path, bool frame,
+	struct bench_result *result)
+{
+	int64_t start = app_clock_usec ();
+	g.lua = app_lua_new (true);
+	result->usec[BENCH_PLUGINS] = app_clock_usec () - start;
+
+	start = app_clock_usec ();
+	int fd = open (path, O_RDONLY);
+	if (fd < 0)
+		exit_fatal ("%s: %s", path, strerror (errno));
+	g.filename = xstrdup (path);
+	app_load_data (fd, INT64_MAX);
+	close (fd);
+	result->usec[BENCH_LOAD] = app_clock_usec () - start;
+
+	g.view_cursor = g.view_top = 0;
+	app_init_context ();
+	g.lua->data = g.data;
+	g.lua->data_len = g.data_len;
+	g.lua->data_offset = g.data_offset;
+	g.lua->on_mark = app_add_mark;
+
+	// Some formats have no magic to go by, and must be named
+	if (input->type)
+		result->type = xstrdup (input->type);
+	else
+	{
+		start = app_clock_usec ();
+		result->type = bench_identify (g.lua);
+		result->usec[BENCH_IDENTIFY] = app_clock_usec () - start;
+	}
+	if (!result->type)
+	{
+		result->error = xstrdup ("the type has not been identified");
+		return;
+	}
+
+	struct error *e = NULL;
+	start = app_clock_usec ();
+	if (!app_lua_decode_data (g.lua, result->type, &e))
+	{
+		result->error = xstrdup (e->message);
+		error_free (e);
+		return;
+	}
+	result->usec[BENCH_DECODE] = app_clock_usec () - start;
+
+	start = app_clock_usec ();
+	qsort (g.marks, g.marks_len, sizeof *g.marks, app_mark_cmp);
+	app_index_marks ();
+	result->usec[BENCH_INDEX] = app_clock_usec () - start;
+	if (!frame)
+		return;
+
+	uint64_t state = 1;
+	volatile ssize_t found = 0;
+	start = app_clock_usec ();
+	for (int i = 0; g.data_len && i < BENCH_LOOKUPS; i++)
+		found += app_find_marks
+			(g.data_offset + bench_random (&state) % g.data_len);
+	result->usec[BENCH_LOOKUP] = app_clock_usec () - start;
+	(void) bench_first_frame (result);
+}
+
+static void
+bench_report (struct str *out, const char *name, const char *path,
+	const struct bench_result *result)
+{
+	struct stat st = {};
+	(void) stat (path, &st);
+
+	str_append (out, "{\"input\":");
+	app_dump_json_string (out, name);
+	str_append_printf (out, ",\"bytes\":%" PRIu64 ",\"type\":",
+		(uint64_t) st.st_size);
+	if (result->type)
+		app_dump_json_string (out, result->type);
+	else
+		str_append (out, "null");
+	str_append_printf (out, ",\"marks\":%zu,\"usec\":{", g.marks_len);
+	for (int i = 0; i < BENCH_COUNT; i++)
+	{
+		str_append_printf (out, "%s\"%s\":", i ? "," : "",
+			g_bench_stage_names[i]);
+		if (result->usec[i] < 0)
+			str_append (out, "null");
+		else
+			str_append_printf (out, "%" PRId64, result->usec[i]);
+	}
+
+	str_append_printf (out, "},\"hugepages\":%s",
+		g.no_hugepages ? "false" : "true");
+
+	// Bytes per microsecond happen to be megabytes per second
+	int64_t decode = result->usec[BENCH_DECODE];
+	if (decode >= 0)
+		str_append_printf (out, ",\"mb_per_s\":%.3f,\"marks_per_s\":%.0f",
+			(double) st.st_size / MAX (decode, 1),
+			g.marks_len * 1e6 / MAX (decode, 1));
+
+	struct rusage usage = {};
+	(void) getrusage (RUSAGE_SELF, &usage);
+	str_append_printf (out, ",\"peak_rss_kib\":%ld,\"memory\":{",
+		(long) usage.ru_maxrss);
+
+	static const char *labels[MEMORY_COUNT] =
+	{
+#define XX(name, label) label,
+		MEMORY_TABLE (XX)
+#undef XX
+	};
+	for (int i = 0; i < MEMORY_COUNT; i++)
+	{
+		if (i)
+			str_append_c (out, ',');
+		app_dump_json_string (out, labels[i]);
+		str_append_printf (out, ":{\"peak\":%zu,\"allocations\":%zu}",
+			g.memory[i].peak, g.memory[i].allocations);
+	}
+	str_append (out, "},\"error\":");
+	if (result->error)
+		app_dump_json_string (out, result->error);
+	else
+		str_append (out, "null");
+	str_append (out, "}\n");
+}
+
+/// What the parent process learns about a run besides its report
+struct bench_summary
+{
+	bool ok;                            ///< All stages have succeeded
+	int64_t bytes;                      ///< Size of the input
+	int64_t decode_usec;                ///< Time spent decoding
+	size_t marks;                       ///< Number of marks produced
+};
+
+/// Run the input in a new process, so that each one starts afresh,
+/// and has its own peak resident set size
+static struct bench_summary
+bench_input (const struct bench_input *input, const char *path, bool frame)
+{
+	int fds[2];
+	if (pipe (fds))
+		exit_fatal ("pipe: %s", strerror (errno));
+
+	fflush (stdout);
+	pid_t child = fork ();
+	if (child < 0)
+		exit_fatal ("fork: %s", strerror (errno));
+	if (!child)
+	{
+		close (fds[0]);
+
+		struct bench_result result = {};
+		for (int i = 0; i < BENCH_COUNT; i++)
+			result.usec[i] = -1;
+		bench_run (input, path, frame, &result);
+
+		struct stat st = {};
+		(void) stat (path, &st);
+		struct bench_summary summary =
+		{
+			.ok = !result.error,
+			.bytes = st.st_size,
+			.decode_usec = result.usec[BENCH_DECODE],
+			.marks = g.marks_len,
+		};
+
+		struct str out = str_make ();
+		str_append_data (&out, &summary, sizeof summary);
+		bench_report (&out, input->name, path, &result);
+		struct error *e = NULL;
+		if (!app_write_all (fds[1], out.str, out.len, -1, &e))
+			exit_fatal ("%s", e->message);
+		_exit (result.error ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	close (fds[1]);
+	struct str in = str_make ();
+	char buf[4096];
+	ssize_t n;
+	while ((n = read (fds[0], buf, sizeof buf)) > 0
+		|| (n < 0 && errno == EINTR))
+		if (n > 0)
+			str_append_data (&in, buf, n);
+	close (fds[0]);
+
+	struct bench_summary summary = {};
+	if (in.len >= sizeof summary)
+	{
+		memcpy (&summary, in.str, sizeof summary);
+		fwrite (in.str + sizeof summary, 1, in.len - sizeof summary, stdout);
+		fflush (stdout);
+	}
+	str_free (&in);
+
+	int status = 0;
+	while (waitpid (child, &status, 0) < 0 && errno == EINTR)
+		;
+	if (!WIFEXITED (status) || WEXITSTATUS (status) != EXIT_SUCCESS)
+		summary.ok = false;
+	return summary;
+}
+
+static char *
+bench_generate (const struct bench_input *input, const char *dir, double scale)
+{
+	char *path = xstrdup_printf ("%s/input.%s", dir, input->name);
+	FILE *fp = fopen (path, "wb");
+	if (!fp)
+		exit_fatal ("%s: %s", path, strerror (errno));
+	input->generate (fp, scale);
+	if (fclose (fp))
+		exit_fatal ("%s: %s", path, strerror (errno));
+	return path;
+}
+
+// --- Throughput --------------------------------------------------------------
+
+// Decoding is measured over inputs doubling in size, and the time spent
+// per byte should stay roughly the same--anything more is a regression.
+// Inputs decoded faster than the minimum are too noisy to tell.
+
+#define BENCH_SCALING_STEPS      4      ///< How many times to double inputs
+#define BENCH_SCALING_LIMIT      1.5    ///< Most growth of time per byte
+#define BENCH_SCALING_MIN_USEC   20000  ///< Least decoding time to compare
+#define BENCH_BASELINE_TOLERANCE 0.25   ///< Tolerated drop in throughput
+
+/// Throughputs to compare against, in MB/s, zero where unknown
+static double g_bench_baseline[N_ELEMENTS (g_bench_inputs)];
+
+static void
+bench_load_baseline (const char *path)
+{
+	FILE *fp = fopen (path, "r");
+	if (!fp)
+		exit_fatal ("%s: %s", path, strerror (errno));
+
+	char name[64];
+	double mb_per_s;
+	int n;
+	while ((n = fscanf (fp, "%63s %lf", name, &mb_per_s)) == 2)
+		for (size_t i = 0; i < N_ELEMENTS (g_bench_inputs); i++)
+			if (!strcmp (g_bench_inputs[i].name, name))
+				g_bench_baseline[i] = mb_per_s;
+	if (n != EOF || ferror (fp))
+		exit_fatal ("%s: invalid baseline", path);
+	fclose (fp);
+}
+
+/// Decode the input at increasing sizes, checking for superlinear scaling,
+/// and compare the throughput at the largest one with the baseline
+static bool
+bench_throughput (size_t index, const char *dir, double scale, FILE *save)
+{
+	const struct bench_input *input = &g_bench_inputs[index];
+	struct bench_summary last = {};
+	bool ok = true;
+	for (int step = 0; step < BENCH_SCALING_STEPS; step++)
+	{
+		char *path = bench_generate (input, dir,
+			scale / (1 << (BENCH_SCALING_STEPS - 1 - step)));
+		struct bench_summary summary = bench_input (input, path, false);
+		(void) unlink (path);
+		free (path);
+		if (!summary.ok)
+			return false;
+
+		if (step && last.decode_usec >= BENCH_SCALING_MIN_USEC
+		 && summary.bytes > last.bytes)
+		{
+			double growth =
+				((double) summary.decode_usec / summary.bytes) /
+				((double) last.decode_usec / last.bytes);
+			if (growth > BENCH_SCALING_LIMIT)
+			{
+				print_error ("%s: decoding %" PRId64 " bytes takes"
+					" %.2f times as long per byte as %" PRId64 " bytes",
+					input->name, summary.bytes, growth, last.bytes);
+				ok = false;
+			}
+		}
+		last = summary;
+	}
+
+	double mb_per_s = (double) last.bytes / MAX (last.decode_usec, 1);
+	double baseline = g_bench_baseline[index];
+	if (baseline > 0 && mb_per_s < baseline * (1 - BENCH_BASELINE_TOLERANCE))
+	{
+		print_error ("%s: decoding at %.3f MB/s, down from %.3f MB/s",
+			input->name, mb_per_s, baseline);
+		ok = false;
+	}
+	if (save)
+		fprintf (save, "%s\t%.3f\n", input->name, mb_per_s);
+	return ok;
+}
+
+// --- Checks ------------------------------------------------------------------
+
+// Not everything worth checking is a matter of speed.  Checks run instead
+// of benchmarks, each in a process of its own, so that they start afresh.
+
+static const struct bench_edit
+{
+	int64_t offset;                     ///< Where to make the edit
+	int64_t remove;                     ///< How many bytes to remove
+	const char *insert;                 ///< What to insert there
+}
+g_bench_edits[] =
+{
+	{  4, 0, "x"   },
+	{  0, 0, "yy"  },
+	{ 10, 3, ""    },
+	{ 12, 1, "zzz" },
+};
+
+/// Make edits that change where the file continues past the data,
+/// saving after each one, and compare the result with what was intended
+static bool
+bench_check_saving (const char *dir)
+{
+	static const char prefix[] = "prefix", data[] = "0123456789abcdef",
+		suffix[] = "suffix";
+
+	char *path = xstrdup_printf ("%s/saved", dir);
+	FILE *fp = fopen (path, "wb");
+	if (!fp || fprintf (fp, "%s%s%s", prefix, data, suffix) < 0 || fclose (fp))
+		exit_fatal ("%s: %s", path, strerror (errno));
+
+	// Only load the middle part, so that both ends need to be copied over
+	int fd = open (path, O_RDONLY);
+	if (fd < 0)
+		exit_fatal ("%s: %s", path, strerror (errno));
+	g.filename = path;
+	g.data_offset = sizeof prefix - 1;
+	app_load_data (fd, sizeof data - 1);
+	close (fd);
+	app_init_context ();
+	g.redecode_event = poller_idle_make (&g.poller);
+
+	struct str expected = str_make ();
+	str_append (&expected, data);
+
+	bool ok = true;
+	for (size_t i = 0; ok && i < N_ELEMENTS (g_bench_edits); i++)
+	{
+		const struct bench_edit *edit = &g_bench_edits[i];
+		app_edit (edit->offset, edit->remove,
+			edit->insert, strlen (edit->insert));
+
+		struct str tail = str_make ();
+		str_append (&tail, expected.str + edit->offset + edit->remove);
+		expected.len = edit->offset;
+		str_append (&expected, edit->insert);
+		str_append_str (&expected, &tail);
+		str_free (&tail);
+
+		struct error *e = NULL;
+		if (!app_save (&e))
+		{
+			print_error ("saving: %s", e->message);
+			error_free (e);
+			ok = false;
+			break;
+		}
+
+		char *intended =
+			xstrdup_printf ("%s%s%s", prefix, expected.str, suffix);
+		char buf[256] = "";
+		size_t len = 0;
+		if ((fp = fopen (path, "rb")))
+		{
+			len = fread (buf, 1, sizeof buf - 1, fp);
+			fclose (fp);
+		}
+		if (len != strlen (intended) || memcmp (buf, intended, len))
+		{
+			print_error ("save %zu: expected \"%s\", got \"%.*s\"",
+				i + 1, intended, (int) len, buf);
+			ok = false;
+		}
+		free (intended);
+	}
+
+	str_free (&expected);
+	(void) unlink (path);
+	return ok;
+}
+
+/// Load "data" from a file, as the whole input
+static void
+bench_check_load (const char *dir, const char *data)
+{
+	char *path = xstrdup_printf ("%s/checked", dir);
+	FILE *fp = fopen (path, "wb");
+	if (!fp || fputs (data, fp) < 0 || fclose (fp))
+		exit_fatal ("%s: %s", path, strerror (errno));
+
+	int fd = open (path, O_RDONLY);
+	if (fd < 0)
+		exit_fatal ("%s: %s", path, strerror (errno));
+	app_load_data (fd, INT64_MAX);
+	close (fd);
+	(void) unlink (path);
+	free (path);
+
+	app_init_context ();
+	g.redecode_event = poller_idle_make (&g.poller);
+}
+
+/// Run a search to completion right here, without any worker threads
+static void
+bench_check_run_search (struct app_search *search)
+{
+	pthread_mutex_init (&search->task.lock, NULL);
+	search->task.user_data = search;
+	for (size_t i = 0; i < search->chunks_len; i++)
+		app_search_execute (&search->task, 0, i);
+	app_search_merge (search);
+	pthread_mutex_destroy (&search->task.lock);
+}
+
+/// Compare search results against a naive search of the edited data
+static bool
+bench_check_matches (const struct app_search *search, const char *step)
+{
+	uint8_t *data = xmalloc (MAX (g.data_len, 1));
+	app_edit_read (0, data, g.data_len);
+
+	const struct str *needle = &search->needles[0];
+	size_t k = 0;
+	bool ok = true;
+	for (int64_t i = 0; ok && i + (int64_t) needle->len <= g.data_len; i++)
+	{
+		if (memcmp (data + i, needle->str, needle->len))
+			continue;
+		if (k >= search->matches_len || search->matches[k] != i)
+			ok = false;
+		k++;
+	}
+	if (!ok || k != search->matches_len)
+	{
+		print_error ("search %s: found %zu matches, expected %zu",
+			step, search->matches_len, k);
+		ok = false;
+	}
+	free (data);
+	return ok;
+}
+
+/// Search over edited data, and make further edits with the search done
+static bool
+bench_check_search (const char *dir)
+{
+	bench_check_load (dir, "xxabcxxabcxx");
+	app_edit (0, 0, "abc", 3);
+
+	struct app_search *search = g.search = app_search_new ();
+	str_append (&search->needles[0], "abc");
+	search->needles_len = 1;
+	search->match_len = search->needles[0].len;
+	bench_check_run_search (search);
+	if (!bench_check_matches (search, "after an insert"))
+		return false;
+
+	// Break a match apart, then join it back together
+	app_edit (6, 0, "X", 1);
+	if (!bench_check_matches (search, "after splitting a match"))
+		return false;
+	app_edit (6, 1, "", 0);
+	return bench_check_matches (search, "after joining a match");
+}
+
+/// A mark, as it can be compared across decodes
+struct bench_check_mark
+{
+	int64_t offset;                     ///< Offset of the mark
+	int64_t len;                        ///< Length of the mark
+	const char *description;            ///< Its description
+};
+
+static int
+bench_check_mark_cmp (const void *first, const void *second)
+{
+	const struct bench_check_mark *a = first, *b = second;
+	if (a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	if (a->len != b->len)
+		return a->len < b->len ? -1 : 1;
+	return strcmp (a->description, b->description);
+}
+
+/// Take a sorted copy of all marks, the descriptions pointing into "strings"
+static struct bench_check_mark *
+bench_check_marks_copy (struct str *strings)
+{
+	str_reset (strings);
+	str_append_data (strings, g.mark_strings.str, g.mark_strings.len);
+
+	struct bench_check_mark *marks =
+		xcalloc (MAX (g.marks_len, 1), sizeof *marks);
+	for (size_t i = 0; i < g.marks_len; i++)
+		marks[i] = (struct bench_check_mark)
+			{ g.marks[i].offset, g.marks[i].len,
+			  strings->str + g.marks[i].description };
+	qsort (marks, g.marks_len, sizeof *marks, bench_check_mark_cmp);
+	return marks;
+}
+
+/// Repeat the decode affected by edits right here, the way the main program
+/// would in the background, returning its type
+static char *
+bench_check_redecode_run (void)
+{
+	struct app_redecode *self = app_redecode_get ();
+	for (size_t i = 0; i < g.splices_len; i++)
+		app_redecode_apply (self, &g.splices[i]);
+	g.splices_len = 0;
+	app_redecode_start (self);
+	if (!self->running)
+		return NULL;
+
+	app_task_wait (&self->task);
+	poller_timer_reset (&self->timer);
+	self->running = false;
+	if (self->edited)
+		app_edited_destroy (self->edited);
+	self->edited = NULL;
+	if (self->error)
+	{
+		print_error ("re-decoding %s: %s", self->type, self->error);
+		return NULL;
+	}
+
+	app_redecode_merge (self);
+	app_index_marks ();
+	return self->type;
+}
+
+/// Insert whitespace in front of an object that has been decoded from within
+/// another one, and compare the marks of the latter, decoded again,
+/// with its original marks moved along
+static bool
+bench_check_redecode (const char *dir)
+{
+	static const char *objects[] =
+	{
+		"1 0 obj\n<< /Type /Check >>\nendobj\n",
+		"2 0 obj\n<< /Length 3 0 R >>\nstream\nabc\nendstream\nendobj\n",
+		"3 0 obj\n3\nendobj\n",
+	};
+
+	struct str pdf = str_make ();
+	str_append (&pdf, "%PDF-1.4\n");
+	int64_t offsets[N_ELEMENTS (objects)];
+	for (size_t i = 0; i < N_ELEMENTS (objects); i++)
+	{
+		offsets[i] = pdf.len;
+		str_append (&pdf, objects[i]);
+	}
+
+	int64_t xref = pdf.len;
+	str_append_printf (&pdf, "xref\n0 %zu\n0000000000 65535 f \n",
+		N_ELEMENTS (objects) + 1);
+	for (size_t i = 0; i < N_ELEMENTS (objects); i++)
+		str_append_printf (&pdf, "%010" PRId64 " 00000 n \n", offsets[i]);
+	str_append_printf (&pdf, "trailer\n<< /Size %zu >>\nstartxref\n%"
+		PRId64 "\n%%%%EOF\n", N_ELEMENTS (objects) + 1, xref);
+	bench_check_load (dir, pdf.str);
+	str_free (&pdf);
+
+	g.lua = app_lua_new (true);
+	g.lua->data = g.data;
+	g.lua->data_len = g.data_len;
+	g.lua->data_offset = g.data_offset;
+	g.lua->on_mark = app_add_mark;
+
+	struct error *e = NULL;
+	if (!app_lua_decode_data (g.lua, "pdf", &e))
+	{
+		print_error ("decoding: %s", e->message);
+		error_free (e);
+		return false;
+	}
+	qsort (g.marks, g.marks_len, sizeof *g.marks, app_mark_cmp);
+	app_index_marks ();
+
+	// Everything from the insertion on moves, whatever contains it grows
+	struct str expected_strings = str_make ();
+	struct bench_check_mark *expected =
+		bench_check_marks_copy (&expected_strings);
+	size_t expected_len = g.marks_len;
+	int64_t at = offsets[1] + strlen ("2 0 obj\n<<");
+	for (size_t i = 0; i < expected_len; i++)
+	{
+		int64_t end = expected[i].offset + expected[i].len;
+		expected[i].offset += expected[i].offset >= at;
+		expected[i].len = end + (end > at) - expected[i].offset;
+	}
+	qsort (expected, expected_len, sizeof *expected, bench_check_mark_cmp);
+
+	app_edit (at, 0, " ", 1);
+	const char *type = bench_check_redecode_run ();
+	bool ok = type && !strcmp (type, "pdf-object");
+	if (type && !ok)
+		print_error ("re-decoded %s rather than the object", type);
+
+	struct str actual_strings = str_make ();
+	struct bench_check_mark *actual = bench_check_marks_copy (&actual_strings);
+	if (ok && g.marks_len != expected_len)
+	{
+		print_error ("re-decode: expected %zu marks, got %zu",
+			expected_len, g.marks_len);
+		ok = false;
+	}
+	for (size_t i = 0; ok && i < expected_len; i++)
+		if (bench_check_mark_cmp (&expected[i], &actual[i]))
+		{
+			print_error ("re-decode: expected \"%s\" at %" PRId64
+				"+%" PRId64 ", got \"%s\" at %" PRId64 "+%" PRId64,
+				expected[i].description, expected[i].offset, expected[i].len,
+				actual[i].description, actual[i].offset, actual[i].len);
+			ok = false;
+		}
+
+	free (expected);
+	free (actual);
+	str_free (&expected_strings);
+	str_free (&actual_strings);
+	return ok;
+}
+
+/// Run a check in a child process, for it to have a clean state
+static bool
+bench_check (bool (*check) (const char *dir), const char *dir)
+{
+	fflush (stdout);
+	pid_t child = fork ();
+	if (child < 0)
+		exit_fatal ("fork: %s", strerror (errno));
+	if (!child)
+		_exit (check (dir) ? EXIT_SUCCESS : EXIT_FAILURE);
+
+	int status = 0;
+	while (waitpid (child, &status, 0) < 0 && errno == EINTR)
+		;
+	return WIFEXITED (status) && WEXITSTATUS (status) == EXIT_SUCCESS;
+}
+
+// --- Main --------------------------------------------------------------------
+
+/// Make the plugin directory the only one to be found, by pointing
+/// the XDG base directories to a temporary one linking to it
+static void
+bench_use_plugins (const char *dir, const char *plugin_dir)
+{
+	char *parent = xstrdup_printf ("%s/" PROGRAM_NAME, dir);
+	char *link = xstrdup_printf ("%s/plugins", parent);
+	char *target = realpath (plugin_dir, NULL);
+	if (!target)
+		exit_fatal ("%s: %s", plugin_dir, strerror (errno));
+	if (mkdir (parent, 0777) || symlink (target, link))
+		exit_fatal ("%s: %s", link, strerror (errno));
+
+	setenv ("XDG_DATA_HOME", dir, true);
+	setenv ("XDG_DATA_DIRS", dir, true);
+	free (parent);
+	free (link);
+	free (target);
+}
+
+static void
+bench_clean_up (const char *dir)
+{
+	char *path = xstrdup_printf ("%s/" PROGRAM_NAME "/plugins", dir);
+	(void) unlink (path);
+	cstr_set (&path, xstrdup_printf ("%s/" PROGRAM_NAME, dir));
+	(void) rmdir (path);
+	free (path);
+	(void) rmdir (dir);
+}
+
+int
+main (int argc, char *argv[])
+{
+	static const struct opt opts[] =
+	{
+		{ 'h', "help", NULL, 0, "display this help and exit" },
+		{ 'V', "version", NULL, 0, "output version information and exit" },
+		{ 's', "scale", "FACTOR", 0, "multiply the size of inputs" },
+		{ 'p', "plugins", "DIR", 0, "use plugins from DIR" },
+		{ 't', "throughput", NULL, 0,
+		  "only measure decoding, checking how it scales" },
+		{ 'b', "baseline", "FILE", 0,
+		  "fail if throughput drops below that in FILE" },
+		{ 'w', "write-baseline", "FILE", 0, "save throughput to FILE" },
+		{ 'c', "check", NULL, 0, "check that edits are saved correctly" },
+		{ 'H', "hugepages", NULL, 0,
+		  "compare runs without and with huge pages" },
+		{ 0, NULL, NULL, 0, NULL }
+	};
+
+	struct opt_handler oh = opt_handler_make (argc, argv, opts, "[INPUT]...",
+		"Benchmarks for " PROGRAM_NAME ", writing out JSON Lines.");
+	double scale = 1;
+	const char *plugin_dir = BENCH_PLUGIN_DIR;
+	const char *save_path = NULL;
+	bool throughput = false, check = false, hugepages = false;
+	char *end = NULL;
+
+	int c;
+	while ((c = opt_handler_get (&oh)) != -1)
+	switch (c)
+	{
+	case 'h':
+		opt_handler_usage (&oh, stdout);
+		exit (EXIT_SUCCESS);
+	case 'V':
+		printf (PROGRAM_NAME "-bench " PROGRAM_VERSION "\n");
+		exit (EXIT_SUCCESS);
+	case 's':
+		scale = strtod (optarg, &end);
+		if (*end || !(scale > 0))
+			exit_fatal ("invalid scale factor specified");
+		break;
+	case 'p':
+		plugin_dir = optarg;
+		break;
+	case 't':
+		throughput = true;
+		break;
+	case 'b':
+		bench_load_baseline (optarg);
+		throughput = true;
+		break;
+	case 'w':
+		save_path = optarg;
+		throughput = true;
+		break;
+	case 'c':
+		check = true;
+		break;
+	case 'H':
+		hugepages = true;
+		break;
+	default:
+		print_error ("wrong options");
+		opt_handler_usage (&oh, stderr);
+		exit (EXIT_FAILURE);
+	}
+
+	argc -= optind;
+	argv += optind;
+	opt_handler_free (&oh);
+
+	if (!setlocale (LC_CTYPE, ""))
+		print_warning ("failed to set the locale");
+
+	const char *tmpdir = getenv ("TMPDIR");
+	char *dir = xstrdup_printf ("%s/" PROGRAM_NAME "-bench.XXXXXX",
+		tmpdir ? tmpdir : "/tmp");
+	if (!mkdtemp (dir))
+		exit_fatal ("%s: %s", dir, strerror (errno));
+	bench_use_plugins (dir, plugin_dir);
+
+	FILE *save = NULL;
+	if (save_path && !(save = fopen (save_path, "w")))
+		exit_fatal ("%s: %s", save_path, strerror (errno));
+
+	bool ok = true;
+	for (size_t i = 0; !check && i < N_ELEMENTS (g_bench_inputs); i++)
+	{
+		const struct bench_input *input = &g_bench_inputs[i];
+		bool selected = !argc;
+		for (int k = 0; k < argc; k++)
+			selected |= !strcmp (argv[k], input->name);
+		if (!selected)
+			continue;
+
+		if (throughput)
+		{
+			if (!bench_throughput (i, dir, scale, save))
+				ok = false;
+			continue;
+		}
+
+		// Children inherit the setting
+		char *path = bench_generate (input, dir, scale);
+		g.no_hugepages = hugepages;
+		if (hugepages && !bench_input (input, path, true).ok)
+			ok = false;
+		g.no_hugepages = false;
+		if (!bench_input (input, path, true).ok)
+			ok = false;
+		(void) unlink (path);
+		free (path);
+	}
+
+	if (check)
+	{
+		ok &= bench_check (bench_check_saving, dir);
+		ok &= bench_check (bench_check_search, dir);
+		ok &= bench_check (bench_check_redecode, dir);
+	}
+	if (save && fclose (save))
+		exit_fatal ("%s: %s", save_path, strerror (errno));
+	bench_clean_up (dir);
+	free (dir);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -32,6 +32,8 @@
 	XX( EVEN,       "even",       -1,  -1, 0                  ) \
 	XX( ODD,        "odd",        -1,  -1, 0                  ) \
 	XX( SELECTION,  "selection",  -1,  -1, A_REVERSE          ) \
+	XX( MATCH,      "match",      -1,  -1, A_REVERSE | A_BOLD ) \
+	XX( DIFF,       "diff",        1,  -1, A_BOLD             ) \
 	/* Field highlights                                      */ \
 	XX( C1,         "c1",         22, 194, 0                  ) \
 	XX( C2,         "c2",         88, 224, 0                  ) \
@@ -64,6 +66,14 @@ enum
 #include "liberty/liberty-xui.c"
 
 #include <locale.h>
+#include <math.h>
+#include <sys/ioctl.h>
+
+#if defined __SSE2__
+#include <emmintrin.h>
+#elif defined __ARM_NEON
+#include <arm_neon.h>
+#endif
 
 #ifdef WITH_LUA
 #include <dirent.h>
@@ -79,6 +89,21 @@ enum
 #endif
 #endif // WITH_LUA
 
+#ifdef __linux__
+#include <sys/sendfile.h>
+
+// This is Linux-specific, and our POSIX version macros hide it
+#ifndef MADV_HUGEPAGE
+#define MADV_HUGEPAGE 14
+int madvise (void *addr, size_t len, int advice);
+#endif // ! MADV_HUGEPAGE
+#endif // __linux__
+
+#ifdef WITH_URING
+#include <sys/eventfd.h>
+#include <liburing.h>
+#endif // WITH_URING
+
 #define APP_TITLE  PROGRAM_NAME         ///< Left top corner
 
 // --- Application -------------------------------------------------------------
@@ -99,6 +124,7 @@ struct mark
 	int64_t offset;                     ///< Offset of the mark
 	int64_t len;                        ///< Length of the mark
 	size_t description;                 ///< Textual description string offset
+	uint32_t decode;                    ///< Decode producing it, or UINT32_MAX
 };
 
 // XXX: can we avoid constructing the marks_by_offset lookup array?
@@ -114,6 +140,130 @@ struct marks_by_offset
 	int color;                          ///< Color of the area until next offset
 };
 
+enum { ROW_ADDRESS, ROW_HEX, ROW_ASCII, ROW_SECTIONS };
+
+struct app_row_run
+{
+	chtype attrs;                       ///< Attributes of the run
+	size_t text;                        ///< Offset of its text in "texts"
+};
+
+/// A laid out row of the view, kept around so that it can be reused
+struct app_row
+{
+	int64_t addr;                       ///< Address of the row, or -1
+	int64_t cursor;                     ///< Cursor, if it affects the row
+	bool skip_nibble;                   ///< Half-byte cursor offset
+	int attrs;                          ///< Base attributes of the row
+	int64_t selection_start;            ///< Selected part of the row, if any
+	int64_t selection_end;              ///< End of the selected part
+	unsigned generation;                ///< "g.generation" at layout time
+
+	struct str texts;                   ///< NUL-terminated texts of all runs
+	ARRAY (struct app_row_run, runs)    ///< Runs of text in all sections
+	size_t sections[ROW_SECTIONS + 1];  ///< Index of the first run of each
+	bool open;                          ///< The last run can be extended
+};
+
+/// A read-only memory mapping of a part of a regular file
+struct app_mapping
+{
+	void *address;                      ///< Start of the mapping, or NULL
+	size_t len;                         ///< Length of the mapping
+	uint8_t *data;                      ///< Requested data within the mapping
+	int64_t data_len;                   ///< Length of the requested data
+};
+
+/// A contiguous part of the edited data, taken from either the original data,
+/// or from storage for everything that has been typed in
+struct app_piece
+{
+	int64_t start;                      ///< Offset within the edited data
+	int64_t offset;                     ///< Offset within its source
+	int64_t len;                        ///< Length of the piece
+	bool added;                         ///< Comes from "added" storage
+};
+
+/// An entry in the undo journal, self-contained so that it never refers
+/// to the original data, which may change on disk when saving
+struct app_edit
+{
+	int64_t offset;                     ///< Where the edit took place
+	struct str removed;                 ///< Bytes that have been replaced
+	struct str inserted;                ///< Bytes that have replaced them
+};
+
+/// A single change of the data's layout, in file offsets
+struct app_splice
+{
+	int64_t offset;                     ///< Where the change took place
+	int64_t remove;                     ///< Number of bytes removed
+	int64_t insert;                     ///< Number of bytes inserted instead
+};
+
+enum edit_mode
+{
+	EDIT_NONE,                          ///< Keys are bound to actions
+	EDIT_REPLACE,                       ///< Hex digits overwrite nibbles
+	EDIT_INSERT                         ///< Hex digits insert new bytes
+};
+
+/// Timing of a single frame of the user interface
+struct app_frame
+{
+	int64_t layout_usec;                ///< Time spent in app_layout()
+	int64_t render_usec;                ///< Time spent rendering widgets
+	size_t widgets;                     ///< Number of widgets laid out
+};
+
+enum startup_phase
+{
+	STARTUP_PLUGINS,                    ///< Loading Lua plugins
+	STARTUP_READ,                       ///< Reading in the input
+	STARTUP_UI,                         ///< Starting up to the first layout
+	STARTUP_DECODE,                     ///< Decoding in the background
+	STARTUP_COUNT
+};
+
+/// A phase of starting up, timed in microseconds
+struct app_phase
+{
+	int64_t start;                      ///< When the phase has started
+	int64_t end;                        ///< When it has ended, or zero
+};
+
+#define MEMORY_TABLE(XX)                          \
+	XX( DATA,            "data"            ) \
+	XX( MARKS,           "marks"           ) \
+	XX( MARK_STRINGS,    "mark strings"    ) \
+	XX( OFFSET_ENTRIES,  "offset entries"  ) \
+	XX( MARKS_BY_OFFSET, "marks by offset" ) \
+	XX( WIDGETS,         "widgets"         ) \
+	XX( LUA,             "lua"             )
+
+enum memory_use
+{
+#define XX(name, label) MEMORY_ ## name,
+	MEMORY_TABLE (XX)
+#undef XX
+	MEMORY_COUNT
+};
+
+/// Memory used by a subsystem, updated atomically, as Lua runs in workers
+struct app_memory
+{
+	size_t current;                     ///< Bytes currently allocated
+	size_t peak;                        ///< Most bytes allocated at once
+	size_t allocations;                 ///< Number of (re)allocations
+};
+
+enum dump_format
+{
+	DUMP_NONE,                          ///< Marks are kept for the UI
+	DUMP_JSON,                          ///< JSON Lines on standard output
+	DUMP_TSV                            ///< Tab-separated values on output
+};
+
 static struct app_context
 {
 	// Event loop:
@@ -122,11 +272,10 @@ static struct app_context
 	bool polling;                       ///< The event loop is running
 
 	struct poller_fd signal_event;      ///< Signal FD event
+	pthread_t main_thread;              ///< The only one to touch the UI
 
 #ifdef WITH_LUA
-	lua_State *L;                       ///< Lua state
-	int ref_format;                     ///< Reference to "string.format"
-	struct str_map coders;              ///< Map of coders by name
+	struct app_lua *lua;                ///< Lua state for the main thread
 #endif // WITH_LUA
 
 	// Data:
@@ -134,14 +283,38 @@ static struct app_context
 	struct config config;               ///< Program configuration
 	char *filename;                     ///< Target filename
 
-	uint8_t *data;                      ///< Target data
-	int64_t data_len;                   ///< Length of the data
+	uint8_t *data;                      ///< Target data, as loaded
+	int64_t data_len;                   ///< Length of the data, as edited
 	int64_t data_offset;                ///< Offset of the data within the file
 
+	struct app_mapping mapping;         ///< The data is mapped in, if set
+	int64_t original_len;               ///< Length of the data, as loaded
+	int64_t saved_len;                  ///< Length of the data in the file
+	struct app_readahead *readahead;    ///< Read-ahead for mapped data
+
+	// Editing:
+
+	ARRAY (struct app_piece, pieces)    ///< Pieces making up edited data
+	struct str added;                   ///< Storage for typed in bytes
+	ARRAY (struct app_edit, edits)      ///< Undo journal
+	size_t edits_done;                  ///< Edits that haven't been undone
+	size_t edits_saved;                 ///< "edits_done" at the last save
+	bool file_in_sync;                  ///< Data is laid out as in the file
+	enum edit_mode edit_mode;           ///< Current editing mode
+
+#ifdef WITH_LUA
+	ARRAY (struct app_splice, splices)  ///< Changes not yet seen by decoders
+	struct poller_idle redecode_event;  ///< Catches decoders up with changes
+	struct app_redecode *redecode;      ///< Background re-decoding, if any
+	int64_t deferred_view_top;          ///< View last checked for deferred
+	int64_t deferred_view_end;          ///< End of that view
+#endif // WITH_LUA
+
 	// Field marking:
 
 	ARRAY (struct mark, marks)          ///< Marks
 	struct str mark_strings;            ///< Storage for mark descriptions
+	size_t mark_strings_dead;           ///< Storage taken by marks now gone
 
 	ARRAY (struct marks_by_offset, marks_by_offset)
 	ARRAY (struct mark *, offset_entries)
@@ -151,17 +324,59 @@ static struct app_context
 	int64_t view_top;                   ///< Offset of the top of the screen
 	int64_t view_cursor;                ///< Offset of the cursor
 	bool view_skip_nibble;              ///< Half-byte offset
+	int64_t view_anchor;                ///< Other end of selection, or -1
 
 	enum endianity endianity;           ///< Endianity
 
+	unsigned generation;                ///< Changes invalidate laid out rows
+	struct app_row *rows;               ///< Cache of laid out rows
+	size_t rows_len;                    ///< Number of cached rows
+
 	// User interface:
 
 	struct poller_timer message_timer;  ///< Message timeout
 	char *message;                      ///< Last logged message
+	int64_t input_deadline;             ///< Stop coalescing input after this
+	int pending_scroll;                 ///< Rows to scroll by when laid out
+	int pending_rows;                   ///< Rows to move the cursor by
+
+	struct app_overview *overview;      ///< Whole-file overview, if any
+
+	char prompt;                        ///< Active search prompt, or NUL
+	bool prompt_hex;                    ///< The prompt takes hex bytes
+	struct str prompt_text;             ///< Contents of the prompt
+	struct app_search *search;          ///< The last search, if any
+
+	struct app_diff *diff;              ///< Comparison with another input
+	struct app_field_index *fields;     ///< Index of mark descriptions
+	ARRAY (uint32_t, field_results)     ///< Marks found by the field prompt
+	bool field_results_more;            ///< Some results were left out
+	size_t field_selected;              ///< Selected index in "field_results"
 
 	int digitw;                         ///< Width of a single digit
 
 	struct attrs attrs[ATTRIBUTE_COUNT];
+
+	// Frame timing:
+
+	struct ui timed_ui;                 ///< UI with a timed render function
+	struct ui *real_ui;                 ///< The original UI
+	struct app_frame frame;             ///< The frame being drawn
+	struct app_frame last_frame;        ///< The last drawn frame
+
+	const char *replay;                 ///< Remaining keys to replay, if any
+	struct poller_idle replay_event;    ///< Replays the next key
+	ARRAY (struct app_frame, frames)    ///< All frames drawn while replaying
+
+	int64_t started;                    ///< When the program has started
+	struct app_phase startup[STARTUP_COUNT];
+
+	// Memory accounting:
+
+	struct app_memory memory[MEMORY_COUNT];
+	bool memory_stats;                  ///< Report memory use on exit
+	bool memory_overlay;                ///< Show memory use in the UI
+	bool no_hugepages;                  ///< Never ask for huge pages
 }
 g;
 
@@ -206,6 +421,7 @@ load_config_colors (struct config_item *subtree, void *user_data)
 		g.attrs[ATTRIBUTE_ ## name] = attrs_decode (value);
 	ATTRIBUTE_TABLE (XX)
 #undef XX
+	g.generation++;
 }
 
 static void
@@ -239,6 +455,136 @@ app_load_configuration (void)
 	}
 }
 
+// --- Memory accounting -------------------------------------------------------
+
+// Only buffers that can grow large are accounted for, and only as they grow,
+// so that tracking doesn't cost anything noticeable.
+
+static void
+app_memory_raise_peak (struct app_memory *self, size_t current)
+{
+	size_t peak = __atomic_load_n (&self->peak, __ATOMIC_RELAXED);
+	while (current > peak && !__atomic_compare_exchange_n (&self->peak,
+		&peak, current, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/// Account for a subsystem's buffer having been resized to "size" bytes
+static void
+app_memory_set (enum memory_use use, size_t size, size_t allocations)
+{
+	struct app_memory *self = &g.memory[use];
+	__atomic_store_n (&self->current, size, __ATOMIC_RELAXED);
+	__atomic_add_fetch (&self->allocations, allocations, __ATOMIC_RELAXED);
+	app_memory_raise_peak (self, size);
+}
+
+/// Account for a change in the amount of memory used by a subsystem
+static void
+app_memory_add (enum memory_use use, ssize_t delta, size_t allocations)
+{
+	struct app_memory *self = &g.memory[use];
+	size_t current =
+		__atomic_add_fetch (&self->current, delta, __ATOMIC_RELAXED);
+	__atomic_add_fetch (&self->allocations, allocations, __ATOMIC_RELAXED);
+	app_memory_raise_peak (self, current);
+}
+
+enum
+{
+	HUGEPAGE_SIZE      = 2 << 20,       ///< The usual size of a huge page
+	HUGEPAGE_THRESHOLD = 32 << 20       ///< Buffers worth a huge page hint
+};
+
+/// Ask for huge pages to back the aligned interior of a large buffer,
+/// so that random access across it doesn't keep missing the TLB.
+/// This is mere advice, ordinary pages are used when it is refused.
+static void
+app_hugepage_advise (void *p, size_t len)
+{
+#ifdef __linux__
+	if (g.no_hugepages || len < HUGEPAGE_THRESHOLD)
+		return;
+
+	uintptr_t mask = HUGEPAGE_SIZE - 1;
+	uintptr_t start = ((uintptr_t) p + mask) & ~mask;
+	uintptr_t end = ((uintptr_t) p + len) & ~mask;
+	if (start < end)
+		(void) madvise ((void *) start, end - start, MADV_HUGEPAGE);
+#else
+	(void) p;
+	(void) len;
+#endif // __linux__
+}
+
+/// Account for a subsystem's buffer having grown to "size" bytes,
+/// and have it backed by huge pages if it has become large enough
+static void
+app_memory_grown (enum memory_use use, void *p, size_t size)
+{
+	app_memory_set (use, size, 1);
+	app_hugepage_advise (p, size);
+}
+
+/// ARRAY_RESERVE() that accounts for the array, which must be the only one
+/// of its subsystem
+#define APP_ARRAY_RESERVE(use, a, n)                                          \
+	BLOCK_START                                                               \
+		size_t alloc_ = (a ## _alloc);                                        \
+		ARRAY_RESERVE (a, n);                                                 \
+		if ((a ## _alloc) != alloc_)                                          \
+			app_memory_grown ((use), (a), (a ## _alloc) * sizeof *(a));       \
+	BLOCK_END
+
+/// Format memory use of all subsystems as table rows, including a header
+static struct strv
+app_memory_report (void)
+{
+	static const char *labels[MEMORY_COUNT] =
+	{
+#define XX(name, label) label,
+		MEMORY_TABLE (XX)
+#undef XX
+	};
+
+	struct strv lines = strv_make ();
+	strv_append_owned (&lines, xstrdup_printf ("%-16s %14s %14s %12s",
+		"memory", "current", "peak", "allocations"));
+
+	size_t current = 0, peak = 0;
+	for (int i = 0; i < MEMORY_COUNT; i++)
+	{
+		struct app_memory m =
+		{
+			__atomic_load_n (&g.memory[i].current, __ATOMIC_RELAXED),
+			__atomic_load_n (&g.memory[i].peak, __ATOMIC_RELAXED),
+			__atomic_load_n (&g.memory[i].allocations, __ATOMIC_RELAXED),
+		};
+		strv_append_owned (&lines, xstrdup_printf ("%-16s %14zu %14zu %12zu",
+			labels[i], m.current, m.peak, m.allocations));
+		current += m.current;
+		peak += m.peak;
+	}
+
+	// The sum of peaks is an upper bound, they needn't have coincided
+	strv_append_owned (&lines, xstrdup_printf ("%-16s %14zu %14zu",
+		"total", current, peak));
+	return lines;
+}
+
+/// Print memory use to standard error, if requested
+static void
+app_memory_print (void)
+{
+	if (!g.memory_stats)
+		return;
+
+	struct strv lines = app_memory_report ();
+	for (size_t i = 0; i < lines.len; i++)
+		fprintf (stderr, "%s\n", lines.vector[i]);
+	strv_free (&lines);
+}
+
 // --- Application -------------------------------------------------------------
 
 static void
@@ -256,9 +602,25 @@ static bool
 app_on_insufficient_color (void)
 {
 	app_init_attributes ();
+	g.generation++;
 	return true;
 }
 
+static void
+app_row_init (struct app_row *self)
+{
+	self->addr = -1;
+	self->texts = str_make ();
+	ARRAY_INIT (self->runs);
+}
+
+static void
+app_row_free (struct app_row *self)
+{
+	str_free (&self->texts);
+	free (self->runs);
+}
+
 static void
 app_init_context (void)
 {
@@ -269,8 +631,30 @@ app_init_context (void)
 	g.mark_strings = str_make ();
 	ARRAY_INIT (g.marks_by_offset);
 	ARRAY_INIT (g.offset_entries);
+	app_memory_set (MEMORY_MARKS, g.marks_alloc * sizeof *g.marks, 1);
+	app_memory_set (MEMORY_MARK_STRINGS, g.mark_strings.alloc, 1);
+	app_memory_set (MEMORY_MARKS_BY_OFFSET,
+		g.marks_by_offset_alloc * sizeof *g.marks_by_offset, 1);
+	app_memory_set (MEMORY_OFFSET_ENTRIES,
+		g.offset_entries_alloc * sizeof *g.offset_entries, 1);
+
+	g.view_anchor = -1;
+	g.prompt_text = str_make ();
+	ARRAY_INIT (g.field_results);
+
+	ARRAY_INIT (g.pieces);
+	g.added = str_make ();
+	ARRAY_INIT (g.edits);
+	g.file_in_sync = true;
+#ifdef WITH_LUA
+	ARRAY_INIT (g.splices);
+#endif // WITH_LUA
+	if (g.data_len)
+		g.pieces[g.pieces_len++] =
+			(struct app_piece) { 0, 0, g.data_len, false };
 
 	app_init_attributes ();
+	ARRAY_INIT (g.frames);
 }
 
 static void
@@ -284,10 +668,32 @@ app_free_context (void)
 	free (g.marks_by_offset);
 	free (g.offset_entries);
 
+	for (size_t i = 0; i < g.rows_len; i++)
+		app_row_free (&g.rows[i]);
+	free (g.rows);
+
 	cstr_set (&g.message, NULL);
+	str_free (&g.prompt_text);
+	free (g.field_results);
+
+	free (g.pieces);
+	str_free (&g.added);
+	for (size_t i = 0; i < g.edits_len; i++)
+	{
+		str_free (&g.edits[i].removed);
+		str_free (&g.edits[i].inserted);
+	}
+	free (g.edits);
+#ifdef WITH_LUA
+	free (g.splices);
+#endif // WITH_LUA
+	free (g.frames);
 
 	cstr_set (&g.filename, NULL);
-	free (g.data);
+	if (g.mapping.address)
+		munmap (g.mapping.address, g.mapping.len);
+	else
+		free (g.data);
 }
 
 static void
@@ -296,6 +702,364 @@ app_quit (void)
 	g.polling = false;
 }
 
+// --- Worker threads ----------------------------------------------------------
+
+struct app_task;
+
+struct app_worker
+{
+	struct app_task *task;              ///< The task being processed
+	size_t index;                       ///< Index of this worker
+	pthread_t thread;                   ///< Thread ID
+};
+
+/// A number of independent jobs to be processed by a pool of threads
+struct app_task
+{
+	pthread_mutex_t lock;               ///< Protects the job counters
+	size_t jobs_len;                    ///< Total number of jobs
+	size_t jobs_next;                   ///< Index of the next job to run
+	size_t jobs_done;                   ///< Number of finished jobs
+	bool cancelled;                     ///< Don't start any further jobs
+
+	struct app_worker *workers;         ///< Worker threads
+	size_t workers_len;                 ///< Number of worker threads
+
+	/// Processes a single job; "worker" identifies the calling thread
+	void (*execute) (struct app_task *self, size_t worker, size_t job);
+	void *user_data;                    ///< User data for callbacks
+};
+
+static size_t
+app_cpu_count (void)
+{
+	long n = sysconf (_SC_NPROCESSORS_ONLN);
+	return n > 0 ? n : 1;
+}
+
+static void *
+app_task_worker (void *user_data)
+{
+	struct app_worker *worker = user_data;
+	struct app_task *task = worker->task;
+	while (true)
+	{
+		pthread_mutex_lock (&task->lock);
+		bool stop = task->cancelled || task->jobs_next == task->jobs_len;
+		size_t job = stop ? 0 : task->jobs_next++;
+		pthread_mutex_unlock (&task->lock);
+		if (stop)
+			break;
+
+		task->execute (task, worker->index, job);
+
+		pthread_mutex_lock (&task->lock);
+		task->jobs_done++;
+		pthread_mutex_unlock (&task->lock);
+	}
+	return NULL;
+}
+
+/// Start processing "jobs" jobs with at most "threads" threads
+static void
+app_task_start (struct app_task *self, size_t jobs, size_t threads)
+{
+	pthread_mutex_init (&self->lock, NULL);
+	self->jobs_len = jobs;
+	self->jobs_next = self->jobs_done = 0;
+	self->cancelled = false;
+
+	self->workers_len = MIN (MAX (threads, 1), jobs);
+	self->workers = xcalloc (self->workers_len, sizeof *self->workers);
+
+	// Leave all signal handling to the main thread
+	sigset_t all, old;
+	sigfillset (&all);
+	pthread_sigmask (SIG_BLOCK, &all, &old);
+	for (size_t i = 0; i < self->workers_len; i++)
+	{
+		struct app_worker *worker = &self->workers[i];
+		worker->task = self;
+		worker->index = i;
+
+		int err = pthread_create
+			(&worker->thread, NULL, app_task_worker, worker);
+		if (err)
+			exit_fatal ("%s: %s", "pthread_create", strerror (err));
+	}
+	pthread_sigmask (SIG_SETMASK, &old, NULL);
+}
+
+/// Return the number of finished jobs, which grows as the task progresses
+static size_t
+app_task_jobs_done (struct app_task *self)
+{
+	pthread_mutex_lock (&self->lock);
+	size_t done = self->jobs_done;
+	pthread_mutex_unlock (&self->lock);
+	return done;
+}
+
+/// Return whether the task has been cancelled, for long jobs to give up early
+static bool
+app_task_cancelled (struct app_task *self)
+{
+	pthread_mutex_lock (&self->lock);
+	bool cancelled = self->cancelled;
+	pthread_mutex_unlock (&self->lock);
+	return cancelled;
+}
+
+/// Wait until all jobs have been processed, or the task has been cancelled
+static void
+app_task_wait (struct app_task *self)
+{
+	for (size_t i = 0; i < self->workers_len; i++)
+		pthread_join (self->workers[i].thread, NULL);
+
+	free (self->workers);
+	self->workers = NULL;
+	self->workers_len = 0;
+	pthread_mutex_destroy (&self->lock);
+}
+
+static void
+app_task_cancel (struct app_task *self)
+{
+	pthread_mutex_lock (&self->lock);
+	self->cancelled = true;
+	pthread_mutex_unlock (&self->lock);
+	app_task_wait (self);
+}
+
+// --- Pattern matching --------------------------------------------------------
+
+/// Find the first occurrence of "needle" in "haystack".  Candidate positions
+/// are found by comparing both the first and the last byte of the needle
+/// against whole vectors at once, which quickly skips over most of the data.
+static const uint8_t *
+app_memmem (const uint8_t *haystack, size_t haystack_len,
+	const uint8_t *needle, size_t needle_len)
+{
+	if (!needle_len)
+		return haystack;
+	if (needle_len > haystack_len)
+		return NULL;
+	if (needle_len == 1)
+		return memchr (haystack, *needle, haystack_len);
+
+	// Candidates may start anywhere in [0, end)
+	size_t last = needle_len - 1, end = haystack_len - last, i = 0;
+#if defined __SSE2__
+	__m128i first_v = _mm_set1_epi8 (needle[0]);
+	__m128i last_v = _mm_set1_epi8 (needle[last]);
+	for (; i + 16 <= end; i += 16)
+	{
+		__m128i a = _mm_loadu_si128 ((const __m128i *) (haystack + i));
+		__m128i b = _mm_loadu_si128 ((const __m128i *) (haystack + i + last));
+		unsigned mask = _mm_movemask_epi8 (_mm_and_si128
+			(_mm_cmpeq_epi8 (a, first_v), _mm_cmpeq_epi8 (b, last_v)));
+		for (; mask; mask &= mask - 1)
+		{
+			const uint8_t *p = haystack + i + __builtin_ctz (mask);
+			if (!memcmp (p + 1, needle + 1, last - 1))
+				return p;
+		}
+	}
+#elif defined __ARM_NEON
+	uint8x16_t first_v = vdupq_n_u8 (needle[0]);
+	uint8x16_t last_v = vdupq_n_u8 (needle[last]);
+	for (; i + 16 <= end; i += 16)
+	{
+		uint8x16_t eq = vandq_u8
+			(vceqq_u8 (vld1q_u8 (haystack + i), first_v),
+			 vceqq_u8 (vld1q_u8 (haystack + i + last), last_v));
+
+		// There is no movemask, narrow each byte down to a nibble instead
+		uint64_t mask = vget_lane_u64 (vreinterpret_u64_u8
+			(vshrn_n_u16 (vreinterpretq_u16_u8 (eq), 4)), 0);
+		while (mask)
+		{
+			int nibble = __builtin_ctzll (mask) / 4;
+			const uint8_t *p = haystack + i + nibble;
+			if (!memcmp (p + 1, needle + 1, last - 1))
+				return p;
+			mask &= ~(UINT64_C (0xf) << nibble * 4);
+		}
+	}
+#endif
+	for (; i < end; i++)
+		if (haystack[i] == needle[0] && haystack[i + last] == needle[last]
+		 && !memcmp (haystack + i + 1, needle + 1, last - 1))
+			return haystack + i;
+	return NULL;
+}
+
+// --- Hex formatting ----------------------------------------------------------
+
+/// Turn "len" bytes into "2 * len" lowercase hexadecimal digits in "hex",
+/// and "len" characters in "ascii", with non-printables replaced by dots.
+/// Neither output is NUL-terminated.
+static void
+app_format_hex (const uint8_t *in, size_t len, char *hex, char *ascii)
+{
+	size_t i = 0;
+#if defined __SSE2__
+	const __m128i nibble = _mm_set1_epi8 (0x0f), nine = _mm_set1_epi8 (9);
+	const __m128i zero = _mm_set1_epi8 ('0');
+	const __m128i gap = _mm_set1_epi8 ('a' - '9' - 1);
+	const __m128i space = _mm_set1_epi8 (31), del = _mm_set1_epi8 (127);
+	const __m128i dot = _mm_set1_epi8 ('.');
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i v = _mm_loadu_si128 ((const __m128i *) (in + i));
+		__m128i hi = _mm_and_si128 (_mm_srli_epi16 (v, 4), nibble);
+		__m128i lo = _mm_and_si128 (v, nibble);
+
+		// Digits above nine need to skip over to the letters
+		hi = _mm_add_epi8 (_mm_add_epi8 (hi, zero),
+			_mm_and_si128 (_mm_cmpgt_epi8 (hi, nine), gap));
+		lo = _mm_add_epi8 (_mm_add_epi8 (lo, zero),
+			_mm_and_si128 (_mm_cmpgt_epi8 (lo, nine), gap));
+		_mm_storeu_si128 ((__m128i *) (hex + 2 * i),
+			_mm_unpacklo_epi8 (hi, lo));
+		_mm_storeu_si128 ((__m128i *) (hex + 2 * i + 16),
+			_mm_unpackhi_epi8 (hi, lo));
+
+		// The comparisons are signed, so bytes above 127 count as negative
+		__m128i printable = _mm_and_si128
+			(_mm_cmpgt_epi8 (v, space), _mm_cmplt_epi8 (v, del));
+		_mm_storeu_si128 ((__m128i *) (ascii + i), _mm_or_si128
+			(_mm_and_si128 (printable, v), _mm_andnot_si128 (printable, dot)));
+	}
+#elif defined __ARM_NEON
+	const uint8x16_t nibble = vdupq_n_u8 (0x0f), nine = vdupq_n_u8 (9);
+	const uint8x16_t zero = vdupq_n_u8 ('0');
+	const uint8x16_t gap = vdupq_n_u8 ('a' - '9' - 1);
+	const uint8x16_t space = vdupq_n_u8 (32), del = vdupq_n_u8 (127);
+	const uint8x16_t dot = vdupq_n_u8 ('.');
+	for (; i + 16 <= len; i += 16)
+	{
+		uint8x16_t v = vld1q_u8 (in + i);
+		uint8x16_t hi = vshrq_n_u8 (v, 4), lo = vandq_u8 (v, nibble);
+
+		// Digits above nine need to skip over to the letters
+		uint8x16x2_t digits;
+		digits.val[0] = vaddq_u8 (vaddq_u8 (hi, zero),
+			vandq_u8 (vcgtq_u8 (hi, nine), gap));
+		digits.val[1] = vaddq_u8 (vaddq_u8 (lo, zero),
+			vandq_u8 (vcgtq_u8 (lo, nine), gap));
+		vst2q_u8 ((uint8_t *) hex + 2 * i, digits);
+
+		uint8x16_t printable =
+			vandq_u8 (vcgeq_u8 (v, space), vcltq_u8 (v, del));
+		vst1q_u8 ((uint8_t *) ascii + i, vbslq_u8 (printable, v, dot));
+	}
+#endif
+	static const char hexa[] = "0123456789abcdef";
+	for (; i < len; i++)
+	{
+		uint8_t c = in[i];
+		hex[2 * i] = hexa[c >> 4];
+		hex[2 * i + 1] = hexa[c & 0xf];
+		ascii[i] = (c >= 32 && c < 127) ? c : '.';
+	}
+}
+
+// --- Input -------------------------------------------------------------------
+
+/// Map in up to "size_limit" bytes from "offset" of a regular file,
+/// returning false when that isn't possible or there is nothing to map
+static bool
+app_map_file (int fd, int64_t offset, int64_t size_limit,
+	struct app_mapping *out)
+{
+	struct stat st = {};
+	if (fstat (fd, &st) || !S_ISREG (st.st_mode)
+	 || st.st_size <= offset || size_limit <= 0)
+		return false;
+
+	int64_t page_size = sysconf (_SC_PAGESIZE);
+	int64_t start = offset / page_size * page_size;
+	int64_t len = MIN (st.st_size - offset, size_limit);
+
+	size_t mapping_len = offset - start + len;
+	void *mapping = mmap (NULL, mapping_len, PROT_READ, MAP_PRIVATE,
+		fd, start);
+	if (mapping == MAP_FAILED)
+		return false;
+
+	// Page cache can only be collapsed into huge pages on some systems
+	app_hugepage_advise (mapping, mapping_len);
+	out->address = mapping;
+	out->len = mapping_len;
+	out->data = (uint8_t *) mapping + (offset - start);
+	out->data_len = len;
+	return true;
+}
+
+/// Read up to "size_limit" bytes from "offset" of a file or a pipe
+static bool
+app_read_fd (int fd, int64_t offset, int64_t size_limit, struct str *out,
+	struct error **e)
+{
+	// Seek in the file or pipe however we can
+	char seek_buf[8192];
+	if (lseek (fd, offset, SEEK_SET) == (off_t) -1)
+		for (uint64_t remaining = offset; remaining; )
+		{
+			ssize_t n_read = read (fd,
+				seek_buf, MIN (remaining, sizeof seek_buf));
+			if (n_read <= 0)
+			{
+				error_set (e, "cannot seek: %s", strerror (errno));
+				return false;
+			}
+			remaining -= n_read;
+		}
+
+	while (out->len < (size_t) size_limit)
+	{
+		// Advise before reading, so that the new pages are faulted in huge
+		size_t alloc = out->alloc;
+		str_reserve (out, 8192);
+		if (out->alloc != alloc)
+			app_hugepage_advise (out->str, out->alloc);
+		ssize_t n_read = read (fd, out->str + out->len,
+			MIN (size_limit - out->len, out->alloc - out->len));
+		if (!n_read)
+			break;
+		if (n_read == -1)
+		{
+			error_set (e, "cannot read input: %s", strerror (errno));
+			return false;
+		}
+		out->len += n_read;
+	}
+	return true;
+}
+
+/// Map in or read the input, whichever works, exiting on failure
+static void
+app_load (int fd, int64_t offset, int64_t size_limit,
+	struct app_mapping *mapping, uint8_t **data, int64_t *data_len)
+{
+	if (app_map_file (fd, offset, size_limit, mapping))
+	{
+		*data = mapping->data;
+		*data_len = mapping->data_len;
+		return;
+	}
+
+	struct error *e = NULL;
+	struct str buf = str_make ();
+	if (!app_read_fd (fd, offset, size_limit, &buf, &e))
+		exit_fatal ("%s", e->message);
+
+	*data = (uint8_t *) buf.str;
+	*data_len = buf.len;
+}
+
 // --- Field marking -----------------------------------------------------------
 
 /// Find the "marks_by_offset" span covering the offset (if any)
@@ -339,16 +1103,35 @@ app_mark_cmp (const void *first, const void *second)
 	return 0;
 }
 
-static size_t
-app_store_marks (struct mark **entries, size_t len)
+/// Record a mark for display, making a copy of its description
+static void
+app_add_mark (void *user_data,
+	int64_t offset, int64_t len, uint32_t decode, const char *desc)
 {
-	size_t result = g.offset_entries_len;
-	ARRAY_RESERVE (g.offset_entries, len);
-	memcpy (g.offset_entries + g.offset_entries_len, entries,
-		sizeof *entries * len);
-	g.offset_entries_len += len;
-	return result;
-}
+	(void) user_data;
+
+	APP_ARRAY_RESERVE (MEMORY_MARKS, g.marks, 1);
+	g.marks[g.marks_len++] =
+		(struct mark) { offset, len, g.mark_strings.len, decode };
+
+	size_t alloc = g.mark_strings.alloc;
+	str_append (&g.mark_strings, desc);
+	str_append_c (&g.mark_strings, 0);
+	if (g.mark_strings.alloc != alloc)
+		app_memory_grown (MEMORY_MARK_STRINGS,
+			g.mark_strings.str, g.mark_strings.alloc);
+}
+
+static size_t
+app_store_marks (struct mark **entries, size_t len)
+{
+	size_t result = g.offset_entries_len;
+	APP_ARRAY_RESERVE (MEMORY_OFFSET_ENTRIES, g.offset_entries, len);
+	memcpy (g.offset_entries + g.offset_entries_len, entries,
+		sizeof *entries * len);
+	g.offset_entries_len += len;
+	return result;
+}
 
 /// Flattens marks into sequential non-overlapping spans suitable for search
 /// by offset, assigning different colors to them in the process:
@@ -359,10 +1142,13 @@ app_store_marks (struct mark **entries, size_t len)
 ///  ___ ____ __ _ _____ ___ ___
 /// |___|____|__|_|_____|___|___|
 /// @endcode
+/// The marks need to be sorted by app_mark_cmp().
 static void
-app_flatten_marks (void)
+app_index_marks (void)
 {
-	qsort (g.marks, g.marks_len, sizeof *g.marks, app_mark_cmp);
+	g.marks_by_offset_len = 0;
+	g.offset_entries_len = 0;
+	g.generation++;
 	if (!g.marks_len)
 		return;
 
@@ -411,771 +1197,4859 @@ app_flatten_marks (void)
 			current_color %= 4;
 		}
 
-		ARRAY_RESERVE (g.marks_by_offset, 1);
+		APP_ARRAY_RESERVE (MEMORY_MARKS_BY_OFFSET, g.marks_by_offset, 1);
 		g.marks_by_offset[g.marks_by_offset_len++] =
 			(struct marks_by_offset) { closest, marks, color };
 	}
 	free (current);
 }
 
-// --- Layouting ---------------------------------------------------------------
+/// Map an offset from before a splice to after it; offsets within
+/// the removed range are kept within the inserted one
+static int64_t
+app_splice_map (const struct app_splice *s, int64_t offset)
+{
+	if (offset < s->offset)
+		return offset;
+	if (offset >= s->offset + s->remove)
+		return offset - s->remove + s->insert;
+	return s->offset + MIN (offset - s->offset, s->insert);
+}
+
+/// Move marks along with the data they describe, dropping emptied ones.
+/// The mapping is monotonic, so the marks stay sorted.
+static void
+app_shift_marks (const struct app_splice *s)
+{
+	if (s->remove == s->insert)
+		return;
+
+	size_t kept = 0;
+	for (size_t i = 0; i < g.marks_len; i++)
+	{
+		struct mark *mark = &g.marks[i];
+		int64_t end = app_splice_map (s, mark->offset + mark->len);
+		mark->offset = app_splice_map (s, mark->offset);
+		if ((mark->len = end - mark->offset) > 0)
+			g.marks[kept++] = *mark;
+	}
+	g.marks_len = kept;
+}
+
+// --- Field index -------------------------------------------------------------
+
+// Trigrams of mark descriptions are hashed into buckets, each of which lists
+// all marks containing any of its trigrams, in order.  A query only needs to
+// verify candidates from the smallest bucket of all of its trigrams.
+//
+// The index is built in the background, and queries go through all marks
+// until it is ready.  Marks must not change while it is being built.
 
 enum
 {
-	WIDGET_NONE = 0, WIDGET_HEX, WIDGET_ASCII, WIDGET_ENDIANITY,
+	FIELD_INDEX_BITS = 20,              ///< Bits of trigram hashes used
+	FIELD_INDEX_BUCKETS = 1 << FIELD_INDEX_BITS, ///< Number of buckets
+	FIELD_INDEX_STRIDE = 1 << 16,       ///< Marks between cancellation checks
+	FIELD_INDEX_POLL_MS = 20            ///< Progress polling interval
 };
 
-struct layout
+struct app_field_index
 {
-	struct widget *head;
-	struct widget *tail;
+	struct app_task task;               ///< Background indexing
+	bool running;                       ///< The task is still running
+	bool ready;                         ///< The index can be used
+	struct poller_timer timer;          ///< Polls the task for completion
+
+	size_t marks_len;                   ///< Number of marks indexed
+	uint32_t *buckets;                  ///< Start of each bucket in "postings"
+	uint32_t *postings;                 ///< Mark indexes for all buckets
 };
 
-static struct widget *
-app_label (chtype attrs, const char *label)
+static uint32_t
+app_field_index_bucket (const char *s)
 {
-	return g_xui.ui->label (attrs, 0, label);
+	uint32_t trigram = (uint32_t) (uint8_t) tolower_ascii (s[0]) << 16
+		| (uint32_t) (uint8_t) tolower_ascii (s[1]) << 8
+		| (uint32_t) (uint8_t) tolower_ascii (s[2]);
+	return (trigram * UINT32_C (2654435761)) >> (32 - FIELD_INDEX_BITS);
 }
 
-static struct widget *
-app_mono_label (chtype attrs, const char *label)
+static void
+app_field_index_execute (struct app_task *task, size_t worker, size_t job)
 {
-	return g_xui.ui->label (attrs, XUI_ATTR_MONOSPACE, label);
+	(void) worker;
+	(void) job;
+
+	struct app_field_index *self = task->user_data;
+	self->buckets = xcalloc (FIELD_INDEX_BUCKETS + 1, sizeof *self->buckets);
+
+	// The first pass counts marks in each bucket, the second one fills them;
+	// "last" serves to list each mark only once per bucket
+	uint32_t *last = xcalloc (FIELD_INDEX_BUCKETS, sizeof *last);
+	for (size_t i = 0; i < g.marks_len; i++)
+	{
+		if (!(i % FIELD_INDEX_STRIDE) && app_task_cancelled (task))
+			goto out;
+
+		const char *s = g.mark_strings.str + g.marks[i].description;
+		for (; s[0] && s[1] && s[2]; s++)
+		{
+			uint32_t bucket = app_field_index_bucket (s);
+			if (last[bucket] != i + 1)
+			{
+				last[bucket] = i + 1;
+				self->buckets[bucket + 1]++;
+			}
+		}
+	}
+	for (size_t i = 0; i < FIELD_INDEX_BUCKETS; i++)
+		self->buckets[i + 1] += self->buckets[i];
+
+	self->postings = xcalloc (MAX (self->buckets[FIELD_INDEX_BUCKETS], 1),
+		sizeof *self->postings);
+	memcpy (last, self->buckets, FIELD_INDEX_BUCKETS * sizeof *last);
+	for (size_t i = 0; i < g.marks_len; i++)
+	{
+		if (!(i % FIELD_INDEX_STRIDE) && app_task_cancelled (task))
+			goto out;
+
+		const char *s = g.mark_strings.str + g.marks[i].description;
+		for (; s[0] && s[1] && s[2]; s++)
+		{
+			uint32_t bucket = app_field_index_bucket (s);
+			if (last[bucket] == self->buckets[bucket]
+			 || self->postings[last[bucket] - 1] != i)
+				self->postings[last[bucket]++] = i;
+		}
+	}
+out:
+	free (last);
 }
 
-static struct widget *
-app_mono_padding (chtype attrs, float width, float height)
+static void
+app_on_field_index_timer (void *user_data)
 {
-	struct widget *w = g_xui.ui->padding (attrs, width, height);
-	w->width = width * g.digitw;
-	return w;
+	struct app_field_index *self = user_data;
+	if (!app_task_jobs_done (&self->task))
+	{
+		poller_timer_set (&self->timer, FIELD_INDEX_POLL_MS);
+		return;
+	}
+
+	app_task_wait (&self->task);
+	self->running = false;
+	self->ready = true;
 }
 
-static struct widget *
-app_push (struct layout *l, struct widget *w)
+/// Throw the index away, as marks are about to change
+static void
+app_field_index_stop (struct app_field_index *self)
 {
-	LIST_APPEND_WITH_TAIL (l->head, l->tail, w);
-	return w;
+	if (self->running)
+		app_task_cancel (&self->task);
+	poller_timer_reset (&self->timer);
+	self->running = self->ready = false;
+
+	free (self->buckets);
+	free (self->postings);
+	self->buckets = self->postings = NULL;
 }
 
-static struct widget *
-app_push_hfill (struct layout *l, struct widget *w)
+/// Index marks anew, in the background
+static void
+app_field_index_start (struct app_field_index *self)
 {
-	w->width = -1;
-	return app_push (l, w);
+	app_field_index_stop (self);
+	self->marks_len = g.marks_len;
+	self->task.execute = app_field_index_execute;
+	self->task.user_data = self;
+	app_task_start (&self->task, 1, 1);
+	self->running = true;
+	poller_timer_set (&self->timer, FIELD_INDEX_POLL_MS);
 }
 
-static struct widget *
-app_push_vfill (struct layout *l, struct widget *w)
+static void
+app_field_index_free (struct app_field_index *self)
 {
-	w->height = -1;
-	return app_push (l, w);
+	app_field_index_stop (self);
+	free (self);
 }
 
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-
-static int
-app_visible_rows (void)
+static struct app_field_index *
+app_field_index_new (void)
 {
-	int occupied = 1 /* bar */ + 3 /* decoder */;
-	return MAX (0, g_xui.height - occupied * g_xui.vunit) / g_xui.vunit;
+	struct app_field_index *self = xcalloc (1, sizeof *self);
+	self->timer = poller_timer_make (&g.poller);
+	self->timer.dispatcher = app_on_field_index_timer;
+	self->timer.user_data = self;
+	return self;
 }
 
-static inline void
-app_layout_cell (struct layout *hex, struct layout *ascii, int attrs,
-	int64_t addr)
+/// ASCII case-insensitive substring check
+static bool
+app_field_matches (const char *description, const char *query)
 {
-	const char *hexa = "0123456789abcdef";
-
-	struct marks_by_offset *marks = app_marks_at_offset (addr);
-	int attrs_mark = attrs;
-	if (marks && marks->color >= 0)
-		attrs_mark = g.attrs[marks->color].attrs;
+	for (; *description; description++)
+	{
+		size_t i = 0;
+		while (query[i] && tolower_ascii (description[i])
+			== tolower_ascii (query[i]))
+			i++;
+		if (!query[i])
+			return true;
+	}
+	return !*query;
+}
 
-	if (addr >= g.view_cursor
-	 && addr <  g.view_cursor + 8)
+static bool
+app_field_try (uint32_t mark, const char *query, size_t limit)
+{
+	if (!app_field_matches (g.mark_strings.str + g.marks[mark].description,
+		query))
+		return true;
+	if (g.field_results_len == limit)
 	{
-		attrs      |= A_UNDERLINE;
-		attrs_mark |= A_UNDERLINE;
+		g.field_results_more = true;
+		return false;
 	}
 
-	// TODO: leave it up to the user to decide what should be colored
-	uint8_t cell = g.data[addr - g.data_offset];
-	if (addr != g.view_cursor)
+	ARRAY_RESERVE (g.field_results, 1);
+	g.field_results[g.field_results_len++] = mark;
+	return true;
+}
+
+/// Find up to "limit" marks whose descriptions contain the query
+static void
+app_field_filter (const char *query, size_t limit)
+{
+	g.field_results_len = 0;
+	g.field_results_more = false;
+	g.field_selected = 0;
+
+	if (!g.fields)
 	{
-		char s[] = { hexa[cell >> 4], hexa[cell & 0xf], 0 };
-		app_push (hex, app_mono_label (attrs, s));
+		g.fields = app_field_index_new ();
+		app_field_index_start (g.fields);
 	}
-	else if (g.view_skip_nibble)
+
+	// Queries too short to have trigrams have to go through all marks,
+	// and so does everything until the index is ready
+	struct app_field_index *self = g.fields;
+	if (!self->ready || self->marks_len != g.marks_len || strlen (query) < 3)
 	{
-		char s1[] = { hexa[cell >> 4], 0 }, s2[] = { hexa[cell & 0xf], 0 };
-		app_push (hex, app_mono_label (attrs, s1));
-		app_push (hex, app_mono_label (attrs ^ A_REVERSE, s2));
+		for (size_t i = 0; i < g.marks_len; i++)
+			if (!app_field_try (i, query, limit))
+				return;
+		return;
 	}
-	else
+
+	size_t from = 0, to = 0;
+	for (const char *s = query; s[0] && s[1] && s[2]; s++)
 	{
-		char s1[] = { hexa[cell >> 4], 0 }, s2[] = { hexa[cell & 0xf], 0 };
-		app_push (hex, app_mono_label (attrs ^ A_REVERSE, s1));
-		app_push (hex, app_mono_label (attrs, s2));
+		uint32_t bucket = app_field_index_bucket (s);
+		if (s == query || self->buckets[bucket + 1] - self->buckets[bucket]
+			< to - from)
+		{
+			from = self->buckets[bucket];
+			to = self->buckets[bucket + 1];
+		}
 	}
 
-	char s[] = { (cell >= 32 && cell < 127) ? cell : '.', 0 };
-	app_push (ascii, app_mono_label (attrs_mark, s));
+	for (size_t i = from; i < to; i++)
+		if (!app_field_try (self->postings[i], query, limit))
+			return;
 }
 
-// XXX: This per-character layouting is very inefficient, but not extremely so.
-static struct widget *
-app_layout_row (int64_t addr, int y, int attrs)
+// --- Dumping -----------------------------------------------------------------
+
+// Marks are written out as soon as decoders produce them, so that arbitrarily
+// large inputs can be processed without holding all of them in memory.
+
+struct app_dump
 {
-	struct layout l = {};
-	char *row_addr_str = xstrdup_printf ("%08" PRIx64, addr);
-	app_push (&l, app_mono_label (attrs, row_addr_str));
-	free (row_addr_str);
+	enum dump_format format;            ///< Output format
+	const char *filename;               ///< Input name to include, if any
+	FILE *fp;                           ///< Output stream
+	struct str buf;                     ///< Formatting buffer
+};
 
-	struct layout hex = {};
-	struct layout ascii = {};
-	app_push (&ascii, app_mono_padding (attrs, 2, 1));
+/// Return the length of a valid UTF-8 sequence of more than one byte at "s",
+/// or zero if there is none
+static size_t
+app_utf8_sequence_len (const uint8_t *s)
+{
+	size_t len = 0;
+	uint32_t cp = 0;
+	if      (s[0] >= 0xc2 && s[0] <= 0xdf) { len = 2; cp = s[0] & 0x1f; }
+	else if (s[0] >= 0xe0 && s[0] <= 0xef) { len = 3; cp = s[0] & 0x0f; }
+	else if (s[0] >= 0xf0 && s[0] <= 0xf4) { len = 4; cp = s[0] & 0x07; }
+	else
+		return 0;
 
-	int64_t end_addr = g.data_offset + g.data_len;
-	for (int x = 0; x < ROW_SIZE; x++)
+	for (size_t i = 1; i < len; i++)
 	{
-		if (x % 8 == 0) app_push (&hex, app_mono_padding (attrs, 1, 1));
-		if (x % 2 == 0) app_push (&hex, app_mono_padding (attrs, 1, 1));
+		if ((s[i] & 0xc0) != 0x80)
+			return 0;
+		cp = cp << 6 | (s[i] & 0x3f);
+	}
 
-		int64_t cell_addr = addr + x;
-		if (cell_addr < g.data_offset
-		 || cell_addr >= end_addr)
+	// Reject overlong forms, surrogates, and what lies beyond Unicode
+	if ((len == 3 && cp < 0x800) || (len == 4 && cp < 0x10000)
+	 || (cp >= 0xd800 && cp <= 0xdfff) || cp > 0x10ffff)
+		return 0;
+	return len;
+}
+
+static void
+app_dump_json_string (struct str *out, const char *s)
+{
+	str_append_c (out, '"');
+	for (; *s; s++)
+	{
+		unsigned char c = *s;
+		size_t len = c < 0x80 ? 1 : app_utf8_sequence_len ((const uint8_t *) s);
+		if (len > 1)
 		{
-			app_push (&hex,   app_mono_padding (attrs, 2, 1));
-			app_push (&ascii, app_mono_padding (attrs, 1, 1));
+			str_append_data (out, s, len);
+			s += len - 1;
 		}
+		else if (c >= 0x80)
+			str_append_printf (out, "\\u%04x", c);
+		else if (c == '"' || c == '\\')
+			str_append_printf (out, "\\%c", c);
+		else if (c == '\n')
+			str_append (out, "\\n");
+		else if (c == '\t')
+			str_append (out, "\\t");
+		else if (c < 32 || c == 127)
+			str_append_printf (out, "\\u%04x", c);
 		else
-			app_layout_cell (&hex, &ascii, attrs, cell_addr);
+			str_append_c (out, c);
 	}
-
-	struct widget *w = NULL;
-	app_push (&l, (w = xui_hbox (hex.head)))->widget_id = WIDGET_HEX;
-	w->userdata = y;
-	app_push (&l, (w = xui_hbox (ascii.head)))->widget_id = WIDGET_ASCII;
-	w->userdata = y;
-	return xui_hbox (l.head);
+	str_append_c (out, '"');
 }
 
-static struct widget *
-app_layout_view (void)
+static void
+app_dump_tsv_string (struct str *out, const char *s)
 {
-	struct layout l = {};
-	int64_t end_addr = g.data_offset + g.data_len;
-	for (int y = 0; y <= app_visible_rows (); y++)
+	for (; *s; s++)
 	{
-		int64_t addr = g.view_top + y * ROW_SIZE;
-		if (addr >= end_addr)
-			break;
-
-		int attrs = (addr / ROW_SIZE & 1) ? APP_ATTR (ODD) : APP_ATTR (EVEN);
-		app_push (&l, app_layout_row (addr, y, attrs));
+		if      (*s == '\\') str_append (out, "\\\\");
+		else if (*s == '\t') str_append (out, "\\t");
+		else if (*s == '\n') str_append (out, "\\n");
+		else if (*s == '\r') str_append (out, "\\r");
+		else                 str_append_c (out, *s);
 	}
-	return xui_vbox (l.head);
 }
 
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-
-static struct widget *
-app_layout_info (void)
+/// Write out a single mark.  Each record is passed to stdio in one call,
+/// so that several threads may share the same output stream.
+static void
+app_dump_mark (void *user_data,
+	int64_t offset, int64_t len, uint32_t decode, const char *desc)
 {
-	const struct marks_by_offset *marks;
-	struct layout l = {};
-	if (!(marks = app_marks_at_offset (g.view_cursor)))
-		goto out;
+	(void) decode;
 
-	struct mark *mark, **iter = g.offset_entries + marks->marks;
-	for (int y = 0; y <= app_visible_rows (); y++)
+	struct app_dump *self = user_data;
+	struct str *out = &self->buf;
+	switch (self->format)
 	{
-		// TODO: we can use the field background
-		// TODO: we can keep going through subsequent fields to fill the column
-		if (!(mark = *iter++))
-			break;
-
-		const char *description = g.mark_strings.str + mark->description;
-		app_push (&l, app_label (0, description));
+	case DUMP_JSON:
+		str_append_c (out, '{');
+		if (self->filename)
+		{
+			str_append (out, "\"file\": ");
+			app_dump_json_string (out, self->filename);
+			str_append (out, ", ");
+		}
+		str_append_printf (out, "\"offset\": %" PRId64 ", \"length\": %"
+			PRId64 ", \"description\": ", offset, len);
+		app_dump_json_string (out, desc);
+		str_append (out, "}\n");
+		break;
+	case DUMP_TSV:
+		if (self->filename)
+		{
+			app_dump_tsv_string (out, self->filename);
+			str_append_c (out, '\t');
+		}
+		str_append_printf (out, "%" PRId64 "\t%" PRId64 "\t", offset, len);
+		app_dump_tsv_string (out, desc);
+		str_append_c (out, '\n');
+		break;
+	default:
+		hard_assert (!"invalid dump format");
 	}
-out:
-	return xui_vbox (l.head);
+
+	fwrite (out->str, 1, out->len, self->fp);
+	str_reset (out);
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
-static uint64_t
-app_decode (const uint8_t *p, size_t len, enum endianity endianity)
+// Exporting writes an xxd-style hexdump with descriptions of marks starting
+// on each row to the right.  Rather than building widgets, data is formatted
+// a block at a time, walking "marks_by_offset" in lockstep.
+
+enum
 {
-	uint64_t val = 0;
-	if (endianity == ENDIANITY_BE)
-		for (size_t i = 0; i < len; i++)
-			val = val << 8 | (uint64_t) p[i];
-	else
-		while (len--)
-			val = val << 8 | (uint64_t) p[len];
-	return val;
+	EXPORT_BLOCK = 1 << 16,             ///< Bytes formatted at once
+	EXPORT_FLUSH = 1 << 20              ///< Output buffered before writing
+};
+
+/// Write "value" as exactly "digits" lowercase hexadecimal digits
+static char *
+app_export_address (char *p, int64_t value, int digits)
+{
+	static const char hexa[] = "0123456789abcdef";
+	for (int i = digits; i--; value >>= 4)
+		p[i] = hexa[value & 0xf];
+	return p + digits;
 }
 
-static struct widget *
-app_footer_field (char id, int size, const char *fmt, ...)
-	ATTRIBUTE_PRINTF (3, 4);
+/// Append descriptions of all marks starting within [offset, end),
+/// advancing "span" through "marks_by_offset"
+static void
+app_export_marks (struct str *out, size_t *span, int64_t offset, int64_t end)
+{
+	const char *separator = "  ";
+	for (; *span < g.marks_by_offset_len
+		&& g.marks_by_offset[*span].offset < end; ++*span)
+	{
+		const struct marks_by_offset *entry = &g.marks_by_offset[*span];
+		if (entry->offset < offset)
+			continue;
 
-static struct widget *
-app_footer_field (char id, int size, const char *fmt, ...)
+		for (struct mark **iter = g.offset_entries + entry->marks;
+			entry->marks && *iter; iter++)
+		{
+			if ((*iter)->offset != entry->offset)
+				continue;
+
+			str_append (out, separator);
+			str_append (out, g.mark_strings.str + (*iter)->description);
+			separator = "; ";
+		}
+	}
+}
+
+static bool
+app_export (FILE *fp, struct error **e)
 {
-	const char *coding = "";
-	if (size <= 1)
-		;
-	else if (g.endianity == ENDIANITY_LE)
-		coding = "le";
-	else if (g.endianity == ENDIANITY_BE)
-		coding = "be";
+	int64_t end = g.data_offset + g.data_len;
+	int digits = 8;
+	while (digits < 16 && end >> (4 * digits))
+		digits++;
+
+	char *hex = xmalloc (2 * EXPORT_BLOCK);
+	char *ascii = xmalloc (EXPORT_BLOCK);
+	struct str out = str_make ();
+	ssize_t first = app_find_marks (g.data_offset);
+	size_t span = MAX (first, 0);
+
+	bool ok = true;
+	for (int64_t block = 0; ok && block < g.data_len; block += EXPORT_BLOCK)
+	{
+		size_t block_len = MIN (EXPORT_BLOCK, g.data_len - block);
+		app_format_hex (g.data + block, block_len, hex, ascii);
+		for (size_t row = 0; row < block_len; row += ROW_SIZE)
+		{
+			size_t len = MIN (ROW_SIZE, block_len - row);
+			int64_t offset = g.data_offset + block + row;
+
+			// The address, groups of two bytes in hex, and the bytes as text
+			str_reserve (&out, digits + 2 + ROW_SIZE / 2 * 5 + 1 + ROW_SIZE);
+			char *p = app_export_address (out.str + out.len, offset, digits);
+			*p++ = ':';
+			for (size_t i = 0; i < ROW_SIZE; i += 2)
+			{
+				*p++ = ' ';
+				size_t n = i >= len ? 0 : MIN (2, len - i);
+				memcpy (p, hex + 2 * (row + i), 2 * n);
+				memset (p + 2 * n, ' ', 4 - 2 * n);
+				p += 4;
+			}
+			*p++ = ' ';
+			*p++ = ' ';
+			memcpy (p, ascii + row, len);
+			out.len = p + len - out.str;
+
+			app_export_marks (&out, &span, offset, offset + len);
+			str_append_c (&out, '\n');
+		}
 
-	struct layout l = {};
-	char *key = xstrdup_printf ("%c%d%s", id, size * 8, coding);
-	app_push (&l, app_mono_label (APP_ATTR (FOOTER_HL), key));
-	free (key);
+		if (out.len >= EXPORT_FLUSH || block + EXPORT_BLOCK >= g.data_len)
+		{
+			ok = fwrite (out.str, 1, out.len, fp) == out.len;
+			str_reset (&out);
+		}
+	}
+	if (ok && fflush (fp))
+		ok = false;
+	if (!ok)
+		error_set (e, "cannot write output: %s", strerror (errno));
+
+	str_free (&out);
+	free (hex);
+	free (ascii);
+	return ok;
+}
 
-	app_push (&l, app_mono_padding (0, 1, 1));
+// --- Edited data -------------------------------------------------------------
 
-	va_list ap;
-	va_start (ap, fmt);
-	struct str value = str_make ();
-	str_append_vprintf (&value, fmt, ap);
-	va_end (ap);
+// Background tasks go through the edited data without holding up the user,
+// so they work with snapshots of the piece table, see the Editing section.
 
-	// Right-aligned
-	app_push_hfill (&l, g_xui.ui->padding (0, 1, 1));
-	app_push (&l, app_mono_label (APP_ATTR (FOOTER), value.str));
-	str_free (&value);
-	return xui_hbox (l.head);
+/// Edited data as a table of pieces.  Background tasks read from
+/// a snapshot of it, so that the user may go on editing in the meantime.
+struct app_edited
+{
+	const struct app_piece *pieces;     ///< Pieces making up the data
+	size_t pieces_len;                  ///< Number of pieces
+	const uint8_t *data;                ///< The original data
+	const uint8_t *added;               ///< Storage for typed in bytes
+	int64_t len;                        ///< Length of the edited data
+};
+
+/// Refer to the edited data as it is now, only valid until the next edit
+static struct app_edited
+app_edited_live (void)
+{
+	return (struct app_edited) { g.pieces, g.pieces_len,
+		g.data, (const uint8_t *) g.added.str, g.data_len };
+}
+
+/// Copy the piece table, and typed in bytes, whose storage may move
+static struct app_edited *
+app_edited_snapshot (void)
+{
+	struct app_piece *pieces = xcalloc (MAX (g.pieces_len, 1), sizeof *pieces);
+	memcpy (pieces, g.pieces, g.pieces_len * sizeof *pieces);
+	uint8_t *added = xmalloc (MAX (g.added.len, 1));
+	memcpy (added, g.added.str, g.added.len);
+
+	struct app_edited *self = xcalloc (1, sizeof *self);
+	*self = (struct app_edited)
+		{ pieces, g.pieces_len, g.data, added, g.data_len };
+	return self;
 }
 
 static void
-app_footer_group (struct layout *out, int size, int64_t u, int64_t s, int align)
+app_edited_destroy (struct app_edited *self)
 {
-	struct layout l = {};
-	app_push (&l, app_footer_field ('x', size, "%0*" PRIx64, size * 2, u));
-	app_push (&l, app_footer_field ('u', size, "%" PRIu64, u));
-	app_push (&l, app_footer_field ('s', size, "%" PRId64, s));
-	l.head->width = MAX (l.head->width,
-		g.digitw * align /* sign + ceil(log10(U/INT*_MAX)) */);
-	if (out->head)
-		app_push (out, app_mono_padding (APP_ATTR (FOOTER), 2, 1));
-	app_push (out, xui_vbox (l.head));
+	free ((struct app_piece *) self->pieces);
+	free ((uint8_t *) self->added);
+	free (self);
 }
 
-static struct widget *
-app_layout_footer (void)
+/// Return the index of the piece containing "offset", or the piece count
+static size_t
+app_edited_find (const struct app_edited *self, int64_t offset)
 {
-	struct layout statusl = {};
-	app_push (&statusl, app_label (APP_ATTR (BAR), APP_TITLE));
-	app_push (&statusl, g_xui.ui->padding (APP_ATTR (BAR), 1, 1));
-
-	if (g.message)
-		app_push (&statusl, app_label (APP_ATTR (BAR_HL), g.message));
-	else if (g.filename)
+	size_t lo = 0, hi = self->pieces_len;
+	while (lo < hi)
 	{
-		char *filename = (char *) u8_strconv_from_locale (g.filename);
-		app_push (&statusl, app_label (APP_ATTR (BAR_HL), filename));
-		free (filename);
-		app_push (&statusl, g_xui.ui->padding (APP_ATTR (BAR), 1, 1));
+		size_t mid = lo + (hi - lo) / 2;
+		if (self->pieces[mid].start <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
+	if (!lo || offset >= self->len)
+		return self->pieces_len;
+	return lo - 1;
+}
 
-	app_push_hfill (&statusl, g_xui.ui->padding (APP_ATTR (BAR), 1, 1));
+static const uint8_t *
+app_edited_piece_data (const struct app_edited *self,
+	const struct app_piece *piece)
+{
+	return (piece->added ? self->added : self->data) + piece->offset;
+}
 
-	char *address = xstrdup_printf ("%08" PRIx64, g.view_cursor);
-	app_push (&statusl, app_mono_label (APP_ATTR (BAR), address));
-	free (address);
-	app_push (&statusl, g_xui.ui->padding (APP_ATTR (BAR), 1, 1));
+/// Return edited data in place, if it lies within a single piece
+static const uint8_t *
+app_edited_view (const struct app_edited *self, int64_t offset, int64_t len)
+{
+	size_t i = app_edited_find (self, offset);
+	if (i == self->pieces_len)
+		return NULL;
 
-	app_push (&statusl, app_mono_label (APP_ATTR (BAR),
-		g.endianity == ENDIANITY_LE ? "LE" : "BE"))
-		->widget_id = WIDGET_ENDIANITY;
-	app_push (&statusl, g_xui.ui->padding (APP_ATTR (BAR), 1, 1));
+	const struct app_piece *piece = &self->pieces[i];
+	if (offset + len > piece->start + piece->len)
+		return NULL;
+	return app_edited_piece_data (self, piece) + (offset - piece->start);
+}
 
-	int64_t top = g.view_top;
-	int64_t bot = g.view_top + app_visible_rows () * ROW_SIZE;
-	struct str where = str_make ();
-	if (top <= g.data_offset
-	 && bot >= g.data_offset + g.data_len)
-		str_append (&where, "All");
-	else if (top <= g.data_offset)
-		str_append (&where, "Top");
-	else if (bot >= g.data_offset + g.data_len)
-		str_append (&where, "Bot");
-	else
+/// Copy out edited data, returning how many bytes were available
+static size_t
+app_edited_read (const struct app_edited *self,
+	int64_t offset, uint8_t *buf, size_t len)
+{
+	size_t done = 0;
+	for (size_t i = app_edited_find (self, offset);
+		i < self->pieces_len && done < len; i++)
 	{
-		int64_t end_addr = g.data_offset + g.data_len;
-		int64_t cur = g.view_top / ROW_SIZE;
-		int64_t max = (end_addr - 1) / ROW_SIZE - app_visible_rows () + 1;
-
-		cur -= g.data_offset / ROW_SIZE;
-		max -= g.data_offset / ROW_SIZE;
-		str_append_printf (&where, "%2d%%", (int) (100 * cur / max));
+		const struct app_piece *piece = &self->pieces[i];
+		int64_t skip = offset + (int64_t) done - piece->start;
+		size_t n = MIN ((int64_t) (len - done), piece->len - skip);
+		memcpy (buf + done, app_edited_piece_data (self, piece) + skip, n);
+		done += n;
 	}
+	return done;
+}
 
-	app_push (&statusl, app_mono_label (APP_ATTR (BAR), where.str));
-	str_free (&where);
+/// Return edited data in place where possible, or else copied into "*copy",
+/// which is then to be freed by the caller
+static const uint8_t *
+app_edited_get (const struct app_edited *self, int64_t offset, int64_t len,
+	uint8_t **copy)
+{
+	*copy = NULL;
+	const uint8_t *p = app_edited_view (self, offset, len);
+	if (p)
+		return p;
+
+	*copy = xmalloc (MAX (len, 1));
+	app_edited_read (self, offset, *copy, len);
+	return *copy;
+}
 
-	int64_t end_addr = g.data_offset + g.data_len;
-	if (g.view_cursor < g.data_offset
-	 || g.view_cursor >= end_addr)
-		return xui_hbox (statusl.head);
+// --- Overview ----------------------------------------------------------------
 
-	int64_t len = end_addr - g.view_cursor;
-	uint8_t *p = g.data + (g.view_cursor - g.data_offset);
+// Entropy and byte class statistics are computed for blocks of the whole data
+// in the background, and polled for from the main thread as they come in.
+// Edits start it over, only keeping blocks that they couldn't have changed.
 
-	// TODO: The entire bottom part perhaps should be pre-painted
-	//   with APP_ATTR (FOOTER).
-	struct layout groupl = {};
-	if (len >= 1)
-		app_footer_group (&groupl, 1, p[0], (int8_t) p[0], 3 + 4);
-	if (len >= 2)
+enum
+{
+	OVERVIEW_BLOCKS = 4096,             ///< Upper bound on block count
+	OVERVIEW_BLOCK_MIN = 4096,          ///< Lower bound on block size
+	OVERVIEW_POLL_MS = 100,             ///< Progress polling interval
+};
+
+struct app_overview_block
+{
+	bool ready;                         ///< The block has been processed
+	uint8_t entropy;                    ///< Entropy, 255 for 8 bits per byte
+	uint8_t zero;                       ///< Share of zero bytes, in 1/255
+	uint8_t text;                       ///< Share of text bytes, in 1/255
+	uint8_t high;                       ///< Share of bytes above 127, in 1/255
+};
+
+struct app_overview
+{
+	struct app_task task;               ///< Background computation
+	bool running;                       ///< The task is still running
+	struct poller_timer timer;          ///< Polls the task for progress
+	size_t reported;                    ///< Jobs done as of the last poll
+
+	struct app_edited *edited;          ///< Snapshot of the data
+	int64_t data_len;                   ///< Length of the data
+	int64_t block_size;                 ///< Bytes per block
+	struct app_overview_block *blocks;  ///< Results, under the task's lock
+	size_t blocks_len;                  ///< Number of blocks
+};
+
+/// Histogramming doesn't vectorize well, but spreading consecutive bytes
+/// across separate tables avoids stalling on runs of the same value
+static void
+app_overview_histogram (const uint8_t *p, size_t len, uint32_t hist[256])
+{
+	uint32_t t[4][256] = {};
+	size_t i = 0;
+	for (; i + 4 <= len; i += 4)
 	{
-		uint16_t value = app_decode (p, 2, g.endianity);
-		app_footer_group (&groupl, 2, value, (int16_t) value, 6 + 6);
+		t[0][p[i + 0]]++;
+		t[1][p[i + 1]]++;
+		t[2][p[i + 2]]++;
+		t[3][p[i + 3]]++;
 	}
-	if (len >= 4)
+	for (; i < len; i++)
+		t[0][p[i]]++;
+	for (int k = 0; k < 256; k++)
+		hist[k] = t[0][k] + t[1][k] + t[2][k] + t[3][k];
+}
+
+static void
+app_overview_execute (struct app_task *task, size_t worker, size_t job)
+{
+	(void) worker;
+
+	// Blocks kept from before an edit are never written to again
+	struct app_overview *self = task->user_data;
+	if (self->blocks[job].ready)
+		return;
+
+	int64_t start = (int64_t) job * self->block_size;
+	int64_t len = MIN (self->block_size, self->data_len - start);
+
+	uint8_t *copy = NULL;
+	uint32_t hist[256];
+	app_overview_histogram
+		(app_edited_get (self->edited, start, len, &copy), len, hist);
+	free (copy);
+
+	double entropy = 0;
+	uint64_t text = hist['\t'] + hist['\n'] + hist['\r'], high = 0;
+	for (int k = 0; k < 256; k++)
 	{
-		uint32_t value = app_decode (p, 4, g.endianity);
-		app_footer_group (&groupl, 4, value, (int32_t) value, 6 + 11);
+		if (hist[k])
+		{
+			double p = (double) hist[k] / len;
+			entropy -= p * log2 (p);
+		}
+		if (k >= 32 && k < 127)
+			text += hist[k];
+		if (k >= 128)
+			high += hist[k];
 	}
-	if (len >= 8)
+
+	struct app_overview_block block =
 	{
-		uint64_t value = app_decode (p, 8, g.endianity);
-		app_footer_group (&groupl, 8, value, (int64_t) value, 6 + 20);
-	}
+		.ready = true,
+		.entropy = MIN (255, lround (entropy * 255 / 8)),
+		.zero = hist[0] * 255 / len,
+		.text = text * 255 / len,
+		.high = high * 255 / len,
+	};
 
-	struct layout lll = {};
-	app_push (&lll, xui_hbox (statusl.head));
-	app_push (&lll, xui_hbox (groupl.head));
-	return xui_vbox (lll.head);
+	pthread_mutex_lock (&task->lock);
+	self->blocks[job] = block;
+	pthread_mutex_unlock (&task->lock);
 }
 
 static void
-app_layout (void)
+app_on_overview_timer (void *user_data)
 {
-	struct layout topl = {};
-	app_push (&topl, app_layout_view ());
-	app_push (&topl, g_xui.ui->padding (0, 1, 1));
-	app_push_hfill (&topl, app_layout_info ());
-
-	struct layout l = {};
-	app_push_vfill (&l, xui_hbox (topl.head));
-	app_push (&l, app_layout_footer ());
+	struct app_overview *self = user_data;
+	size_t done = app_task_jobs_done (&self->task);
+	if (done != self->reported)
+	{
+		self->reported = done;
+		xui_invalidate ();
+	}
 
-	struct widget *root = g_xui.widgets = xui_vbox (l.head);
-	root->width = g_xui.width;
-	root->height = g_xui.height;
+	if (done < self->blocks_len)
+		poller_timer_set (&self->timer, OVERVIEW_POLL_MS);
+	else
+	{
+		app_task_wait (&self->task);
+		self->running = false;
+	}
 }
 
-// --- Lua ---------------------------------------------------------------------
-
-#ifdef WITH_LUA
-
-static void *
-app_lua_alloc (void *ud, void *ptr, size_t o_size, size_t n_size)
+static struct app_overview *
+app_overview_new (void)
 {
-	(void) ud;
-	(void) o_size;
+	struct app_overview *self = xcalloc (1, sizeof *self);
+	self->edited = app_edited_snapshot ();
+	self->data_len = g.data_len;
+	self->block_size = MAX (OVERVIEW_BLOCK_MIN,
+		(self->data_len + OVERVIEW_BLOCKS - 1) / OVERVIEW_BLOCKS);
+	self->blocks_len =
+		(self->data_len + self->block_size - 1) / self->block_size;
+	self->blocks = xcalloc (self->blocks_len, sizeof *self->blocks);
+	return self;
+}
 
-	if (n_size)
-		return realloc (ptr, n_size);
+static void
+app_overview_run (struct app_overview *self)
+{
+	self->timer = poller_timer_make (&g.poller);
+	self->timer.dispatcher = app_on_overview_timer;
+	self->timer.user_data = self;
+	poller_timer_set (&self->timer, OVERVIEW_POLL_MS);
+
+	self->task.execute = app_overview_execute;
+	self->task.user_data = self;
+	app_task_start (&self->task, self->blocks_len, app_cpu_count ());
+	self->running = true;
+}
 
-	free (ptr);
-	return NULL;
+static void
+app_overview_start (void)
+{
+	app_overview_run ((g.overview = app_overview_new ()));
 }
 
-static int
-app_lua_panic (lua_State *L)
+static void
+app_overview_free (void)
 {
-	// XXX: we might be able to do something better
-	print_fatal ("Lua panicked: %s", lua_tostring (L, -1));
-	lua_close (L);
-	exit (EXIT_FAILURE);
-	return 0;
+	struct app_overview *self = g.overview;
+	if (!self)
+		return;
+
+	if (self->running)
+		app_task_cancel (&self->task);
+	poller_timer_reset (&self->timer);
+	app_edited_destroy (self->edited);
+	free (self->blocks);
+	free (self);
+	g.overview = NULL;
 }
 
-static bool
-app_lua_getfield (lua_State *L, int idx, const char *name,
-	int expected, bool optional)
+/// Start over after "remove" bytes at "offset" have been replaced
+/// with "insert" bytes, carrying over blocks that stayed the same
+static void
+app_overview_restart (int64_t offset, int64_t remove, int64_t insert)
 {
-	int found = lua_getfield (L, idx, name);
-	if (found == expected)
-		return true;
-	if (optional && found == LUA_TNIL)
-		return false;
+	struct app_overview *old = g.overview;
+	if (old->running)
+		app_task_cancel (&old->task);
+	poller_timer_reset (&old->timer);
+
+	// Blocks past the edit only stay the same when nothing has moved
+	struct app_overview *self = g.overview = app_overview_new ();
+	if (self->block_size == old->block_size)
+		for (size_t i = 0; i < MIN (self->blocks_len, old->blocks_len); i++)
+		{
+			int64_t start = (int64_t) i * self->block_size;
+			if (start + self->block_size <= offset
+			 || (remove == insert && start >= offset + remove))
+				self->blocks[i] = old->blocks[i];
+		}
+	app_overview_run (self);
 
-	const char *message = optional
-		? "invalid field \"%s\" (found: %s, expected: %s or nil)"
-		: "invalid or missing field \"%s\" (found: %s, expected: %s)";
-	return luaL_error (L, message, name,
-		lua_typename (L, found), lua_typename (L, expected));
+	app_edited_destroy (old->edited);
+	free (old->blocks);
+	free (old);
 }
 
-static int
-app_lua_error_handler (lua_State *L)
+/// Return the range of blocks that represent a given row of the overview
+static void
+app_overview_segment (int y, int rows, size_t *from, size_t *to)
 {
-	luaL_traceback (L, L, luaL_checkstring (L, 1), 1);
-	return 1;
+	size_t blocks_len = g.overview->blocks_len;
+	*from = (size_t) y * blocks_len / rows;
+	*to = MAX (*from + 1, (size_t) (y + 1) * blocks_len / rows);
 }
 
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+// --- Search ------------------------------------------------------------------
 
-struct app_lua_coder
+// The data is split into chunks that are searched by worker threads, whose
+// matches get merged into a sorted index, in order, as soon as they're ready.
+// Edits move finished matches along, and only search around themselves,
+// whereas unfinished searches start over.
+
+enum
 {
-	int ref_detect;                     ///< Reference to the "detect" method
-	int ref_decode;                     ///< Reference to the "decode" method
+	SEARCH_CHUNK = 1 << 20,             ///< Bytes searched by a single job
+	SEARCH_POLL_MS = 50,                ///< Progress polling interval
 };
 
-static void
-app_lua_coder_free (void *coder)
+struct app_search_chunk
 {
-	struct app_lua_coder *self = coder;
-	luaL_unref (g.L, LUA_REGISTRYINDEX, self->ref_decode);
-	luaL_unref (g.L, LUA_REGISTRYINDEX, self->ref_detect);
-	free (self);
-}
+	bool done;                          ///< The chunk has been searched
+	ARRAY (int64_t, matches)            ///< Offsets of matches within data
+};
 
-static int
-app_lua_register (lua_State *L)
+struct app_search
 {
-	luaL_checktype (L, 1, LUA_TTABLE);
+	struct app_task task;               ///< Background search
+	bool running;                       ///< The task is still running
+	struct poller_timer timer;          ///< Polls the task for progress
 
-	(void) app_lua_getfield (L, 1, "type",   LUA_TSTRING,   false);
-	const char *type = lua_tostring (L, -1);
-	if (str_map_find (&g.coders, type))
-		luaL_error (L, "a coder has already been registered for `%s'", type);
+	bool forward;                       ///< Direction of the search
+	bool pending;                       ///< Jump once the target is known
+	bool pending_forward;               ///< Direction of the pending jump
 
-	(void) app_lua_getfield (L, 1, "detect", LUA_TFUNCTION, true);
-	(void) app_lua_getfield (L, 1, "decode", LUA_TFUNCTION, false);
+	struct app_edited *edited;          ///< Snapshot of the data searched
+	int64_t data_len;                   ///< Length of the data
+	int match_len;                      ///< Length of each match
 
-	struct app_lua_coder *coder = xcalloc (1, sizeof *coder);
-	coder->ref_decode = luaL_ref (L, LUA_REGISTRYINDEX);
-	coder->ref_detect = luaL_ref (L, LUA_REGISTRYINDEX);
-	str_map_set (&g.coders, type, coder);
-	return 0;
-}
+	struct str needles[2];              ///< Byte strings to look for
+	size_t needles_len;                 ///< Number of needles, or zero
+	double value;                       ///< Float to look for, if no needles
+	double tolerance;                   ///< Maximum distance from "value"
 
-static luaL_Reg app_lua_library[] =
-{
-	{ "register", app_lua_register },
-	{ NULL,       NULL             }
+	struct app_search_chunk *chunks;    ///< Results, under the task's lock
+	size_t chunks_len;                  ///< Number of chunks
+	size_t chunks_merged;               ///< Chunks moved to "matches"
+	ARRAY (int64_t, matches)            ///< Sorted offsets of all matches
 };
 
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
-
-#define XLUA_CHUNK_METATABLE "chunk"
+static int
+app_int64_cmp (const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+	return (x > y) - (x < y);
+}
 
-struct app_lua_chunk
+/// Read an IEEE 754 number of the given size, which is either 4 or 8 bytes
+static inline double
+app_search_read_float (const uint8_t *p, int size, bool swap)
 {
-	int64_t offset;                     ///< Offset from start of file
-	int64_t len;                        ///< Length of the sequence
+	if (size == 4)
+	{
+		uint32_t u;
+		float f;
+		memcpy (&u, p, sizeof u);
+		if (swap)
+			u = __builtin_bswap32 (u);
+		memcpy (&f, &u, sizeof f);
+		return f;
+	}
 
-	int64_t position;                   ///< Read position in the sequence
-	enum endianity endianity;           ///< Read endianity
-};
+	uint64_t u;
+	double d;
+	memcpy (&u, p, sizeof u);
+	if (swap)
+		u = __builtin_bswap64 (u);
+	memcpy (&d, &u, sizeof d);
+	return d;
+}
 
-static struct app_lua_chunk *
-app_lua_chunk_new (lua_State *L)
+static inline bool
+app_search_float_matches (const struct app_search *self, const uint8_t *p)
 {
-	struct app_lua_chunk *chunk = lua_newuserdata (L, sizeof *chunk);
-	luaL_setmetatable (L, XLUA_CHUNK_METATABLE);
-	memset (chunk, 0, sizeof *chunk);
-	return chunk;
+	bool host_le = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+	double le = app_search_read_float (p, self->match_len, !host_le);
+	double be = app_search_read_float (p, self->match_len, host_le);
+	return fabs (le - self->value) <= self->tolerance
+		|| fabs (be - self->value) <= self->tolerance;
 }
 
-static int
-app_lua_chunk_len (lua_State *L)
+/// Return the most significant byte of a float of the given size
+static uint8_t
+app_search_float_top (double x, int size)
 {
-	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
-	lua_pushinteger (L, self->len);
-	return 1;
+	if (size == 4)
+	{
+		float f = x;
+		uint32_t u;
+		memcpy (&u, &f, sizeof u);
+		return u >> 24;
+	}
+
+	uint64_t u;
+	memcpy (&u, &x, sizeof u);
+	return u >> 56;
 }
 
-/// Create a new subchunk following Lua's string.sub() semantics.
-/// An implication is that it is not possible to go extend a chunk's bounds.
+/// The most significant byte holds the sign and most of the exponent,
+/// so floats within a range of values only have it within a range as well,
+/// separately for positive and negative numbers.  Store those ranges
+/// as their first bytes and spans, widened by one for rounding,
+/// and return how many there are.
 static int
-app_lua_chunk_call (lua_State *L)
+app_search_float_tops (const struct app_search *self, uint8_t from[2],
+	uint8_t span[2])
 {
-	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
-	lua_Integer start = luaL_optinteger (L, 2,  1);
-	lua_Integer end   = luaL_optinteger (L, 3, -1);
-
-	if (start < 0) start += self->len + 1;
-	if (end   < 0) end   += self->len + 1;
+	double lo = self->value - self->tolerance;
+	double hi = self->value + self->tolerance;
+	int n = 0, size = self->match_len;
+	if (hi >= 0)
+	{
+		int a = app_search_float_top (MAX (lo, 0), size);
+		int b = app_search_float_top (hi, size);
+		from[n] = MAX (a - 1, 0x00);
+		span[n] = MIN (b + 1, 0x7f) - from[n];
+		n++;
+	}
+	if (lo <= 0)
+	{
+		int a = app_search_float_top (-MIN (hi, 0), size) | 0x80;
+		int b = app_search_float_top (lo, size);
+		from[n] = MAX (a - 1, 0x80);
+		span[n] = MIN (b + 1, 0xff) - from[n];
+		n++;
+	}
+	return n;
+}
 
-	start = MAX (start, 1);
-	end = MIN (end, self->len);
+/// Find floats starting within "p" up to "end", which may extend up to
+/// "limit", adding their offsets, "p" being at "offset", in order.
+/// Like app_memmem(), candidates are found by comparing the most significant
+/// byte, in both byte orders, against whole vectors at once.
+static void
+app_search_scan_floats (const struct app_search *self, const uint8_t *p,
+	const uint8_t *end, const uint8_t *limit, int64_t offset,
+	struct app_search_chunk *out)
+{
+	if (limit - p < self->match_len)
+		return;
 
-	struct app_lua_chunk *clone = app_lua_chunk_new (L);
-	clone->position = 0;
-	clone->endianity = self->endianity;
-	if (start > end)
+	uint8_t from[2], span[2];
+	int ranges = app_search_float_tops (self, from, span);
+	if (!ranges)
+		return;
+	if (ranges == 1)
 	{
-		// "start" can be too high and "end" can be too low;
-		// the length is zero, so the offset doesn't matter much anyway
-		clone->offset = self->offset;
-		clone->len = 0;
+		from[1] = from[0];
+		span[1] = span[0];
 	}
-	else
+
+	// Little endian floats have their top byte last
+	int64_t n = MIN (end - p, limit - p - self->match_len + 1), i = 0;
+	int last = self->match_len - 1;
+#if defined __SSE2__
+	__m128i from0 = _mm_set1_epi8 (from[0]), span0 = _mm_set1_epi8 (span[0]);
+	__m128i from1 = _mm_set1_epi8 (from[1]), span1 = _mm_set1_epi8 (span[1]);
+	for (; i + 16 <= n; i += 16)
 	{
-		clone->offset = self->offset + start - 1;
-		clone->len = end - start + 1;
+		__m128i be = _mm_loadu_si128 ((const __m128i *) (p + i));
+		__m128i le = _mm_loadu_si128 ((const __m128i *) (p + i + last));
+
+		// Unsigned x - from <= span is the same as min (x - from, span)
+		// being equal to x - from
+		__m128i d, in = _mm_setzero_si128 ();
+		d = _mm_sub_epi8 (be, from0);
+		in = _mm_or_si128 (in, _mm_cmpeq_epi8 (_mm_min_epu8 (d, span0), d));
+		d = _mm_sub_epi8 (be, from1);
+		in = _mm_or_si128 (in, _mm_cmpeq_epi8 (_mm_min_epu8 (d, span1), d));
+		d = _mm_sub_epi8 (le, from0);
+		in = _mm_or_si128 (in, _mm_cmpeq_epi8 (_mm_min_epu8 (d, span0), d));
+		d = _mm_sub_epi8 (le, from1);
+		in = _mm_or_si128 (in, _mm_cmpeq_epi8 (_mm_min_epu8 (d, span1), d));
+
+		for (unsigned mask = _mm_movemask_epi8 (in); mask; mask &= mask - 1)
+		{
+			int k = __builtin_ctz (mask);
+			if (app_search_float_matches (self, p + i + k))
+			{
+				ARRAY_RESERVE (out->matches, 1);
+				out->matches[out->matches_len++] = offset + i + k;
+			}
+		}
 	}
-	return 1;
+#elif defined __ARM_NEON
+	uint8x16_t from0 = vdupq_n_u8 (from[0]), span0 = vdupq_n_u8 (span[0]);
+	uint8x16_t from1 = vdupq_n_u8 (from[1]), span1 = vdupq_n_u8 (span[1]);
+	for (; i + 16 <= n; i += 16)
+	{
+		uint8x16_t be = vld1q_u8 (p + i), le = vld1q_u8 (p + i + last);
+		uint8x16_t in = vorrq_u8
+			(vorrq_u8 (vcleq_u8 (vsubq_u8 (be, from0), span0),
+				vcleq_u8 (vsubq_u8 (be, from1), span1)),
+			 vorrq_u8 (vcleq_u8 (vsubq_u8 (le, from0), span0),
+				vcleq_u8 (vsubq_u8 (le, from1), span1)));
+
+		// There is no movemask, narrow each byte down to a nibble instead
+		uint64_t mask = vget_lane_u64 (vreinterpret_u64_u8
+			(vshrn_n_u16 (vreinterpretq_u16_u8 (in), 4)), 0);
+		while (mask)
+		{
+			int k = __builtin_ctzll (mask) / 4;
+			if (app_search_float_matches (self, p + i + k))
+			{
+				ARRAY_RESERVE (out->matches, 1);
+				out->matches[out->matches_len++] = offset + i + k;
+			}
+			mask &= ~(UINT64_C (0xf) << k * 4);
+		}
+	}
+#endif
+	for (; i < n; i++)
+		if (app_search_float_matches (self, p + i))
+		{
+			ARRAY_RESERVE (out->matches, 1);
+			out->matches[out->matches_len++] = offset + i;
+		}
 }
 
-static int
-app_lua_chunk_index (lua_State *L)
+/// Find matches starting within "p" up to "end", which may extend up to
+/// "limit", adding their offsets, "p" being at "offset", in order
+static void
+app_search_scan (const struct app_search *self, const uint8_t *p,
+	const uint8_t *end, const uint8_t *limit, int64_t offset,
+	struct app_search_chunk *out)
 {
-	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
-	const char *key = luaL_checkstring (L, 2);
-	if (luaL_getmetafield (L, 1, key))
-		return 1;
+	const uint8_t *start = p;
+	for (size_t i = 0; i < self->needles_len; i++)
+	{
+		const struct str *needle = &self->needles[i];
+		p = start;
+		while ((p = app_memmem (p, limit - p,
+			(const uint8_t *) needle->str, needle->len)) && p < end)
+		{
+			ARRAY_RESERVE (out->matches, 1);
+			out->matches[out->matches_len++] = offset + (p++ - start);
+		}
+	}
+	if (self->needles_len > 1)
+		qsort (out->matches, out->matches_len, sizeof *out->matches,
+			app_int64_cmp);
 
-	if (!strcmp (key, "offset"))
-		lua_pushinteger (L, self->offset);
-	else if (!strcmp (key, "endianity"))
-		lua_pushstring (L, self->endianity == ENDIANITY_LE ? "le" : "be");
-	else if (!strcmp (key, "position"))
-		lua_pushinteger (L, self->position + 1);
-	else if (!strcmp (key, "eof"))
-		lua_pushboolean (L, self->position >= self->len);
-	else
-		return luaL_argerror (L, 2, "not a readable property");
-	return 1;
+	// Floats can't be turned into byte strings, so try every position
+	if (!self->needles_len)
+		app_search_scan_floats (self, start, end, limit, offset, out);
 }
 
-static int
-app_lua_chunk_newindex (lua_State *L)
+static void
+app_search_execute (struct app_task *task, size_t worker, size_t job)
 {
-	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
-	const char *key = luaL_checkstring (L, 2);
-	if (!strcmp (key, "endianity"))
+	(void) worker;
+
+	// Matches must start within the chunk, but they may extend beyond it
+	struct app_search *self = task->user_data;
+	int64_t start = (int64_t) job * SEARCH_CHUNK;
+	int64_t end = MIN (start + SEARCH_CHUNK, self->data_len);
+	int64_t limit = MIN (end + self->match_len - 1, self->data_len);
+
+	uint8_t *copy = NULL;
+	const uint8_t *p =
+		app_edited_get (self->edited, start, limit - start, &copy);
+
+	struct app_search_chunk chunk = { .done = true };
+	ARRAY_INIT (chunk.matches);
+	app_search_scan (self, p, p + (end - start), p + (limit - start),
+		start, &chunk);
+	free (copy);
+
+	pthread_mutex_lock (&task->lock);
+	self->chunks[job] = chunk;
+	pthread_mutex_unlock (&task->lock);
+}
+
+static void
+app_search_merge (struct app_search *self)
+{
+	pthread_mutex_lock (&self->task.lock);
+	for (; self->chunks_merged < self->chunks_len; self->chunks_merged++)
 	{
-		// Needs to be in the enum order
-		const char *options[] = { "le", "be" };
-		self->endianity = luaL_checkoption (L, 3, options[0], options);
+		struct app_search_chunk *chunk = &self->chunks[self->chunks_merged];
+		if (!chunk->done)
+			break;
+
+		ARRAY_RESERVE (self->matches, chunk->matches_len);
+		memcpy (self->matches + self->matches_len, chunk->matches,
+			chunk->matches_len * sizeof *chunk->matches);
+		self->matches_len += chunk->matches_len;
+		free (chunk->matches);
+		chunk->matches = NULL;
 	}
-	else if (!strcmp (key, "position"))
+	pthread_mutex_unlock (&self->task.lock);
+}
+
+/// Return the index of the first match at or after "offset"
+static size_t
+app_search_lower_bound (struct app_search *self, int64_t offset)
+{
+	size_t lo = 0, hi = self->matches_len;
+	while (lo < hi)
 	{
-		lua_Integer position = luaL_checkinteger (L, 3);
-		if (position < 1 || position > self->len + 1)
-			return luaL_error (L, "position out of range: %I", position);
-		self->position = position - 1;
+		size_t mid = lo + (hi - lo) / 2;
+		if (self->matches[mid] < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
-	else
-		return luaL_argerror (L, 2, "not a writable property");
-	return 0;
+	return lo;
 }
 
-static void
-app_lua_mark (int64_t offset, int64_t len, const char *desc)
+/// Return whether the address is covered by a match of the last search
+static bool
+app_search_covers (int64_t addr)
 {
-	// That would cause stupid entries, making trouble in marks_by_offset
-	if (len <= 0)
-		return;
+	struct app_search *self = g.search;
+	if (!self)
+		return false;
 
-	ARRAY_RESERVE (g.marks, 1);
-	g.marks[g.marks_len++] =
-		(struct mark) { offset, len, g.mark_strings.len };
+	int64_t offset = addr - g.data_offset;
+	size_t i = app_search_lower_bound (self, offset + 1);
+	return i && offset < self->matches[i - 1] + self->match_len;
+}
 
-	str_append (&g.mark_strings, desc);
-	str_append_c (&g.mark_strings, 0);
+static struct app_search *
+app_search_new (void)
+{
+	struct app_search *self = xcalloc (1, sizeof *self);
+	self->edited = app_edited_snapshot ();
+	self->data_len = g.data_len;
+	self->needles[0] = str_make ();
+	self->needles[1] = str_make ();
+
+	self->chunks_len = (self->data_len + SEARCH_CHUNK - 1) / SEARCH_CHUNK;
+	self->chunks = xcalloc (self->chunks_len, sizeof *self->chunks);
+	ARRAY_INIT (self->matches);
+
+	// Searches that fail to parse get freed without ever having started
+	self->timer = poller_timer_make (&g.poller);
+	return self;
 }
 
-static int
-app_lua_chunk_mark (lua_State *L)
+static void
+app_search_free (struct app_search *self)
 {
-	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
-	int n_args = lua_gettop (L);
-	lua_rawgeti (L, LUA_REGISTRYINDEX, g.ref_format);
-	lua_insert (L, 2);
-	lua_call (L, n_args - 1, 1);
-	app_lua_mark (self->offset, self->len, luaL_checkstring (L, -1));
-	return 0;
+	if (self->running)
+		app_task_cancel (&self->task);
+	poller_timer_reset (&self->timer);
+
+	for (size_t i = 0; i < self->chunks_len; i++)
+		free (self->chunks[i].matches);
+	free (self->chunks);
+	free (self->matches);
+	app_edited_destroy (self->edited);
+	str_free (&self->needles[0]);
+	str_free (&self->needles[1]);
+	free (self);
 }
 
-/// Try to detect any registered type in the data and return its name
-static int
-app_lua_chunk_identify (lua_State *L)
+/// Search all of the data again, as it is now
+static void
+app_search_restart (struct app_search *self)
 {
-	(void) luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
+	if (self->running)
+		app_task_cancel (&self->task);
+	self->running = false;
+
+	for (size_t i = 0; i < self->chunks_len; i++)
+		free (self->chunks[i].matches);
+	free (self->chunks);
+	app_edited_destroy (self->edited);
+
+	self->edited = app_edited_snapshot ();
+	self->data_len = g.data_len;
+	self->chunks_len = (self->data_len + SEARCH_CHUNK - 1) / SEARCH_CHUNK;
+	self->chunks = xcalloc (self->chunks_len, sizeof *self->chunks);
+	self->chunks_merged = 0;
+	self->matches_len = 0;
+	if (!self->chunks_len)
+		return;
 
-	struct str_map_iter iter = str_map_iter_make (&g.coders);
-	struct app_lua_coder *coder;
-	while ((coder = str_map_iter_next (&iter)))
+	app_task_start (&self->task, self->chunks_len, app_cpu_count ());
+	self->running = true;
+	poller_timer_set (&self->timer, SEARCH_POLL_MS);
+}
+
+/// Follow an edit that has replaced "remove" bytes at "offset"
+/// with "insert" bytes
+static void
+app_search_splice (struct app_search *self,
+	int64_t offset, int64_t remove, int64_t insert)
+{
+	if (self->running)
 	{
-		if (coder->ref_detect == LUA_REFNIL)
-			continue;
+		app_search_restart (self);
+		return;
+	}
 
-		lua_rawgeti (L, LUA_REGISTRYINDEX, coder->ref_detect);
+	// Matches that the edit has touched are gone
+	size_t kept = 0;
+	for (size_t i = 0; i < self->matches_len; i++)
+	{
+		int64_t match = self->matches[i];
+		if (match + self->match_len <= offset)
+			self->matches[kept++] = match;
+		else if (match >= offset + remove)
+			self->matches[kept++] = match - remove + insert;
+	}
+	self->matches_len = kept;
+	self->data_len = g.data_len;
+
+	// New ones may start anywhere from just before the edit to its end
+	int64_t start = MAX (0, offset - self->match_len + 1);
+	int64_t end = MIN (offset + insert, self->data_len);
+	int64_t limit = MIN (end + self->match_len - 1, self->data_len);
+	if (start >= end)
+		return;
 
-		// Clone the chunk first to reset its read position
-		lua_pushcfunction (L, app_lua_chunk_call);
-		lua_pushvalue (L, 1);
-		lua_call (L, 1, 1);
+	struct app_edited live = app_edited_live ();
+	uint8_t *buf = xmalloc (limit - start);
+	app_edited_read (&live, start, buf, limit - start);
+
+	struct app_search_chunk found = { .done = true };
+	ARRAY_INIT (found.matches);
+	app_search_scan (self, buf, buf + (end - start), buf + (limit - start),
+		start, &found);
+	free (buf);
+
+	size_t at = app_search_lower_bound (self, start);
+	ARRAY_RESERVE (self->matches, found.matches_len);
+	memmove (self->matches + at + found.matches_len, self->matches + at,
+		(self->matches_len - at) * sizeof *self->matches);
+	memcpy (self->matches + at, found.matches,
+		found.matches_len * sizeof *found.matches);
+	self->matches_len += found.matches_len;
+	free (found.matches);
+}
 
-		lua_call (L, 1, 1);
-		if (lua_toboolean (L, -1))
+/// Decode pairs of hexadecimal digits, ignoring whitespace between them
+static bool
+app_decode_hex (const char *hex, struct str *out)
+{
+	int high = -1;
+	for (; *hex; hex++)
+	{
+		if (isspace_ascii (*hex) && high < 0)
+			continue;
+
+		const char *alphabet = "0123456789abcdef", *digit =
+			strchr (alphabet, tolower_ascii (*hex));
+		if (!digit)
+			return false;
+		if (high < 0)
+			high = digit - alphabet;
+		else
 		{
-			lua_pushstring (L, iter.link->key);
-			return 1;
+			str_append_c (out, high << 4 | (digit - alphabet));
+			high = -1;
 		}
-		lua_pop (L, 1);
 	}
-	return 0;
+	return high < 0;
 }
 
-static int
-app_lua_chunk_decode (lua_State *L)
+// --- Diff --------------------------------------------------------------------
+
+// Both inputs are split into content-defined chunks using a gear hash, so that
+// chunk boundaries resynchronize shortly after any insertion or deletion.
+// Chunks with equal hashes are then paired up greedily, and split into parts,
+// within which pairs are verified, and the gaps between them are narrowed down
+// to ranges of differing bytes.  All of it runs in the background, and parts
+// in parallel.  Memory use is bounded by the number of chunks and differences.
+// Edits throw all of it away, and it starts over once they settle down.
+
+enum
 {
-	(void) luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
-	const char *type = luaL_optstring (L, 2, NULL);
-	// TODO: further arguments should be passed to the decoding function
+	DIFF_SEGMENT = 64 << 20,            ///< Bytes chunked by a single job
+	DIFF_CHUNK_MIN = 2 << 10,           ///< Minimum chunk length
+	DIFF_CHUNK_MAX = 64 << 10,          ///< Maximum chunk length
+	DIFF_CHUNK_BITS = 13,               ///< For 8 KiB long chunks on average
+	DIFF_LOOKAHEAD = 1024,              ///< Chunks to look ahead for a match
+	DIFF_MERGE = 32,                    ///< Merge differences this close
+	DIFF_POLL_MS = 100,                 ///< Progress polling interval
+	DIFF_RESTART_MS = 500,              ///< Wait for edits to settle down
+};
 
-	if (!type)
-	{
-		lua_pushcfunction (L, app_lua_chunk_identify);
-		lua_pushvalue (L, 1);
-		lua_call (L, 1, 1);
-		type = lua_tostring (L, -1);
-	}
-	// Can't identify -> can't decode, nothing to do here
-	if (!type)
-		return 0;
+struct app_diff_chunk
+{
+	int64_t offset;                     ///< Offset within the input
+	int64_t len;                        ///< Length of the chunk
+	uint64_t hash;                      ///< FNV-1a hash of its contents
+};
 
-	// While we could call "detect" here, just to be sure, some kinds may not
-	// even be detectable and it's better to leave it up to the plugin
+/// A chunk list sorted by hash, for finding the next equal chunk
+struct app_diff_lookup
+{
+	uint64_t hash;                      ///< Hash of the chunk
+	size_t index;                       ///< Index of the chunk
+};
 
-	struct app_lua_coder *coder = str_map_find (&g.coders, type);
-	if (!coder)
-		return luaL_error (L, "unknown type: %s", type);
+/// A run of bytes that are the same in both inputs
+struct app_diff_anchor
+{
+	int64_t a;                          ///< Offset in our data
+	int64_t b;                          ///< Offset in the other input
+	int64_t len;                        ///< Length of the run
+};
 
-	lua_rawgeti (L, LUA_REGISTRYINDEX, coder->ref_decode);
-	lua_pushvalue (L, 1);
-	// TODO: the chunk could remember the name of the coder and prepend it
-	//   to all marks set from the callback; then reset it back to NULL
-	lua_call (L, 1, 0);
-	return 0;
-}
+/// Differing bytes, where either side may be empty.  When both are of
+/// the same length, some of the bytes within may still be equal.
+struct app_diff_range
+{
+	int64_t a, a_len;                   ///< Range in our data
+	int64_t b, b_len;                   ///< Range in the other input
+};
 
-static int
-app_lua_chunk_read (lua_State *L)
+struct app_diff_segment
 {
-	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
-	lua_Integer len = luaL_checkinteger (L, 2);
-	if (len < 0)
-		return luaL_argerror (L, 2, "invalid read length");
+	int side;                           ///< Index of the input
+	int64_t offset;                     ///< Start of the segment
+	int64_t len;                        ///< Length of the segment
+	struct app_diff_chunk *chunks;      ///< Resulting chunks
+	size_t chunks_len;                  ///< Number of chunks
+};
 
-	int64_t start = self->offset + self->position;
-	// XXX: or just return a shorter string in this case?
-	if (start + len > g.data_offset + g.data_len)
-		return luaL_argerror (L, 2, "chunk is too short");
+/// Paired up chunks to be verified, and gaps to be narrowed down by one job,
+/// from the end of the preceding part to the end of its last pair
+struct app_diff_part
+{
+	size_t first;                       ///< Index of the first pair
+	size_t last;                        ///< Index past the last pair
 
-	lua_pushlstring (L, (char *) g.data + (start - g.data_offset), len);
-	self->position += len;
-	return 1;
-}
+	ARRAY (struct app_diff_anchor, anchors)
+	ARRAY (struct app_diff_range, ranges)
+};
+
+struct app_diff
+{
+	char *filename;                     ///< Name of the other input
+	struct app_mapping mapping;         ///< Mapping of the other input, if any
+	const uint8_t *inputs[2];           ///< Our data, and the other input
+	int64_t inputs_len[2];              ///< Lengths of both inputs
+	uint8_t *copy;                      ///< Our data as edited, if it is
+
+	struct app_task task;               ///< Background chunking, alignment
+	bool running;                       ///< The task is still running
+	bool aligned;                       ///< Results are available
+	bool stale;                         ///< Edited, to be started over
+	struct poller_timer timer;          ///< Polls the task for progress
+
+	uint64_t gear[256];                 ///< Gear hash table
+	struct app_diff_segment *segments;  ///< Chunking jobs for both inputs
+	size_t segments_len;                ///< Number of jobs
+
+	ARRAY (struct app_diff_anchor, pairs)
+	struct app_diff_part *parts;        ///< Alignment jobs
+	size_t parts_len;                   ///< Number of jobs
+
+	ARRAY (struct app_diff_anchor, anchors)
+	ARRAY (struct app_diff_range, ranges)
+	struct app_row row;                 ///< Scratch row for the other input
+};
 
-/// Mark a field that has just been read from the chunk and advance position:
-///  - the second argument, if present, is a simple format string for marking;
-///  - the third argument, if present, is a filtering function.
-///
-/// I am aware of how ugly the implicit "string.format" is.  Convenience wins.
 static void
-app_lua_chunk_finish_read
-	(lua_State *L, struct app_lua_chunk *self, int64_t len)
+app_diff_execute (struct app_task *task, size_t worker, size_t job)
 {
-	int n_args = lua_gettop (L) - 1;
-	if (n_args < 2)
-	{
-		self->position += len;
-		return;
-	}
+	(void) worker;
 
-	// Prepare <string.format>, <format>, <value>
-	lua_rawgeti (L, LUA_REGISTRYINDEX, g.ref_format);
-	lua_pushvalue (L, 2);
+	struct app_diff *self = task->user_data;
+	struct app_diff_segment *segment = &self->segments[job];
+	const uint8_t *p = self->inputs[segment->side];
 
-	int pre_filter_top = lua_gettop (L);
-	lua_pushvalue (L, -3);
+	ARRAY (struct app_diff_chunk, chunks)
+	ARRAY_INIT (chunks);
 
-	// Transform the value if a filtering function is provided
-	if (n_args >= 3)
+	// The gear hash shifts older bytes out to the top, so test the top bits
+	const uint64_t basis = UINT64_C (0xcbf29ce484222325);
+	uint64_t gear = 0, hash = basis;
+	int64_t start = segment->offset, end = start + segment->len;
+	for (int64_t i = start; i < end; i++)
 	{
-		lua_pushvalue (L, 3);
-		lua_insert (L, -2);
-		lua_call (L, 1, LUA_MULTRET);
-		int n_ret = lua_gettop (L) - pre_filter_top;
-
-		// When no value has been returned, keep the old one
-		if (n_ret < 1)
-			lua_pushvalue (L, pre_filter_top - 2);
+		gear = (gear << 1) + self->gear[p[i]];
+		hash = (hash ^ p[i]) * UINT64_C (0x100000001b3);
 
-		// Forward multiple return values to "string.format"
-		if (n_ret > 1)
+		int64_t len = i + 1 - start;
+		if ((len >= DIFF_CHUNK_MIN && !(gear >> (64 - DIFF_CHUNK_BITS)))
+		 || len >= DIFF_CHUNK_MAX || i + 1 == end)
 		{
-			lua_pushvalue (L, pre_filter_top - 1);
-			lua_insert (L, -n_ret - 1);
-			lua_call (L, n_ret, 1);
+			ARRAY_RESERVE (chunks, 1);
+			chunks[chunks_len++] =
+				(struct app_diff_chunk) { start, len, hash };
+			start = i + 1;
+			hash = basis;
 		}
 	}
 
-	lua_call (L, 2, 1);
-	app_lua_mark (self->offset + self->position, len, lua_tostring (L, -1));
-	self->position += len;
-	lua_pop (L, 1);
+	pthread_mutex_lock (&task->lock);
+	segment->chunks = chunks;
+	segment->chunks_len = chunks_len;
+	pthread_mutex_unlock (&task->lock);
 }
 
 static int
-app_lua_chunk_cstring (lua_State *L)
+app_diff_lookup_cmp (const void *a, const void *b)
 {
-	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
-	void *s = g.data + (self->offset - g.data_offset) + self->position;
-
-	void *nil;
-	if (!(nil = memchr (s, '\0', self->len - self->position)))
-		return luaL_error (L, "unexpected EOF");
-
-	lua_pushlstring (L, s, nil - s);
-	app_lua_chunk_finish_read (L, self, nil - s + 1);
-	return 1;
+	const struct app_diff_lookup *x = a, *y = b;
+	if (x->hash != y->hash)
+		return x->hash < y->hash ? -1 : 1;
+	return (x->index > y->index) - (x->index < y->index);
 }
 
-/// Decode "len" bytes as a number starting at the current position in "self"
-static uint64_t
-app_lua_chunk_decode_int (lua_State *L, struct app_lua_chunk *self, size_t len)
+static struct app_diff_lookup *
+app_diff_lookup_new (const struct app_diff_chunk *chunks, size_t len)
 {
-	if (self->position + (int64_t) len > self->len)
-		return luaL_error (L, "unexpected EOF");
-
-	void *s = g.data + (self->offset - g.data_offset) + self->position;
-	return app_decode (s, len, self->endianity);
+	struct app_diff_lookup *lookup = xcalloc (MAX (len, 1), sizeof *lookup);
+	for (size_t i = 0; i < len; i++)
+		lookup[i] = (struct app_diff_lookup) { chunks[i].hash, i };
+	qsort (lookup, len, sizeof *lookup, app_diff_lookup_cmp);
+	return lookup;
 }
 
-#define APP_LUA_CHUNK_INT(name, type)                                          \
-	static int                                                                 \
-	app_lua_chunk_ ## name (lua_State *L)                                      \
-	{                                                                          \
-		struct app_lua_chunk *self =                                           \
-			luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);                      \
-		type v = app_lua_chunk_decode_int (L, self, sizeof v);                 \
-		lua_pushinteger (L, v);                                                \
-		app_lua_chunk_finish_read (L, self, sizeof v);                         \
-		return 1;                                                              \
+/// Find the first chunk at or after "from" with the given hash,
+/// returning SIZE_MAX if there is none
+static size_t
+app_diff_lookup_find (const struct app_diff_lookup *lookup, size_t len,
+	uint64_t hash, size_t from)
+{
+	struct app_diff_lookup key = { hash, from };
+	size_t lo = 0, hi = len;
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if (app_diff_lookup_cmp (&lookup[mid], &key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
+	if (lo == len || lookup[lo].hash != hash)
+		return SIZE_MAX;
+	return lookup[lo].index;
+}
 
-APP_LUA_CHUNK_INT (u8,  uint8_t)  APP_LUA_CHUNK_INT (s8,  int8_t)
-APP_LUA_CHUNK_INT (u16, uint16_t) APP_LUA_CHUNK_INT (s16, int16_t)
-APP_LUA_CHUNK_INT (u32, uint32_t) APP_LUA_CHUNK_INT (s32, int32_t)
-APP_LUA_CHUNK_INT (u64, uint64_t) APP_LUA_CHUNK_INT (s64, int64_t)
-
-static luaL_Reg app_lua_chunk_table[] =
+static void
+app_diff_add_anchor (struct app_diff_part *part,
+	int64_t a, int64_t b, int64_t len)
+{
+	struct app_diff_anchor *last = part->anchors_len
+		? &part->anchors[part->anchors_len - 1] : NULL;
+	if (last && last->a + last->len == a && last->b + last->len == b)
+		last->len += len;
+	else
+	{
+		ARRAY_RESERVE (part->anchors, 1);
+		part->anchors[part->anchors_len++] =
+			(struct app_diff_anchor) { a, b, len };
+	}
+}
+
+static void
+app_diff_add_range (struct app_diff_part *part,
+	int64_t a, int64_t a_len, int64_t b, int64_t b_len)
+{
+	struct app_diff_range *last = part->ranges_len
+		? &part->ranges[part->ranges_len - 1] : NULL;
+	if (last && last->a_len == last->b_len && a_len == b_len
+	 && a - (last->a + last->a_len) < DIFF_MERGE
+	 && a - last->a == b - last->b)
+		last->a_len = last->b_len = a + a_len - last->a;
+	else
+	{
+		ARRAY_RESERVE (part->ranges, 1);
+		part->ranges[part->ranges_len++] =
+			(struct app_diff_range) { a, a_len, b, b_len };
+	}
+}
+
+/// Narrow down a gap between anchors to what actually differs
+static void
+app_diff_add_gap (struct app_diff *self, struct app_diff_part *part,
+	int64_t a, int64_t a_end, int64_t b, int64_t b_end)
+{
+	const uint8_t *pa = self->inputs[0], *pb = self->inputs[1];
+	while (a < a_end && b < b_end && pa[a] == pb[b])
+		a++, b++;
+	while (a < a_end && b < b_end && pa[a_end - 1] == pb[b_end - 1])
+		a_end--, b_end--;
+
+	if (a_end - a != b_end - b)
+	{
+		app_diff_add_range (part, a, a_end - a, b, b_end - b);
+		return;
+	}
+	for (int64_t i = 0; i < a_end - a; i++)
+	{
+		if (pa[a + i] == pb[b + i])
+			continue;
+
+		int64_t len = 1;
+		while (i + len < a_end - a && pa[a + i + len] != pb[b + i + len])
+			len++;
+		app_diff_add_range (part, a + i, len, b + i, len);
+		i += len;
+	}
+}
+
+/// Pair up chunks of both inputs by their hashes, which is cheap enough
+/// to do in one go, and split the pairs into parts to be verified
+static void
+app_diff_match (struct app_task *task, size_t worker, size_t job)
+{
+	(void) worker;
+	(void) job;
+
+	// Segments of both inputs follow each other, in order
+	struct app_diff *self = task->user_data;
+	ARRAY (struct app_diff_chunk, ca)
+	ARRAY (struct app_diff_chunk, cb)
+	ARRAY_INIT (ca);
+	ARRAY_INIT (cb);
+	for (size_t i = 0; i < self->segments_len; i++)
+	{
+		struct app_diff_segment *segment = &self->segments[i];
+		if (segment->side)
+		{
+			ARRAY_RESERVE (cb, segment->chunks_len);
+			memcpy (cb + cb_len, segment->chunks,
+				segment->chunks_len * sizeof *cb);
+			cb_len += segment->chunks_len;
+		}
+		else
+		{
+			ARRAY_RESERVE (ca, segment->chunks_len);
+			memcpy (ca + ca_len, segment->chunks,
+				segment->chunks_len * sizeof *ca);
+			ca_len += segment->chunks_len;
+		}
+		free (segment->chunks);
+		segment->chunks = NULL;
+	}
+
+	struct app_diff_lookup *la = app_diff_lookup_new (ca, ca_len);
+	struct app_diff_lookup *lb = app_diff_lookup_new (cb, cb_len);
+	size_t i = 0, j = 0;
+	while (i < ca_len && j < cb_len)
+	{
+		// Each pair is kept separate, so that parts stay reasonably sized
+		if (ca[i].hash == cb[j].hash && ca[i].len == cb[j].len)
+		{
+			ARRAY_RESERVE (self->pairs, 1);
+			self->pairs[self->pairs_len++] = (struct app_diff_anchor)
+				{ ca[i].offset, cb[j].offset, ca[i].len };
+			i++, j++;
+			continue;
+		}
+
+		// Skip over whichever side seems to have had data inserted,
+		// or over both when the chunks were simply rewritten
+		size_t ja = app_diff_lookup_find (lb, cb_len, ca[i].hash, j + 1);
+		size_t ib = app_diff_lookup_find (la, ca_len, cb[j].hash, i + 1);
+		bool near_a = ja != SIZE_MAX && ja - j < DIFF_LOOKAHEAD;
+		bool near_b = ib != SIZE_MAX && ib - i < DIFF_LOOKAHEAD;
+		if (near_a && (!near_b || ja - j <= ib - i))
+			j = ja;
+		else if (near_b)
+			i = ib;
+		else
+			i++, j++;
+	}
+	free (la);
+	free (lb);
+	free (ca);
+	free (cb);
+
+	// The last part always extends to the end of both inputs
+	size_t first = 0;
+	int64_t start = 0;
+	for (size_t k = 0; k <= self->pairs_len; k++)
+	{
+		int64_t end = k < self->pairs_len
+			? self->pairs[k].a + self->pairs[k].len : INT64_MAX;
+		if (end - start < DIFF_SEGMENT && k < self->pairs_len)
+			continue;
+
+		self->parts = xreallocarray (self->parts,
+			self->parts_len + 1, sizeof *self->parts);
+		struct app_diff_part *part = &self->parts[self->parts_len++];
+		*part = (struct app_diff_part)
+			{ .first = first, .last = MIN (k + 1, self->pairs_len) };
+		ARRAY_INIT (part->anchors);
+		ARRAY_INIT (part->ranges);
+		first = k + 1;
+		start = end;
+	}
+}
+
+/// Verify pairs within a part, and narrow down the gaps in between
+static void
+app_diff_verify (struct app_task *task, size_t worker, size_t job)
+{
+	(void) worker;
+
+	struct app_diff *self = task->user_data;
+	struct app_diff_part *part = &self->parts[job];
+	const uint8_t *pa = self->inputs[0], *pb = self->inputs[1];
+
+	int64_t a = 0, b = 0;
+	if (part->first)
+	{
+		const struct app_diff_anchor *before = &self->pairs[part->first - 1];
+		a = before->a + before->len;
+		b = before->b + before->len;
+	}
+
+	// Hashes may collide, such pairs merely become a part of a gap
+	for (size_t k = part->first; k < part->last; k++)
+	{
+		const struct app_diff_anchor *pair = &self->pairs[k];
+		if (memcmp (pa + pair->a, pb + pair->b, pair->len))
+			continue;
+
+		app_diff_add_gap (self, part, a, pair->a, b, pair->b);
+		app_diff_add_anchor (part, pair->a, pair->b, pair->len);
+		a = pair->a + pair->len;
+		b = pair->b + pair->len;
+	}
+
+	int64_t a_end = self->inputs_len[0], b_end = self->inputs_len[1];
+	if (job + 1 < self->parts_len)
+	{
+		const struct app_diff_anchor *last = &self->pairs[part->last - 1];
+		a_end = last->a + last->len;
+		b_end = last->b + last->len;
+	}
+	app_diff_add_gap (self, part, a, a_end, b, b_end);
+}
+
+/// Collect results of all parts, in order
+static void
+app_diff_publish (struct app_diff *self)
+{
+	for (size_t i = 0; i < self->parts_len; i++)
+	{
+		struct app_diff_part *part = &self->parts[i];
+		ARRAY_RESERVE (self->anchors, part->anchors_len);
+		memcpy (self->anchors + self->anchors_len, part->anchors,
+			part->anchors_len * sizeof *part->anchors);
+		self->anchors_len += part->anchors_len;
+
+		ARRAY_RESERVE (self->ranges, part->ranges_len);
+		memcpy (self->ranges + self->ranges_len, part->ranges,
+			part->ranges_len * sizeof *part->ranges);
+		self->ranges_len += part->ranges_len;
+
+		free (part->anchors);
+		free (part->ranges);
+	}
+	free (self->parts);
+	self->parts = NULL;
+	self->parts_len = 0;
+	self->aligned = true;
+}
+
+/// Load the other input to compare our data with, at the same offset
+static struct app_diff *
+app_diff_new (const char *filename, int64_t size_limit)
+{
+	struct app_diff *self = xcalloc (1, sizeof *self);
+	self->filename = xstrdup (filename);
+	ARRAY_INIT (self->pairs);
+	ARRAY_INIT (self->anchors);
+	ARRAY_INIT (self->ranges);
+	app_row_init (&self->row);
+
+	int fd = open (filename, O_RDONLY);
+	if (fd < 0)
+		exit_fatal ("cannot open `%s': %s", filename, strerror (errno));
+
+	uint8_t *data = NULL;
+	app_load (fd, g.data_offset, size_limit, &self->mapping,
+		&data, &self->inputs_len[1]);
+	self->inputs[1] = data;
+	close (fd);
+	return self;
+}
+
+static void
+app_diff_run (struct app_diff *self)
+{
+	// Our data needs to be in one piece, like the other input
+	self->inputs[0] = g.data;
+	self->inputs_len[0] = g.data_len;
+	if (g.edits_done)
+	{
+		struct app_edited live = app_edited_live ();
+		self->inputs[0] = self->copy = xmalloc (MAX (g.data_len, 1));
+		app_edited_read (&live, 0, self->copy, g.data_len);
+	}
+
+	// Any pseudo-random table will do, as long as it's the same for both
+	uint64_t state = 0;
+	for (size_t i = 0; i < N_ELEMENTS (self->gear); i++)
+	{
+		uint64_t z = (state += UINT64_C (0x9e3779b97f4a7c15));
+		z = (z ^ (z >> 30)) * UINT64_C (0xbf58476d1ce4e5b9);
+		z = (z ^ (z >> 27)) * UINT64_C (0x94d049bb133111eb);
+		self->gear[i] = z ^ (z >> 31);
+	}
+
+	for (int side = 0; side < 2; side++)
+		for (int64_t offset = 0; offset < self->inputs_len[side];
+			offset += DIFF_SEGMENT)
+		{
+			self->segments = xreallocarray (self->segments,
+				self->segments_len + 1, sizeof *self->segments);
+			self->segments[self->segments_len++] = (struct app_diff_segment)
+			{
+				.side = side,
+				.offset = offset,
+				.len = MIN (DIFF_SEGMENT, self->inputs_len[side] - offset),
+			};
+		}
+
+	if (!self->segments_len)
+	{
+		self->aligned = true;
+		return;
+	}
+
+	self->task.execute = app_diff_execute;
+	self->task.user_data = self;
+	app_task_start (&self->task, self->segments_len, app_cpu_count ());
+	self->running = true;
+	poller_timer_set (&self->timer, DIFF_POLL_MS);
+}
+
+static void
+app_on_diff_timer (void *user_data)
+{
+	struct app_diff *self = user_data;
+	if (self->stale)
+	{
+		self->stale = false;
+		app_diff_run (self);
+		return;
+	}
+	if (app_task_jobs_done (&self->task) < self->task.jobs_len)
+	{
+		poller_timer_set (&self->timer, DIFF_POLL_MS);
+		return;
+	}
+
+	app_task_wait (&self->task);
+	self->running = false;
+	if (self->task.execute == app_diff_execute)
+		self->task.execute = app_diff_match;
+	else if (self->task.execute == app_diff_match)
+		self->task.execute = app_diff_verify;
+	else
+	{
+		app_diff_publish (self);
+		g.generation++;
+		xui_invalidate ();
+		return;
+	}
+
+	size_t jobs = self->task.execute == app_diff_match ? 1 : self->parts_len;
+	app_task_start (&self->task, jobs, app_cpu_count ());
+	self->running = true;
+	poller_timer_set (&self->timer, DIFF_POLL_MS);
+}
+
+static void
+app_diff_start (struct app_diff *self)
+{
+	self->timer = poller_timer_make (&g.poller);
+	self->timer.dispatcher = app_on_diff_timer;
+	self->timer.user_data = self;
+	app_diff_run (self);
+}
+
+/// Stop and forget about all results, ready to run again
+static void
+app_diff_reset (struct app_diff *self)
+{
+	if (self->running)
+		app_task_cancel (&self->task);
+	self->running = self->aligned = false;
+	poller_timer_reset (&self->timer);
+
+	for (size_t i = 0; i < self->segments_len; i++)
+		free (self->segments[i].chunks);
+	free (self->segments);
+	self->segments = NULL;
+	self->segments_len = 0;
+
+	for (size_t i = 0; i < self->parts_len; i++)
+	{
+		free (self->parts[i].anchors);
+		free (self->parts[i].ranges);
+	}
+	free (self->parts);
+	self->parts = NULL;
+	self->parts_len = 0;
+
+	self->pairs_len = self->anchors_len = self->ranges_len = 0;
+	free (self->copy);
+	self->inputs[0] = self->copy = NULL;
+	self->inputs_len[0] = 0;
+}
+
+/// Start over once edits seem to have stopped for a while
+static void
+app_diff_invalidate (struct app_diff *self)
+{
+	app_diff_reset (self);
+	self->stale = true;
+	poller_timer_set (&self->timer, DIFF_RESTART_MS);
+}
+
+static void
+app_diff_free (struct app_diff *self)
+{
+	app_diff_reset (self);
+	free (self->pairs);
+	free (self->anchors);
+	free (self->ranges);
+	app_row_free (&self->row);
+
+	if (self->mapping.address)
+		munmap (self->mapping.address, self->mapping.len);
+	else
+		free ((uint8_t *) self->inputs[1]);
+	free (self->filename);
+	free (self);
+}
+
+/// Return the index of the last range starting at or before "offset"
+/// of the given input, or -1
+static ssize_t
+app_diff_find_range (const struct app_diff *self, int side, int64_t offset)
+{
+	ssize_t lo = 0, hi = self->ranges_len;
+	while (lo < hi)
+	{
+		ssize_t mid = lo + (hi - lo) / 2;
+		const struct app_diff_range *range = &self->ranges[mid];
+		if ((side ? range->b : range->a) <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo - 1;
+}
+
+/// Return whether the byte at "offset" of the given input differs
+static bool
+app_diff_differs (int side, int64_t offset)
+{
+	const struct app_diff *self = g.diff;
+	if (!self || !self->aligned)
+		return false;
+
+	ssize_t i = app_diff_find_range (self, side, offset);
+	if (i < 0)
+		return false;
+
+	const struct app_diff_range *range = &self->ranges[i];
+	int64_t start = side ? range->b : range->a;
+	int64_t len = side ? range->b_len : range->a_len;
+	if (offset >= start + len)
+		return false;
+	if (range->a_len != range->b_len)
+		return true;
+
+	int64_t delta = offset - start;
+	return self->inputs[0][range->a + delta]
+		!= self->inputs[1][range->b + delta];
+}
+
+/// Map an offset within our data to the corresponding one in the other input
+static int64_t
+app_diff_map (const struct app_diff *self, int64_t a)
+{
+	ssize_t lo = 0, hi = self->anchors_len;
+	while (lo < hi)
+	{
+		ssize_t mid = lo + (hi - lo) / 2;
+		if (self->anchors[mid].a <= a)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	// Within gaps, simply keep the same distance from the preceding anchor
+	int64_t a_end = 0, b_end = 0, limit = self->inputs_len[1];
+	if (lo)
+	{
+		const struct app_diff_anchor *anchor = &self->anchors[lo - 1];
+		if (a < anchor->a + anchor->len)
+			return anchor->b + (a - anchor->a);
+		a_end = anchor->a + anchor->len;
+		b_end = anchor->b + anchor->len;
+	}
+	if ((size_t) lo < self->anchors_len)
+		limit = self->anchors[lo].b;
+	return MAX (0, MIN (b_end + (a - a_end), limit - 1));
+}
+
+/// Find the closest difference in the given direction from the cursor
+static int64_t
+app_diff_find (bool forward)
+{
+	const struct app_diff *self = g.diff;
+	if (!self || !self->aligned)
+		return -1;
+
+	int64_t cursor = g.view_cursor - g.data_offset;
+	ssize_t i = app_diff_find_range (self, 0, cursor);
+	if (forward && (size_t) ++i < self->ranges_len)
+		return g.data_offset + self->ranges[i].a;
+	if (!forward && i >= 0 && self->ranges[i].a == cursor)
+		i--;
+	if (!forward && i >= 0)
+		return g.data_offset + self->ranges[i].a;
+	return -1;
+}
+
+// --- Editing -----------------------------------------------------------------
+
+// Edits never touch the original data, which may be mapped in from a file,
+// but rather rearrange a table of pieces referring to it, and to storage for
+// all newly typed in bytes.  The cost of an edit depends only on the number
+// of pieces, and saving only writes changed ranges, if it can.
+
+static size_t
+app_piece_find (int64_t offset)
+{
+	struct app_edited live = app_edited_live ();
+	return app_edited_find (&live, offset);
+}
+
+static const uint8_t *
+app_piece_data (const struct app_piece *piece)
+{
+	struct app_edited live = app_edited_live ();
+	return app_edited_piece_data (&live, piece);
+}
+
+static size_t
+app_edit_read (int64_t offset, uint8_t *buf, size_t len)
+{
+	struct app_edited live = app_edited_live ();
+	return app_edited_read (&live, offset, buf, len);
+}
+
+/// Make sure a piece starts at "offset", and return its index
+static size_t
+app_piece_split (int64_t offset)
+{
+	size_t i = app_piece_find (offset);
+	if (i == g.pieces_len || g.pieces[i].start == offset)
+		return i;
+
+	ARRAY_RESERVE (g.pieces, 1);
+	struct app_piece *piece = &g.pieces[i];
+	memmove (piece + 2, piece + 1, (g.pieces_len++ - i - 1) * sizeof *piece);
+
+	int64_t head = offset - piece->start;
+	piece[1] = (struct app_piece) {
+		offset, piece->offset + head, piece->len - head, piece->added };
+	piece->len = head;
+	return i + 1;
+}
+
+/// Replace "remove" bytes at "offset" with "insert_len" bytes from "insert"
+static void
+app_edit_splice (int64_t offset, int64_t remove,
+	const void *insert, size_t insert_len)
+{
+	size_t first = app_piece_split (offset);
+	size_t last = app_piece_split (offset + remove);
+	memmove (g.pieces + first, g.pieces + last,
+		(g.pieces_len - last) * sizeof *g.pieces);
+	g.pieces_len -= last - first;
+
+	// Consecutive typing extends a single piece
+	size_t next = first;
+	struct app_piece *previous = first ? &g.pieces[first - 1] : NULL;
+	if (!insert_len)
+		;
+	else if (previous && previous->added
+	 && previous->start + previous->len == offset
+	 && previous->offset + previous->len == (int64_t) g.added.len)
+		previous->len += insert_len;
+	else
+	{
+		ARRAY_RESERVE (g.pieces, 1);
+		memmove (g.pieces + first + 1, g.pieces + first,
+			(g.pieces_len++ - first) * sizeof *g.pieces);
+		g.pieces[next++] = (struct app_piece)
+			{ offset, g.added.len, insert_len, true };
+	}
+	str_append_data (&g.added, insert, insert_len);
+
+	int64_t delta = (int64_t) insert_len - remove;
+	for (size_t i = next; i < g.pieces_len; i++)
+		g.pieces[i].start += delta;
+	g.data_len += delta;
+	g.generation++;
+
+	// Background tasks over the data need to follow the edit
+	if (g.search)
+		app_search_splice (g.search, offset, remove, insert_len);
+	if (g.overview)
+		app_overview_restart (offset, remove, insert_len);
+	if (g.diff)
+		app_diff_invalidate (g.diff);
+
+	// The field index reads marks from another thread
+	struct app_splice splice = { g.data_offset + offset, remove, insert_len };
+	if (g.fields)
+		app_field_index_stop (g.fields);
+	app_shift_marks (&splice);
+#ifdef WITH_LUA
+	// Decoders catch up in the background, see app_on_redecode()
+	ARRAY_RESERVE (g.splices, 1);
+	g.splices[g.splices_len++] = splice;
+	poller_idle_set (&g.redecode_event);
+#endif // WITH_LUA
+}
+
+/// Make an edit that can be undone
+static void
+app_edit (int64_t offset, int64_t remove, const void *insert, size_t insert_len)
+{
+	struct app_edit edit = { offset, str_make (), str_make () };
+	str_reserve (&edit.removed, remove);
+	edit.removed.len =
+		app_edit_read (offset, (uint8_t *) edit.removed.str, remove);
+	edit.removed.str[edit.removed.len] = '\0';
+	str_append_data (&edit.inserted, insert, insert_len);
+
+	// Making an edit forgets about everything that has been undone
+	while (g.edits_len > g.edits_done)
+	{
+		struct app_edit *forgotten = &g.edits[--g.edits_len];
+		str_free (&forgotten->removed);
+		str_free (&forgotten->inserted);
+	}
+	if (g.edits_saved > g.edits_len)
+		g.edits_saved = SIZE_MAX;
+
+	ARRAY_RESERVE (g.edits, 1);
+	g.edits[g.edits_len++] = edit;
+	g.edits_done = g.edits_len;
+	app_edit_splice (offset, edit.removed.len, insert, insert_len);
+}
+
+/// Undo or redo the last edit, returning where it took place, or -1
+static int64_t
+app_edit_undo (bool redo)
+{
+	if (redo ? g.edits_done == g.edits_len : !g.edits_done)
+		return -1;
+
+	struct app_edit *edit = &g.edits[redo ? g.edits_done++ : --g.edits_done];
+	const struct str *from = redo ? &edit->removed : &edit->inserted;
+	const struct str *to = redo ? &edit->inserted : &edit->removed;
+	app_edit_splice (edit->offset, from->len, to->str, to->len);
+	return edit->offset;
+}
+
+static bool
+app_edit_modified (void)
+{
+	return g.edits_done != g.edits_saved;
+}
+
+static bool
+app_write_all (int fd, const void *data, size_t len, int64_t offset,
+	struct error **e)
+{
+	while (len)
+	{
+		ssize_t written = offset < 0
+			? write (fd, data, len) : pwrite (fd, data, len, offset);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+		{
+			error_set (e, "%s", strerror (errno));
+			return false;
+		}
+
+		data = (const char *) data + written;
+		len -= written;
+		if (offset >= 0)
+			offset += written;
+	}
+	return true;
+}
+
+/// Copy the range [from, to) of a file into another one, or up to its end.
+/// Where possible, the data doesn't pass through user space at all.
+static bool
+app_copy_range (int in, int out, int64_t from, int64_t to, struct error **e)
+{
+#ifdef __linux__
+	while (to < 0 || from < to)
+	{
+		size_t len = 1 << 30;
+		if (to >= 0)
+			len = MIN ((int64_t) len, to - from);
+
+		off_t offset = from;
+		ssize_t n_sent = sendfile (out, in, &offset, len);
+		if (n_sent < 0 && errno == EINTR)
+			continue;
+		// Some file systems don't support it, fall back to copying
+		if (n_sent < 0 && (errno == EINVAL || errno == ENOSYS))
+			break;
+		if (n_sent < 0)
+		{
+			error_set (e, "%s", strerror (errno));
+			return false;
+		}
+		if (!n_sent)
+			return true;
+		from += n_sent;
+	}
+#endif // __linux__
+
+	char buf[1 << 16];
+	while (to < 0 || from < to)
+	{
+		size_t len = sizeof buf;
+		if (to >= 0)
+			len = MIN ((int64_t) len, to - from);
+
+		ssize_t n_read = pread (in, buf, len, from);
+		if (n_read < 0 && errno == EINTR)
+			continue;
+		if (n_read < 0)
+		{
+			error_set (e, "%s", strerror (errno));
+			return false;
+		}
+		if (!n_read)
+			break;
+		if (!app_write_all (out, buf, n_read, -1, e))
+			return false;
+		from += n_read;
+	}
+	return true;
+}
+
+/// Write the file anew next to the original, then replace it
+static bool
+app_save_rewrite (struct error **e)
+{
+	struct stat st = {};
+	int in = open (g.filename, O_RDONLY);
+	if (in < 0 || fstat (in, &st))
+	{
+		error_set (e, "%s: %s", g.filename, strerror (errno));
+		if (in >= 0)
+			close (in);
+		return false;
+	}
+
+	char *path = xstrdup_printf ("%s.XXXXXX", g.filename);
+	int out = mkstemp (path);
+	bool ok = out >= 0
+		&& app_copy_range (in, out, 0, g.data_offset, e);
+	for (size_t i = 0; ok && i < g.pieces_len; i++)
+		ok = app_write_all (out, app_piece_data (&g.pieces[i]),
+			g.pieces[i].len, -1, e);
+	ok = ok && app_copy_range (in, out, g.data_offset + g.saved_len, -1, e);
+	if (ok && (fchmod (out, st.st_mode & 07777) || fsync (out)
+	 || rename (path, g.filename)))
+	{
+		error_set (e, "%s", strerror (errno));
+		ok = false;
+	}
+	if (out < 0)
+		error_set (e, "%s: %s", path, strerror (errno));
+	else
+		close (out);
+	if (out >= 0 && !ok)
+		unlink (path);
+
+	close (in);
+	free (path);
+	return ok;
+}
+
+/// Retrieve the selected range of addresses [start, end), if there is any
+static bool
+app_selection (int64_t *start, int64_t *end)
+{
+	if (g.view_anchor < 0)
+		return false;
+
+	// The anchor may have ended up past the end as a result of editing
+	int64_t end_addr = g.data_offset + g.data_len;
+	*start = MIN (g.view_anchor, g.view_cursor);
+	*end = MIN (MAX (g.view_anchor, g.view_cursor) + 1, end_addr);
+	return *start < *end;
+}
+
+/// Retrieve the range of addresses to extract: the selection, if any,
+/// or else the innermost mark at the cursor
+static bool
+app_extract_range (int64_t *start, int64_t *end)
+{
+	if (app_selection (start, end))
+		return true;
+
+	const struct marks_by_offset *marks = app_marks_at_offset (g.view_cursor);
+	if (!marks)
+		return false;
+
+	const struct mark *best = NULL;
+	for (struct mark **iter = g.offset_entries + marks->marks; *iter; iter++)
+		if (!best || (*iter)->len < best->len)
+			best = *iter;
+	if (!best)
+		return false;
+
+	*start = MAX (best->offset, g.data_offset);
+	*end = MIN (best->offset + best->len, g.data_offset + g.data_len);
+	return *start < *end;
+}
+
+/// Write a range of the edited data out to a new file.  Unchanged parts
+/// of a mapped file are copied from it, which saves on memory traffic.
+static bool
+app_extract (const char *path, int64_t offset, int64_t len, struct error **e)
+{
+	// The mapping would see any in-place saves, and so does the file
+	int in = g.filename ? open (g.filename, O_RDONLY) : -1;
+	bool copy = in >= 0 && g.mapping.address && g.file_in_sync;
+
+	// Only truncate once it's clear that it isn't our own file,
+	// which would pull the data from under us, or lose it altogether
+	struct stat st_in = {}, st_out = {};
+	int out = open (path, O_WRONLY | O_CREAT, 0666);
+	bool ok = out >= 0 && !fstat (out, &st_out);
+	if (ok && in >= 0 && !fstat (in, &st_in)
+	 && st_in.st_dev == st_out.st_dev && st_in.st_ino == st_out.st_ino)
+	{
+		error_set (e, "%s: %s", path, "this is the file being viewed");
+		close (out);
+		close (in);
+		return false;
+	}
+	if (!ok || ftruncate (out, 0))
+	{
+		error_set (e, "%s: %s", path, strerror (errno));
+		if (out >= 0)
+			close (out);
+		if (in >= 0)
+			close (in);
+		return false;
+	}
+
+	for (size_t i = app_piece_find (offset);
+		ok && len > 0 && i < g.pieces_len; i++)
+	{
+		const struct app_piece *piece = &g.pieces[i];
+		int64_t skip = offset - piece->start;
+		int64_t chunk = MIN (len, piece->len - skip);
+		if (piece->added || !copy)
+			ok = app_write_all (out, app_piece_data (piece) + skip, chunk,
+				-1, e);
+		else
+		{
+			int64_t from = g.data_offset + piece->offset + skip;
+			ok = app_copy_range (in, out, from, from + chunk, e);
+		}
+		offset += chunk;
+		len -= chunk;
+	}
+	if (close (out) && ok)
+	{
+		error_set (e, "%s: %s", path, strerror (errno));
+		ok = false;
+	}
+	if (in >= 0)
+		close (in);
+	return ok;
+}
+
+/// Save the edited data; if its layout within the file hasn't changed,
+/// only write what has been typed in, in place
+static bool
+app_save (struct error **e)
+{
+	if (!g.filename)
+	{
+		error_set (e, "there is no file to save to");
+		return false;
+	}
+
+	bool in_place = g.file_in_sync && g.data_len == g.original_len;
+	for (size_t i = 0; in_place && i < g.pieces_len; i++)
+		in_place = g.pieces[i].added
+			|| g.pieces[i].offset == g.pieces[i].start;
+	if (!in_place)
+	{
+		if (!app_save_rewrite (e))
+			return false;
+		g.saved_len = g.data_len;
+		g.file_in_sync = false;
+		g.edits_saved = g.edits_done;
+		return true;
+	}
+
+	int fd = open (g.filename, O_WRONLY);
+	if (fd < 0)
+	{
+		error_set (e, "%s: %s", g.filename, strerror (errno));
+		return false;
+	}
+
+	bool ok = true;
+	for (size_t i = 0; ok && i < g.pieces_len; i++)
+		if (g.pieces[i].added)
+			ok = app_write_all (fd, app_piece_data (&g.pieces[i]),
+				g.pieces[i].len, g.data_offset + g.pieces[i].start, e);
+	if (close (fd) && ok)
+	{
+		error_set (e, "%s", strerror (errno));
+		ok = false;
+	}
+	if (ok)
+		g.edits_saved = g.edits_done;
+	return ok;
+}
+
+// --- Read-ahead --------------------------------------------------------------
+
+// Mapped data only gets read in as it is touched, which makes the user
+// interface stall on slow storage.  Ranges that are likely to be shown next
+// are requested ahead of time: past the view in the direction it is moving,
+// with the window growing with speed, and around neighbouring field jumps.
+// With io_uring, reads complete within the event loop, otherwise the kernel
+// is merely advised to read the pages in on its own.
+
+enum
+{
+	READAHEAD_MIN = 1 << 18,            ///< Smallest window, in bytes
+	READAHEAD_MAX = 1 << 25,            ///< Largest window, in bytes
+	READAHEAD_JUMP = 1 << 16,           ///< Prefetched at jump targets
+	READAHEAD_CHUNK = 1 << 18,          ///< Size of a single read
+	READAHEAD_QUEUE = 128               ///< Most reads in flight
+};
+
+struct app_readahead
+{
+	int fd;                             ///< Duplicate of the input file
+
+	int64_t last_top;                   ///< "view_top" at the last update
+	int direction;                      ///< Last direction of movement
+	int64_t window;                     ///< Current size of the window
+	int64_t requested_start;            ///< Start of the range requested
+	int64_t requested_end;              ///< End of the range requested
+	ssize_t last_marks;                 ///< Marks under the cursor last time
+
+#ifdef WITH_URING
+	struct io_uring ring;               ///< Queue of reads
+	int event_fd;                       ///< Signals completions
+	struct poller_fd event;             ///< Completion event
+	uint8_t *sink;                      ///< Read buffer, contents discarded
+	size_t inflight;                    ///< Reads in flight
+#endif // WITH_URING
+};
+
+#ifdef WITH_URING
+
+static void
+app_on_readahead_completion (const struct pollfd *pfd, void *user_data)
+{
+	struct app_readahead *self = user_data;
+	uint64_t count = 0;
+	(void) read (pfd->fd, &count, sizeof count);
+
+	struct io_uring_cqe *cqe = NULL;
+	while (!io_uring_peek_cqe (&self->ring, &cqe))
+	{
+		io_uring_cqe_seen (&self->ring, cqe);
+		self->inflight--;
+	}
+}
+
+static bool
+app_readahead_init_uring (struct app_readahead *self)
+{
+	if (io_uring_queue_init (READAHEAD_QUEUE, &self->ring, 0))
+		return false;
+	if ((self->event_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+		goto fail;
+	if (io_uring_register_eventfd (&self->ring, self->event_fd))
+		goto fail_eventfd;
+
+	self->sink = xmalloc (READAHEAD_CHUNK);
+	self->event = poller_fd_make (&g.poller, self->event_fd);
+	self->event.dispatcher = app_on_readahead_completion;
+	self->event.user_data = self;
+	poller_fd_set (&self->event, POLLIN);
+	return true;
+
+fail_eventfd:
+	close (self->event_fd);
+fail:
+	io_uring_queue_exit (&self->ring);
+	self->event_fd = -1;
+	return false;
+}
+
+/// Queue reads of as much of the range as possible, returning where they end
+static int64_t
+app_readahead_submit (struct app_readahead *self, int64_t offset, int64_t end)
+{
+	struct io_uring_sqe *sqe = NULL;
+	while (offset < end && self->inflight < READAHEAD_QUEUE
+	 && (sqe = io_uring_get_sqe (&self->ring)))
+	{
+		unsigned len = MIN (end - offset, READAHEAD_CHUNK);
+		io_uring_prep_read (sqe, self->fd, self->sink, len, offset);
+		self->inflight++;
+		offset += len;
+	}
+	io_uring_submit (&self->ring);
+	return offset;
+}
+
+#endif // WITH_URING
+
+/// Request a range of data relative to its start, which is clipped
+/// to the data as loaded.  Returns where the request ends.
+static int64_t
+app_readahead_request (struct app_readahead *self, int64_t start, int64_t end)
+{
+	start = MAX (start, 0);
+	end = MIN (end, g.original_len);
+	if (start >= end)
+		return end;
+
+	// Offsets within the mapping are page-aligned just like those in the file
+	int64_t page_size = sysconf (_SC_PAGESIZE);
+	int64_t base = g.mapping.data - (uint8_t *) g.mapping.address;
+	int64_t from = (base + start) / page_size * page_size;
+	int64_t to = base + end;
+
+	int64_t file_start = g.data_offset - base;
+#ifdef WITH_URING
+	if (self->event_fd >= 0)
+		return app_readahead_submit
+			(self, file_start + from, file_start + to) - file_start - base;
+#endif // WITH_URING
+#ifdef POSIX_FADV_WILLNEED
+	(void) posix_fadvise (self->fd, file_start + from, to - from,
+		POSIX_FADV_WILLNEED);
+#else
+	(void) self;
+	(void) file_start;
+	(void) posix_madvise ((uint8_t *) g.mapping.address + from, to - from,
+		POSIX_MADV_WILLNEED);
+#endif
+	return end;
+}
+
+/// Follow the view, called whenever the screen is about to be laid out
+static void
+app_readahead_update (void)
+{
+	struct app_readahead *self = g.readahead;
+	if (!self)
+		return;
+
+	// Edits shift the data somewhat, which doesn't matter much here
+	int64_t top = g.view_top - g.data_offset;
+	int64_t delta = top - self->last_top;
+	self->last_top = top;
+	if (delta)
+	{
+		int direction = delta > 0 ? 1 : -1;
+		int64_t speed = MAX (delta, -delta) * 8;
+		if (direction != self->direction
+		 || top < self->requested_start - self->window
+		 || top > self->requested_end + self->window)
+		{
+			self->direction = direction;
+			self->window = READAHEAD_MIN;
+			self->requested_start = self->requested_end = top;
+		}
+		self->window = MIN (READAHEAD_MAX,
+			MAX (self->window, MAX (READAHEAD_MIN, speed)));
+	}
+
+	// Only ask for what hasn't been asked for yet
+	if (self->direction >= 0
+	 && self->requested_end < top + self->window)
+	{
+		self->requested_end = app_readahead_request (self,
+			MAX (self->requested_end, top), top + self->window);
+	}
+	if (self->direction < 0
+	 && self->requested_start > top - self->window)
+	{
+		app_readahead_request (self,
+			top - self->window, MIN (self->requested_start, top));
+		self->requested_start = top - self->window;
+	}
+
+	ssize_t i = app_find_marks (g.view_cursor);
+	if (i == self->last_marks)
+		return;
+
+	self->last_marks = i;
+	for (ssize_t k = i - 1; k <= i + 1; k += 2)
+	{
+		if (k < 0 || (size_t) k >= g.marks_by_offset_len)
+			continue;
+
+		int64_t target = g.marks_by_offset[k].offset - g.data_offset;
+		app_readahead_request (self, target, target + READAHEAD_JUMP);
+	}
+}
+
+/// Start reading ahead in mapped data, taking ownership of the descriptor
+static void
+app_readahead_start (int fd)
+{
+	struct app_readahead *self = g.readahead = xcalloc (1, sizeof *self);
+	self->fd = fd;
+	self->last_top = g.view_top - g.data_offset;
+	self->window = READAHEAD_MIN;
+	self->requested_start = self->requested_end = self->last_top;
+	self->last_marks = -1;
+
+#ifdef WITH_URING
+	self->event_fd = -1;
+	if (!app_readahead_init_uring (self))
+		print_debug ("io_uring is unavailable, falling back to advice");
+#endif // WITH_URING
+}
+
+static void
+app_readahead_free (void)
+{
+	struct app_readahead *self = g.readahead;
+	if (!self)
+		return;
+
+#ifdef WITH_URING
+	if (self->event_fd >= 0)
+	{
+		poller_fd_reset (&self->event);
+
+		// The kernel would keep writing to the buffer
+		struct io_uring_cqe *cqe = NULL;
+		while (self->inflight && !io_uring_wait_cqe (&self->ring, &cqe))
+		{
+			io_uring_cqe_seen (&self->ring, cqe);
+			self->inflight--;
+		}
+		io_uring_queue_exit (&self->ring);
+		close (self->event_fd);
+		free (self->sink);
+	}
+#endif // WITH_URING
+	close (self->fd);
+	free (self);
+	g.readahead = NULL;
+}
+
+// --- Layouting ---------------------------------------------------------------
+
+enum
+{
+	WIDGET_NONE = 0, WIDGET_HEX, WIDGET_ASCII, WIDGET_ENDIANITY,
+	WIDGET_OVERVIEW,
+};
+
+struct layout
+{
+	struct widget *head;
+	struct widget *tail;
+};
+
+static struct widget *
+app_label (chtype attrs, const char *label)
+{
+	return g_xui.ui->label (attrs, 0, label);
+}
+
+static struct widget *
+app_mono_label (chtype attrs, const char *label)
+{
+	return g_xui.ui->label (attrs, XUI_ATTR_MONOSPACE, label);
+}
+
+static struct widget *
+app_mono_padding (chtype attrs, float width, float height)
+{
+	struct widget *w = g_xui.ui->padding (attrs, width, height);
+	w->width = width * g.digitw;
+	return w;
+}
+
+static struct widget *
+app_push (struct layout *l, struct widget *w)
+{
+	LIST_APPEND_WITH_TAIL (l->head, l->tail, w);
+	return w;
+}
+
+static struct widget *
+app_push_hfill (struct layout *l, struct widget *w)
+{
+	w->width = -1;
+	return app_push (l, w);
+}
+
+static struct widget *
+app_push_vfill (struct layout *l, struct widget *w)
+{
+	w->height = -1;
+	return app_push (l, w);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static int
+app_visible_rows (void)
+{
+	int occupied = 1 /* bar */ + 3 /* decoder */;
+	return MAX (0, g_xui.height - occupied * g_xui.vunit) / g_xui.vunit;
+}
+
+/// Checks what items are visible and returns if fixes were needed
+static bool
+app_fix_view_range (void)
+{
+	int64_t data_view_start = g.data_offset / ROW_SIZE * ROW_SIZE;
+	if (g.view_top < data_view_start)
+	{
+		g.view_top = data_view_start;
+		xui_invalidate ();
+		return false;
+	}
+
+	// If the contents are at least as long as the screen, always fill it
+	int64_t last_byte = g.data_offset + g.data_len - 1;
+	int64_t max_view_top =
+		(last_byte / ROW_SIZE - app_visible_rows () + 1) * ROW_SIZE;
+	// But don't let that suggest a negative offset
+	max_view_top = MAX (max_view_top, 0);
+
+	if (g.view_top > max_view_top)
+	{
+		g.view_top = max_view_top;
+		xui_invalidate ();
+		return false;
+	}
+	return true;
+}
+
+/// Scroll down (positive) or up (negative) @a n items
+static bool
+app_scroll (int n)
+{
+	g.view_top += n * ROW_SIZE;
+	xui_invalidate ();
+	return app_fix_view_range ();
+}
+
+static void
+app_ensure_selection_visible (void)
+{
+	int too_high = g.view_top / ROW_SIZE - g.view_cursor / ROW_SIZE;
+	if (too_high > 0)
+		app_scroll (-too_high);
+
+	int too_low = g.view_cursor / ROW_SIZE - g.view_top / ROW_SIZE
+		- app_visible_rows () + 1;
+	if (too_low > 0)
+		app_scroll (too_low);
+}
+
+static bool
+app_move_cursor_by_rows (int diff)
+{
+	// TODO: disallow partial up/down movement
+	int64_t fixed = g.view_cursor += diff * ROW_SIZE;
+	fixed = MAX (fixed, g.data_offset);
+	fixed = MIN (fixed, g.data_offset + g.data_len - 1);
+
+	bool result = g.view_cursor == fixed;
+	g.view_cursor = fixed;
+	xui_invalidate ();
+
+	app_ensure_selection_visible ();
+	return result;
+}
+
+// Key repeats arriving in a burst are only laid out once, see
+// app_coalesce_input(), so repeated movement is held back until then,
+// and applied all at once.  Mixing movements would change the outcome.
+
+/// Apply any movement that has been held back
+static void
+app_flush_movement (void)
+{
+	int scroll = g.pending_scroll, rows = g.pending_rows;
+	g.pending_scroll = g.pending_rows = 0;
+	if (scroll)
+		(void) app_scroll (scroll);
+	if (rows)
+		(void) app_move_cursor_by_rows (rows);
+}
+
+/// Hold back movement by "delta" rows, adding it to "pending"
+static void
+app_hold_movement (int *pending, int delta)
+{
+	int *other = pending == &g.pending_scroll
+		? &g.pending_rows : &g.pending_scroll;
+	if (*other || (*pending && (*pending > 0) != (delta > 0)))
+		app_flush_movement ();
+
+	*pending += delta;
+	xui_invalidate ();
+}
+
+// Rows are laid out as runs of text sharing the same attributes, which only
+// get turned into labels afterwards.  Because they are cached, moving around
+// only needs to lay out again those rows whose contents or highlights change.
+
+/// Append text, only starting a new run when attributes change
+static void
+app_row_append (struct app_row *self, chtype attrs, const char *s, size_t len)
+{
+	if (!self->open || self->runs[self->runs_len - 1].attrs != attrs)
+	{
+		if (self->open)
+			str_append_c (&self->texts, 0);
+
+		ARRAY_RESERVE (self->runs, 1);
+		self->runs[self->runs_len++] =
+			(struct app_row_run) { attrs, self->texts.len };
+		self->open = true;
+	}
+	str_append_data (&self->texts, s, len);
+}
+
+static void
+app_row_section (struct app_row *self, int section)
+{
+	if (self->open)
+		str_append_c (&self->texts, 0);
+
+	self->open = false;
+	self->sections[section] = self->runs_len;
+}
+
+static void
+app_row_push (struct app_row *self, int section, struct layout *l)
+{
+	for (size_t i = self->sections[section];
+		i < self->sections[section + 1]; i++)
+	{
+		struct app_row_run *run = &self->runs[i];
+		app_push (l, app_mono_label (run->attrs, self->texts.str + run->text));
+	}
+}
+
+static inline void
+app_layout_hex_cell (struct app_row *row, int attrs, int64_t addr,
+	const char *s)
+{
+	if (app_diff_differs (0, addr - g.data_offset))
+		attrs = APP_ATTR (DIFF);
+	if (app_search_covers (addr))
+		attrs = APP_ATTR (MATCH);
+	if (addr >= row->selection_start
+	 && addr <  row->selection_end)
+		attrs = APP_ATTR (SELECTION);
+	if (addr >= g.view_cursor
+	 && addr <  g.view_cursor + 8)
+		attrs |= A_UNDERLINE;
+
+	if (addr != g.view_cursor)
+		app_row_append (row, attrs, s, 2);
+	else if (g.view_skip_nibble)
+	{
+		app_row_append (row, attrs, s, 1);
+		app_row_append (row, attrs ^ A_REVERSE, s + 1, 1);
+	}
+	else
+	{
+		app_row_append (row, attrs ^ A_REVERSE, s, 1);
+		app_row_append (row, attrs, s + 1, 1);
+	}
+}
+
+static inline void
+app_layout_ascii_cell (struct app_row *row, int attrs, int64_t addr, char c)
+{
+	// TODO: leave it up to the user to decide what should be colored
+	struct marks_by_offset *marks = app_marks_at_offset (addr);
+	if (marks && marks->color >= 0)
+		attrs = g.attrs[marks->color].attrs;
+	if (app_diff_differs (0, addr - g.data_offset))
+		attrs = APP_ATTR (DIFF);
+	if (app_search_covers (addr))
+		attrs = APP_ATTR (MATCH);
+	if (addr >= row->selection_start
+	 && addr <  row->selection_end)
+		attrs = APP_ATTR (SELECTION);
+
+	if (addr >= g.view_cursor
+	 && addr <  g.view_cursor + 8)
+		attrs |= A_UNDERLINE;
+
+	app_row_append (row, attrs, &c, 1);
+}
+
+/// Separators are spaces within runs, at the places of former paddings
+static void
+app_layout_row_runs (struct app_row *row, int64_t addr, int attrs)
+{
+	str_reset (&row->texts);
+	row->runs_len = 0;
+	row->open = false;
+
+	app_row_section (row, ROW_ADDRESS);
+	char *row_addr_str = xstrdup_printf ("%08" PRIx64, addr);
+	app_row_append (row, attrs, row_addr_str, strlen (row_addr_str));
+	free (row_addr_str);
+
+	// Convert all the bytes at once, the cells then only pick their parts
+	int64_t end_addr = g.data_offset + g.data_len;
+	int64_t from = MAX (addr, g.data_offset) - addr;
+	int64_t to = MIN (addr + ROW_SIZE, end_addr) - addr;
+	char hex[2 * ROW_SIZE], ascii[ROW_SIZE];
+	uint8_t bytes[ROW_SIZE];
+	if (from < to)
+		app_format_hex (bytes, app_edit_read (addr + from - g.data_offset,
+			bytes, to - from), hex + 2 * from, ascii + from);
+
+	app_row_section (row, ROW_HEX);
+	for (int x = 0; x < ROW_SIZE; x++)
+	{
+		if (x % 8 == 0) app_row_append (row, attrs, " ", 1);
+		if (x % 2 == 0) app_row_append (row, attrs, " ", 1);
+
+		int64_t cell_addr = addr + x;
+		if (cell_addr < g.data_offset
+		 || cell_addr >= end_addr)
+			app_row_append (row, attrs, "  ", 2);
+		else
+			app_layout_hex_cell (row, attrs, cell_addr, hex + 2 * x);
+	}
+
+	app_row_section (row, ROW_ASCII);
+	app_row_append (row, attrs, "  ", 2);
+	for (int x = 0; x < ROW_SIZE; x++)
+	{
+		int64_t cell_addr = addr + x;
+		if (cell_addr < g.data_offset
+		 || cell_addr >= end_addr)
+			app_row_append (row, attrs, " ", 1);
+		else
+			app_layout_ascii_cell (row, attrs, cell_addr, ascii[x]);
+	}
+	app_row_section (row, ROW_SECTIONS);
+}
+
+/// Retrieve a laid out row from the cache, laying it out again as needed
+static struct app_row *
+app_row_get (int64_t addr, int attrs)
+{
+	// Visible rows have consecutive addresses, so they never collide
+	size_t rows_len = app_visible_rows () + 1;
+	if (g.rows_len != rows_len)
+	{
+		for (size_t i = 0; i < g.rows_len; i++)
+			app_row_free (&g.rows[i]);
+		free (g.rows);
+
+		g.rows = xcalloc (rows_len, sizeof *g.rows);
+		for (size_t i = 0; i < rows_len; i++)
+			app_row_init (&g.rows[i]);
+		g.rows_len = rows_len;
+	}
+
+	// The cursor underlines eight bytes, possibly reaching into the next row
+	int64_t cursor = -1;
+	if (g.view_cursor + 8 > addr && g.view_cursor < addr + ROW_SIZE)
+		cursor = g.view_cursor;
+	bool skip_nibble = cursor >= addr && g.view_skip_nibble;
+
+	int64_t selection_start = 0, selection_end = 0;
+	if (app_selection (&selection_start, &selection_end))
+	{
+		selection_start = MAX (selection_start, addr);
+		selection_end = MIN (selection_end, addr + ROW_SIZE);
+		if (selection_start >= selection_end)
+			selection_start = selection_end = 0;
+	}
+
+	struct app_row *row = &g.rows[(uint64_t) addr / ROW_SIZE % rows_len];
+	if (row->addr == addr && row->cursor == cursor
+	 && row->skip_nibble == skip_nibble && row->attrs == attrs
+	 && row->selection_start == selection_start
+	 && row->selection_end == selection_end
+	 && row->generation == g.generation)
+		return row;
+
+	row->selection_start = selection_start;
+	row->selection_end = selection_end;
+	app_layout_row_runs (row, addr, attrs);
+	row->addr = addr;
+	row->cursor = cursor;
+	row->skip_nibble = skip_nibble;
+	row->attrs = attrs;
+	row->generation = g.generation;
+	return row;
+}
+
+static struct widget *
+app_layout_row (int64_t addr, int y, int attrs)
+{
+	struct app_row *row = app_row_get (addr, attrs);
+
+	struct layout l = {}, hexl = {}, asciil = {};
+	app_row_push (row, ROW_ADDRESS, &l);
+	app_row_push (row, ROW_HEX, &hexl);
+	app_row_push (row, ROW_ASCII, &asciil);
+
+	struct widget *w = NULL;
+	app_push (&l, (w = xui_hbox (hexl.head)))->widget_id = WIDGET_HEX;
+	w->userdata = y;
+	app_push (&l, (w = xui_hbox (asciil.head)))->widget_id = WIDGET_ASCII;
+	w->userdata = y;
+	return xui_hbox (l.head);
+}
+
+static struct widget *
+app_layout_view (void)
+{
+	struct layout l = {};
+	int64_t end_addr = g.data_offset + g.data_len;
+	for (int y = 0; y <= app_visible_rows (); y++)
+	{
+		int64_t addr = g.view_top + y * ROW_SIZE;
+		if (addr >= end_addr)
+			break;
+
+		int attrs = (addr / ROW_SIZE & 1) ? APP_ATTR (ODD) : APP_ATTR (EVEN);
+		app_push (&l, app_layout_row (addr, y, attrs));
+	}
+	return xui_vbox (l.head);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// Lay out a row of the other input, without marks or a cursor
+static struct widget *
+app_layout_diff_row (struct app_diff *self, int64_t b, chtype attrs)
+{
+	struct app_row *row = &self->row;
+	str_reset (&row->texts);
+	row->runs_len = 0;
+	row->open = false;
+
+	app_row_section (row, ROW_ADDRESS);
+	char *row_addr_str = xstrdup_printf ("%08" PRIx64, g.data_offset + b);
+	app_row_append (row, attrs, row_addr_str, strlen (row_addr_str));
+	free (row_addr_str);
+
+	int len = MIN (ROW_SIZE, self->inputs_len[1] - b);
+	char hex[2 * ROW_SIZE], ascii[ROW_SIZE];
+	app_format_hex (self->inputs[1] + b, len, hex, ascii);
+
+	app_row_section (row, ROW_HEX);
+	for (int x = 0; x < ROW_SIZE; x++)
+	{
+		if (x % 8 == 0) app_row_append (row, attrs, " ", 1);
+		if (x % 2 == 0) app_row_append (row, attrs, " ", 1);
+
+		if (x >= len)
+			app_row_append (row, attrs, "  ", 2);
+		else
+			app_row_append (row, app_diff_differs (1, b + x)
+				? APP_ATTR (DIFF) : attrs, hex + 2 * x, 2);
+	}
+
+	app_row_section (row, ROW_ASCII);
+	app_row_append (row, attrs, "  ", 2);
+	for (int x = 0; x < ROW_SIZE; x++)
+	{
+		if (x >= len)
+			app_row_append (row, attrs, " ", 1);
+		else
+			app_row_append (row, app_diff_differs (1, b + x)
+				? APP_ATTR (DIFF) : attrs, ascii + x, 1);
+	}
+	app_row_section (row, ROW_SECTIONS);
+
+	struct layout l = {};
+	app_row_push (row, ROW_ADDRESS, &l);
+	app_row_push (row, ROW_HEX, &l);
+	app_row_push (row, ROW_ASCII, &l);
+	return xui_hbox (l.head);
+}
+
+/// The other input scrolls along, starting at whatever corresponds
+/// to the top of our view
+static struct widget *
+app_layout_diff_view (void)
+{
+	struct layout l = {};
+	struct app_diff *self = g.diff;
+	int64_t a = MAX (g.view_top, g.data_offset) - g.data_offset;
+	int64_t top = self->aligned ? app_diff_map (self, a) : a;
+	for (int y = 0; y <= app_visible_rows (); y++)
+	{
+		int64_t b = top + y * ROW_SIZE;
+		if (b >= self->inputs_len[1])
+			break;
+
+		chtype attrs = (y & 1) ? APP_ATTR (ODD) : APP_ATTR (EVEN);
+		app_push (&l, app_layout_diff_row (self, b, attrs));
+	}
+	return xui_vbox (l.head);
+}
+
+static struct widget *
+app_layout_field_results (void)
+{
+	struct layout l = {};
+	for (size_t i = 0; i < g.field_results_len; i++)
+	{
+		const struct mark *mark = &g.marks[g.field_results[i]];
+		char *item = xstrdup_printf ("%08" PRIx64 " %s",
+			mark->offset, g.mark_strings.str + mark->description);
+		app_push (&l, app_label (i == g.field_selected
+			? APP_ATTR (SELECTION) : 0, item));
+		free (item);
+	}
+	if (g.field_results_more)
+		app_push (&l, app_label (0, "..."));
+	return xui_vbox (l.head);
+}
+
+static struct widget *
+app_layout_info (void)
+{
+	if (g.prompt == 'f')
+		return app_layout_field_results ();
+
+	const struct marks_by_offset *marks;
+	struct layout l = {};
+	if (!(marks = app_marks_at_offset (g.view_cursor)))
+		goto out;
+
+	struct mark *mark, **iter = g.offset_entries + marks->marks;
+	for (int y = 0; y <= app_visible_rows (); y++)
+	{
+		// TODO: we can use the field background
+		// TODO: we can keep going through subsequent fields to fill the column
+		if (!(mark = *iter++))
+			break;
+
+		const char *description = g.mark_strings.str + mark->description;
+		app_push (&l, app_label (0, description));
+	}
+out:
+	return xui_vbox (l.head);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static uint64_t
+app_decode (const uint8_t *p, size_t len, enum endianity endianity)
+{
+	uint64_t val = 0;
+	if (endianity == ENDIANITY_BE)
+		for (size_t i = 0; i < len; i++)
+			val = val << 8 | (uint64_t) p[i];
+	else
+		while (len--)
+			val = val << 8 | (uint64_t) p[len];
+	return val;
+}
+
+static struct widget *
+app_footer_field (char id, int size, const char *fmt, ...)
+	ATTRIBUTE_PRINTF (3, 4);
+
+static struct widget *
+app_footer_field (char id, int size, const char *fmt, ...)
+{
+	const char *coding = "";
+	if (size <= 1)
+		;
+	else if (g.endianity == ENDIANITY_LE)
+		coding = "le";
+	else if (g.endianity == ENDIANITY_BE)
+		coding = "be";
+
+	struct layout l = {};
+	char *key = xstrdup_printf ("%c%d%s", id, size * 8, coding);
+	app_push (&l, app_mono_label (APP_ATTR (FOOTER_HL), key));
+	free (key);
+
+	app_push (&l, app_mono_padding (0, 1, 1));
+
+	va_list ap;
+	va_start (ap, fmt);
+	struct str value = str_make ();
+	str_append_vprintf (&value, fmt, ap);
+	va_end (ap);
+
+	// Right-aligned
+	app_push_hfill (&l, g_xui.ui->padding (0, 1, 1));
+	app_push (&l, app_mono_label (APP_ATTR (FOOTER), value.str));
+	str_free (&value);
+	return xui_hbox (l.head);
+}
+
+static void
+app_footer_group (struct layout *out, int size, int64_t u, int64_t s, int align)
+{
+	struct layout l = {};
+	app_push (&l, app_footer_field ('x', size, "%0*" PRIx64, size * 2, u));
+	app_push (&l, app_footer_field ('u', size, "%" PRIu64, u));
+	app_push (&l, app_footer_field ('s', size, "%" PRId64, s));
+	l.head->width = MAX (l.head->width,
+		g.digitw * align /* sign + ceil(log10(U/INT*_MAX)) */);
+	if (out->head)
+		app_push (out, app_mono_padding (APP_ATTR (FOOTER), 2, 1));
+	app_push (out, xui_vbox (l.head));
+}
+
+static struct widget *
+app_layout_footer (void)
+{
+	struct layout statusl = {};
+	app_push (&statusl, app_label (APP_ATTR (BAR), APP_TITLE));
+	app_push (&statusl, g_xui.ui->padding (APP_ATTR (BAR), 1, 1));
+
+	if (g.prompt)
+	{
+		const char *prefix = "";
+		if (g.prompt == 'f')
+			prefix = "field";
+		else if (g.prompt == 'e')
+			prefix = "extract to";
+		else if (g.prompt_hex && g.prompt != '=')
+			prefix = "hex ";
+
+		bool named = g.prompt == 'f' || g.prompt == 'e';
+		char *prompt = xstrdup_printf ("%s%c%s",
+			prefix, named ? ':' : g.prompt, g.prompt_text.str);
+		app_push (&statusl, app_label (APP_ATTR (BAR_HL), prompt));
+		free (prompt);
+	}
+	else if (g.message)
+		app_push (&statusl, app_label (APP_ATTR (BAR_HL), g.message));
+	else if (g.filename)
+	{
+		char *filename = (char *) u8_strconv_from_locale (g.filename);
+		app_push (&statusl, app_label (APP_ATTR (BAR_HL), filename));
+		free (filename);
+		app_push (&statusl, g_xui.ui->padding (APP_ATTR (BAR), 1, 1));
+	}
+	if (g.edit_mode || app_edit_modified ())
+	{
+		const char *mode = "";
+		if (g.edit_mode == EDIT_REPLACE)
+			mode = "REPLACE";
+		else if (g.edit_mode == EDIT_INSERT)
+			mode = "INSERT";
+
+		char *state = xstrdup_printf ("%s%s%s", app_edit_modified ()
+			? "[+]" : "", app_edit_modified () && *mode ? " " : "", mode);
+		app_push (&statusl, app_label (APP_ATTR (BAR_HL), state));
+		free (state);
+		app_push (&statusl, g_xui.ui->padding (APP_ATTR (BAR), 1, 1));
+	}
+	if (g_debug_mode)
+	{
+		char *timing = xstrdup_printf ("%.2f + %.2f ms, %zu widgets",
+			g.last_frame.layout_usec / 1000., g.last_frame.render_usec / 1000.,
+			g.last_frame.widgets);
+		app_push (&statusl, app_mono_label (APP_ATTR (BAR), timing));
+		free (timing);
+	}
+
+	app_push_hfill (&statusl, g_xui.ui->padding (APP_ATTR (BAR), 1, 1));
+
+	if (g.diff)
+	{
+		char *differences = g.diff->aligned
+			? xstrdup_printf ("%zu differences", g.diff->ranges_len)
+			: xstrdup ("Comparing...");
+		app_push (&statusl, app_mono_label (APP_ATTR (BAR), differences));
+		free (differences);
+		app_push (&statusl, g_xui.ui->padding (APP_ATTR (BAR), 1, 1));
+	}
+	if (g.search)
+	{
+		char *matches = xstrdup_printf ("%zu matches%s",
+			g.search->matches_len, g.search->running ? "..." : "");
+		app_push (&statusl, app_mono_label (APP_ATTR (BAR), matches));
+		free (matches);
+		app_push (&statusl, g_xui.ui->padding (APP_ATTR (BAR), 1, 1));
+	}
+
+	char *address = xstrdup_printf ("%08" PRIx64, g.view_cursor);
+	app_push (&statusl, app_mono_label (APP_ATTR (BAR), address));
+	free (address);
+	app_push (&statusl, g_xui.ui->padding (APP_ATTR (BAR), 1, 1));
+
+	app_push (&statusl, app_mono_label (APP_ATTR (BAR),
+		g.endianity == ENDIANITY_LE ? "LE" : "BE"))
+		->widget_id = WIDGET_ENDIANITY;
+	app_push (&statusl, g_xui.ui->padding (APP_ATTR (BAR), 1, 1));
+
+	int64_t top = g.view_top;
+	int64_t bot = g.view_top + app_visible_rows () * ROW_SIZE;
+	struct str where = str_make ();
+	if (top <= g.data_offset
+	 && bot >= g.data_offset + g.data_len)
+		str_append (&where, "All");
+	else if (top <= g.data_offset)
+		str_append (&where, "Top");
+	else if (bot >= g.data_offset + g.data_len)
+		str_append (&where, "Bot");
+	else
+	{
+		int64_t end_addr = g.data_offset + g.data_len;
+		int64_t cur = g.view_top / ROW_SIZE;
+		int64_t max = (end_addr - 1) / ROW_SIZE - app_visible_rows () + 1;
+
+		cur -= g.data_offset / ROW_SIZE;
+		max -= g.data_offset / ROW_SIZE;
+		str_append_printf (&where, "%2d%%", (int) (100 * cur / max));
+	}
+
+	app_push (&statusl, app_mono_label (APP_ATTR (BAR), where.str));
+	str_free (&where);
+
+	int64_t end_addr = g.data_offset + g.data_len;
+	if (g.view_cursor < g.data_offset
+	 || g.view_cursor >= end_addr)
+		return xui_hbox (statusl.head);
+
+	uint8_t p[8] = {};
+	int64_t len = app_edit_read (g.view_cursor - g.data_offset, p, sizeof p);
+
+	// TODO: The entire bottom part perhaps should be pre-painted
+	//   with APP_ATTR (FOOTER).
+	struct layout groupl = {};
+	if (len >= 1)
+		app_footer_group (&groupl, 1, p[0], (int8_t) p[0], 3 + 4);
+	if (len >= 2)
+	{
+		uint16_t value = app_decode (p, 2, g.endianity);
+		app_footer_group (&groupl, 2, value, (int16_t) value, 6 + 6);
+	}
+	if (len >= 4)
+	{
+		uint32_t value = app_decode (p, 4, g.endianity);
+		app_footer_group (&groupl, 4, value, (int32_t) value, 6 + 11);
+	}
+	if (len >= 8)
+	{
+		uint64_t value = app_decode (p, 8, g.endianity);
+		app_footer_group (&groupl, 8, value, (int64_t) value, 6 + 20);
+	}
+
+	struct layout lll = {};
+	app_push (&lll, xui_hbox (statusl.head));
+	app_push (&lll, xui_hbox (groupl.head));
+	return xui_vbox (lll.head);
+}
+
+/// Each row summarizes a part of the whole data: how much entropy it has,
+/// and whether it is mostly zeros, text, or bytes with the high bit set
+static char *
+app_overview_describe (const struct app_overview_block *blocks, size_t len)
+{
+	unsigned entropy = 0, zero = 0, text = 0, high = 0, ready = 0;
+	for (size_t i = 0; i < len; i++)
+		if (blocks[i].ready)
+		{
+			entropy += blocks[i].entropy;
+			zero += blocks[i].zero;
+			text += blocks[i].text;
+			high += blocks[i].high;
+			ready++;
+		}
+	if (!ready)
+		return xstrdup ("  ");
+
+	const char *levels = " .:-=+*#%@";
+	char class = '.';
+	if      (zero > 128 * ready) class = 'z';
+	else if (text > 192 * ready) class = 't';
+	else if (high > 128 * ready) class = 'h';
+	return xstrdup_printf ("%c%c",
+		levels[entropy / ready * strlen (levels) / 256], class);
+}
+
+static struct widget *
+app_layout_overview (void)
+{
+	struct layout l = {};
+	struct app_overview *self = g.overview;
+	int rows = app_visible_rows ();
+	if (!self || !self->blocks_len || !rows)
+		return xui_vbox (l.head);
+
+	if (self->running)
+		pthread_mutex_lock (&self->task.lock);
+
+	int64_t view_end = g.view_top + rows * ROW_SIZE;
+	for (int y = 0; y < rows; y++)
+	{
+		size_t from = 0, to = 0;
+		app_overview_segment (y, rows, &from, &to);
+		if (from >= self->blocks_len)
+			break;
+
+		to = MIN (to, self->blocks_len);
+		int64_t start = g.data_offset + from * self->block_size;
+		int64_t end = g.data_offset + MIN ((int64_t) to * self->block_size,
+			self->data_len);
+
+		chtype attrs = APP_ATTR (EVEN);
+		if (start < view_end && end > g.view_top)
+			attrs = APP_ATTR (SELECTION);
+
+		char *s = app_overview_describe (self->blocks + from, to - from);
+		struct widget *w = app_push (&l, app_mono_label (attrs, s));
+		w->widget_id = WIDGET_OVERVIEW;
+		w->userdata = y;
+		free (s);
+	}
+
+	if (self->running)
+		pthread_mutex_unlock (&self->task.lock);
+	return xui_vbox (l.head);
+}
+
+static int64_t
+app_clock_usec (void)
+{
+	struct timespec ts;
+	if (clock_gettime (CLOCK_MONOTONIC, &ts))
+		return 0;
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/// Show memory use of all subsystems, as of the last frame
+static struct widget *
+app_layout_memory (void)
+{
+	struct layout l = {};
+	struct strv lines = app_memory_report ();
+	for (size_t i = 0; i < lines.len; i++)
+		app_push (&l, app_mono_label (APP_ATTR (FOOTER), lines.vector[i]));
+	strv_free (&lines);
+	return xui_vbox (l.head);
+}
+
+static size_t
+app_count_widgets (struct widget *list, size_t *bytes)
+{
+	size_t count = 0;
+	LIST_FOR_EACH (struct widget, w, list)
+	{
+		*bytes += sizeof *w + strlen (w->text) + 1;
+		count += 1 + app_count_widgets (w->children, bytes);
+	}
+	return count;
+}
+
+static void
+app_layout (void)
+{
+	int64_t start = app_clock_usec ();
+	app_flush_movement ();
+	g.input_deadline = 0;
+	if (!g.startup[STARTUP_UI].end)
+		g.startup[STARTUP_UI].end = start;
+
+#ifdef WITH_LUA
+	// Decodes deferred until viewed are picked up by app_on_redecode()
+	int64_t view_end = g.view_top + app_visible_rows () * ROW_SIZE;
+	if (g.deferred_view_top != g.view_top || g.deferred_view_end != view_end)
+	{
+		g.deferred_view_top = g.view_top;
+		g.deferred_view_end = view_end;
+		poller_idle_set (&g.redecode_event);
+	}
+#endif // WITH_LUA
+	app_readahead_update ();
+
+	struct layout topl = {};
+	app_push (&topl, app_layout_view ());
+	app_push (&topl, g_xui.ui->padding (0, 1, 1));
+	if (g.diff)
+	{
+		app_push (&topl, app_layout_diff_view ());
+		app_push (&topl, g_xui.ui->padding (0, 1, 1));
+	}
+	app_push (&topl, app_layout_overview ());
+	app_push (&topl, g_xui.ui->padding (0, 1, 1));
+	app_push_hfill (&topl, app_layout_info ());
+
+	struct layout l = {};
+	app_push_vfill (&l, xui_hbox (topl.head));
+	if (g.memory_overlay)
+		app_push (&l, app_layout_memory ());
+	app_push (&l, app_layout_footer ());
+
+	struct widget *root = g_xui.widgets = xui_vbox (l.head);
+	root->width = g_xui.width;
+	root->height = g_xui.height;
+
+	g.frame.layout_usec = app_clock_usec () - start;
+
+	// Walking the whole tree isn't free, only do it when someone's looking
+	if (g_debug_mode || g.replay || g.memory_overlay || g.memory_stats)
+	{
+		size_t bytes = 0;
+		g.frame.widgets = app_count_widgets (root, &bytes);
+		app_memory_set (MEMORY_WIDGETS, bytes, g.frame.widgets);
+	}
+}
+
+// --- Lua ---------------------------------------------------------------------
+
+#ifdef WITH_LUA
+
+/// A single chunk:decode() call, all of which form a tree
+struct app_lua_decode
+{
+	int64_t offset;                     ///< Offset of the decoded chunk
+	int64_t len;                        ///< Length of the decoded chunk
+	char *type;                         ///< The type it was decoded as
+	uint32_t parent;                    ///< Enclosing decode, or UINT32_MAX
+	int ref_args;                       ///< Further arguments, or LUA_NOREF
+	bool deferred;                      ///< Not to be run until viewed
+	bool failed;                        ///< Failed, until its data changes
+	bool dead;                          ///< Superseded by a re-decode
+};
+
+/// Edited data that has had to be pieced together for a decoder
+struct app_lua_spill
+{
+	int64_t offset;                     ///< Offset within the data
+	int64_t len;                        ///< Length of the copy
+	uint8_t *data;                      ///< The copy
+};
+
+/// A Lua state with all plugins loaded, along with the data it decodes.
+/// Batch mode runs one of these in each worker thread.
+struct app_lua
+{
+	lua_State *L;                       ///< Lua state
+	int ref_format;                     ///< Reference to "string.format"
+	struct str_map coders;              ///< Map of coders by name
+
+	const uint8_t *data;                ///< Data to be decoded
+	int64_t data_len;                   ///< Length of the data
+	int64_t data_offset;                ///< Offset of the data within the file
+	const struct app_edited *edited;    ///< Edited data, instead of "data"
+
+	/// Copies of edited data that spans pieces, until the decode ends
+	ARRAY (struct app_lua_spill, spills)
+
+	/// Receives marks as they are produced
+	void (*on_mark) (void *user_data,
+		int64_t offset, int64_t len, uint32_t decode, const char *desc);
+	void *user_data;                    ///< User data for "on_mark"
+	int64_t mark_end;                   ///< End of the furthest mark so far
+
+	/// All decodes made, enclosing ones always preceding those nested
+	ARRAY (struct app_lua_decode, decodes)
+	uint32_t decode;                    ///< Innermost running decode
+};
+
+static struct app_lua *
+app_lua_self (lua_State *L)
+{
+	return *(struct app_lua **) lua_getextraspace (L);
+}
+
+static void *
+app_lua_alloc (void *ud, void *ptr, size_t o_size, size_t n_size)
+{
+	(void) ud;
+
+	// Without a block, the old size rather encodes the type of the object
+	if (!ptr)
+		o_size = 0;
+	if (!n_size)
+	{
+		free (ptr);
+		app_memory_add (MEMORY_LUA, -(ssize_t) o_size, 0);
+		return NULL;
+	}
+
+	void *result = realloc (ptr, n_size);
+	if (result)
+		app_memory_add (MEMORY_LUA,
+			(ssize_t) n_size - (ssize_t) o_size, n_size > o_size);
+	return result;
+}
+
+static int
+app_lua_panic (lua_State *L)
+{
+	// XXX: we might be able to do something better
+	print_fatal ("Lua panicked: %s", lua_tostring (L, -1));
+	lua_close (L);
+	exit (EXIT_FAILURE);
+	return 0;
+}
+
+static bool
+app_lua_getfield (lua_State *L, int idx, const char *name,
+	int expected, bool optional)
+{
+	int found = lua_getfield (L, idx, name);
+	if (found == expected)
+		return true;
+	if (optional && found == LUA_TNIL)
+		return false;
+
+	const char *message = optional
+		? "invalid field \"%s\" (found: %s, expected: %s or nil)"
+		: "invalid or missing field \"%s\" (found: %s, expected: %s)";
+	return luaL_error (L, message, name,
+		lua_typename (L, found), lua_typename (L, expected));
+}
+
+static int
+app_lua_error_handler (lua_State *L)
+{
+	luaL_traceback (L, L, luaL_checkstring (L, 1), 1);
+	return 1;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+struct app_lua_coder
+{
+	lua_State *L;                       ///< Lua state holding the references
+	int ref_detect;                     ///< Reference to the "detect" method
+	int ref_decode;                     ///< Reference to the "decode" method
+
+	/// Signatures that objects of this type start with, used for carving
+	ARRAY (struct str, magic)
+};
+
+static void
+app_lua_coder_free (void *coder)
+{
+	struct app_lua_coder *self = coder;
+	luaL_unref (self->L, LUA_REGISTRYINDEX, self->ref_decode);
+	luaL_unref (self->L, LUA_REGISTRYINDEX, self->ref_detect);
+	for (size_t i = 0; i < self->magic_len; i++)
+		str_free (&self->magic[i]);
+	free (self->magic);
+	free (self);
+}
+
+static void
+app_lua_coder_add_magic (struct app_lua_coder *self, lua_State *L, int idx)
+{
+	size_t len = 0;
+	const char *magic = lua_tolstring (L, idx, &len);
+	if (!len)
+		return;
+
+	struct str s = str_make ();
+	str_append_data (&s, magic, len);
+	ARRAY_RESERVE (self->magic, 1);
+	self->magic[self->magic_len++] = s;
+}
+
+static int
+app_lua_register (lua_State *L)
+{
+	struct app_lua *lua = app_lua_self (L);
+	luaL_checktype (L, 1, LUA_TTABLE);
+
+	(void) app_lua_getfield (L, 1, "type",   LUA_TSTRING,   false);
+	const char *type = lua_tostring (L, -1);
+	if (str_map_find (&lua->coders, type))
+		luaL_error (L, "a coder has already been registered for `%s'", type);
+
+	// This may either be a single string, or a sequence of them
+	int magic_type = lua_getfield (L, 1, "magic");
+	if (magic_type == LUA_TTABLE)
+		for (lua_Integer i = 1; lua_rawgeti (L, -1, i) != LUA_TNIL; i++)
+		{
+			if (lua_type (L, -1) != LUA_TSTRING)
+				luaL_error (L, "invalid field \"%s\" (%s)", "magic",
+					"all signatures must be strings");
+			lua_pop (L, 1);
+		}
+	else if (magic_type != LUA_TSTRING && magic_type != LUA_TNIL)
+		luaL_error (L, "invalid field \"%s\" (found: %s, expected: %s)",
+			"magic", lua_typename (L, magic_type), "string or table");
+	lua_settop (L, 2);
+
+	(void) app_lua_getfield (L, 1, "detect", LUA_TFUNCTION, true);
+	(void) app_lua_getfield (L, 1, "decode", LUA_TFUNCTION, false);
+
+	struct app_lua_coder *coder = xcalloc (1, sizeof *coder);
+	coder->L = L;
+	coder->ref_decode = luaL_ref (L, LUA_REGISTRYINDEX);
+	coder->ref_detect = luaL_ref (L, LUA_REGISTRYINDEX);
+	str_map_set (&lua->coders, type, coder);
+
+	ARRAY_INIT (coder->magic);
+	if ((magic_type = lua_getfield (L, 1, "magic")) == LUA_TSTRING)
+		app_lua_coder_add_magic (coder, L, -1);
+	else if (magic_type == LUA_TTABLE)
+		for (lua_Integer i = 1; lua_rawgeti (L, -1, i) != LUA_TNIL; i++)
+		{
+			app_lua_coder_add_magic (coder, L, -1);
+			lua_pop (L, 1);
+		}
+	return 0;
+}
+
+static luaL_Reg app_lua_library[] =
+{
+	{ "register", app_lua_register },
+	{ NULL,       NULL             }
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+#define XLUA_CHUNK_METATABLE "chunk"
+
+struct app_lua_chunk
+{
+	int64_t offset;                     ///< Offset from start of file
+	int64_t len;                        ///< Length of the sequence
+
+	int64_t position;                   ///< Read position in the sequence
+	enum endianity endianity;           ///< Read endianity
+};
+
+static struct app_lua_chunk *
+app_lua_chunk_new (lua_State *L)
+{
+	struct app_lua_chunk *chunk = lua_newuserdata (L, sizeof *chunk);
+	luaL_setmetatable (L, XLUA_CHUNK_METATABLE);
+	memset (chunk, 0, sizeof *chunk);
+	return chunk;
+}
+
+static int
+app_lua_chunk_len (lua_State *L)
+{
+	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
+	lua_pushinteger (L, self->len);
+	return 1;
+}
+
+/// Create a new subchunk following Lua's string.sub() semantics.
+/// An implication is that it is not possible to go extend a chunk's bounds.
+static int
+app_lua_chunk_call (lua_State *L)
+{
+	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
+	lua_Integer start = luaL_optinteger (L, 2,  1);
+	lua_Integer end   = luaL_optinteger (L, 3, -1);
+
+	if (start < 0) start += self->len + 1;
+	if (end   < 0) end   += self->len + 1;
+
+	start = MAX (start, 1);
+	end = MIN (end, self->len);
+
+	struct app_lua_chunk *clone = app_lua_chunk_new (L);
+	clone->position = 0;
+	clone->endianity = self->endianity;
+	if (start > end)
+	{
+		// "start" can be too high and "end" can be too low;
+		// the length is zero, so the offset doesn't matter much anyway
+		clone->offset = self->offset;
+		clone->len = 0;
+	}
+	else
+	{
+		clone->offset = self->offset + start - 1;
+		clone->len = end - start + 1;
+	}
+	return 1;
+}
+
+static int
+app_lua_chunk_index (lua_State *L)
+{
+	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
+	const char *key = luaL_checkstring (L, 2);
+	if (luaL_getmetafield (L, 1, key))
+		return 1;
+
+	if (!strcmp (key, "offset"))
+		lua_pushinteger (L, self->offset);
+	else if (!strcmp (key, "endianity"))
+		lua_pushstring (L, self->endianity == ENDIANITY_LE ? "le" : "be");
+	else if (!strcmp (key, "position"))
+		lua_pushinteger (L, self->position + 1);
+	else if (!strcmp (key, "eof"))
+		lua_pushboolean (L, self->position >= self->len);
+	else
+		return luaL_argerror (L, 2, "not a readable property");
+	return 1;
+}
+
+static int
+app_lua_chunk_newindex (lua_State *L)
+{
+	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
+	const char *key = luaL_checkstring (L, 2);
+	if (!strcmp (key, "endianity"))
+	{
+		// Needs to be in the enum order
+		const char *options[] = { "le", "be" };
+		self->endianity = luaL_checkoption (L, 3, options[0], options);
+	}
+	else if (!strcmp (key, "position"))
+	{
+		lua_Integer position = luaL_checkinteger (L, 3);
+		if (position < 1 || position > self->len + 1)
+			return luaL_error (L, "position out of range: %I", position);
+		self->position = position - 1;
+	}
+	else
+		return luaL_argerror (L, 2, "not a writable property");
+	return 0;
+}
+
+static void
+app_lua_mark (lua_State *L, int64_t offset, int64_t len, const char *desc)
+{
+	// That would cause stupid entries, making trouble in marks_by_offset
+	if (len <= 0)
+		return;
+
+	struct app_lua *lua = app_lua_self (L);
+	lua->on_mark (lua->user_data, offset, len, lua->decode, desc);
+	lua->mark_end = MAX (lua->mark_end, offset + len);
+}
+
+static int
+app_lua_chunk_mark (lua_State *L)
+{
+	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
+	int n_args = lua_gettop (L);
+	lua_rawgeti (L, LUA_REGISTRYINDEX, app_lua_self (L)->ref_format);
+	lua_insert (L, 2);
+	lua_call (L, n_args - 1, 1);
+	app_lua_mark (L, self->offset, self->len, luaL_checkstring (L, -1));
+	return 0;
+}
+
+/// Try to detect any registered type in the data and return its name
+static int
+app_lua_chunk_identify (lua_State *L)
+{
+	(void) luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
+
+	struct str_map_iter iter = str_map_iter_make (&app_lua_self (L)->coders);
+	struct app_lua_coder *coder;
+	while ((coder = str_map_iter_next (&iter)))
+	{
+		if (coder->ref_detect == LUA_REFNIL)
+			continue;
+
+		lua_rawgeti (L, LUA_REGISTRYINDEX, coder->ref_detect);
+
+		// Clone the chunk first to reset its read position
+		lua_pushcfunction (L, app_lua_chunk_call);
+		lua_pushvalue (L, 1);
+		lua_call (L, 1, 1);
+
+		lua_call (L, 1, 1);
+		if (lua_toboolean (L, -1))
+		{
+			lua_pushstring (L, iter.link->key);
+			return 1;
+		}
+		lua_pop (L, 1);
+	}
+	return 0;
+}
+
+/// Remember a decode, so that it can be repeated, or run later if deferred,
+/// along with "n_args" further arguments for the decoding function at "idx".
+/// Decodes only get moved around by edits as a whole, so their arguments
+/// may be neither chunks, nor functions, which could hold on to chunks.
+static void
+app_lua_add_decode (lua_State *L, const struct app_lua_chunk *chunk,
+	const char *type, int idx, int n_args, bool deferred)
+{
+	for (int i = 0; i < n_args; i++)
+		if (lua_type (L, idx + i) == LUA_TFUNCTION
+		 || lua_type (L, idx + i) == LUA_TUSERDATA)
+			luaL_argerror (L, idx + i, "it would not follow edits");
+
+	int ref_args = LUA_NOREF;
+	if (n_args > 0)
+	{
+		lua_createtable (L, n_args, 1);
+		for (int i = 0; i < n_args; i++)
+		{
+			lua_pushvalue (L, idx + i);
+			lua_rawseti (L, -2, i + 1);
+		}
+		lua_pushinteger (L, n_args);
+		lua_setfield (L, -2, "n");
+		ref_args = luaL_ref (L, LUA_REGISTRYINDEX);
+	}
+
+	struct app_lua *lua = app_lua_self (L);
+	ARRAY_RESERVE (lua->decodes, 1);
+	lua->decodes[lua->decodes_len++] = (struct app_lua_decode)
+	{
+		.offset = chunk->offset,
+		.len = chunk->len,
+		.type = xstrdup (type),
+		.parent = lua->decode,
+		.ref_args = ref_args,
+		.deferred = deferred,
+	};
+}
+
+/// Push further arguments remembered with a decode, returning their count
+static int
+app_lua_push_decode_args (lua_State *L, int ref_args)
+{
+	if (ref_args == LUA_NOREF)
+		return 0;
+
+	lua_rawgeti (L, LUA_REGISTRYINDEX, ref_args);
+	lua_getfield (L, -1, "n");
+	int n_args = lua_tointeger (L, -1);
+	lua_pop (L, 1);
+
+	luaL_checkstack (L, n_args, "too many arguments");
+	for (int i = 1; i <= n_args; i++)
+		lua_rawgeti (L, -i, i);
+	lua_remove (L, -n_args - 1);
+	return n_args;
+}
+
+static int
+app_lua_chunk_decode (lua_State *L)
+{
+	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
+	const char *type = luaL_optstring (L, 2, NULL);
+	int n_args = lua_gettop (L);
+
+	if (!type)
+	{
+		lua_pushcfunction (L, app_lua_chunk_identify);
+		lua_pushvalue (L, 1);
+		lua_call (L, 1, 1);
+		type = lua_tostring (L, -1);
+	}
+	// Can't identify -> can't decode, nothing to do here
+	if (!type)
+		return 0;
+
+	// While we could call "detect" here, just to be sure, some kinds may not
+	// even be detectable and it's better to leave it up to the plugin
+
+	struct app_lua *lua = app_lua_self (L);
+	struct app_lua_coder *coder = str_map_find (&lua->coders, type);
+	if (!coder)
+		return luaL_error (L, "unknown type: %s", type);
+
+	// Remember what has been decoded how, so that it can be repeated.
+	// Errors leave "decode" as it is, top-level callers reset it.
+	uint32_t parent = lua->decode;
+	app_lua_add_decode (L, self, type, 3, n_args - 2, false);
+	lua->decode = lua->decodes_len - 1;
+
+	lua_rawgeti (L, LUA_REGISTRYINDEX, coder->ref_decode);
+	for (int i = 1; i <= n_args; i++)
+		if (i != 2)
+			lua_pushvalue (L, i);
+	// TODO: the chunk could remember the name of the coder and prepend it
+	//   to all marks set from the callback; then reset it back to NULL
+	lua_call (L, MAX (n_args - 1, 1), 0);
+	lua->decode = parent;
+	return 0;
+}
+
+/// Remember to decode the chunk as the given type only once it is viewed,
+/// passing any further arguments along to the decoding function
+static int
+app_lua_chunk_defer (lua_State *L)
+{
+	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
+	const char *type = luaL_checkstring (L, 2);
+
+	struct app_lua *lua = app_lua_self (L);
+	if (!str_map_find (&lua->coders, type))
+		return luaL_error (L, "unknown type: %s", type);
+	if (self->len > 0)
+		app_lua_add_decode (L, self, type, 3, lua_gettop (L) - 2, true);
+	return 0;
+}
+
+/// Return a chunk spanning the decode enclosing the one being run,
+/// or the closest of the given type, or all of the data if there is none.
+/// Nested decodes can be passed offsets relative to it, which stay valid
+/// as edits move the enclosing decode around.
+static int
+app_lua_chunk_enclosing (lua_State *L)
+{
+	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
+	const char *type = luaL_optstring (L, 2, NULL);
+
+	struct app_lua *lua = app_lua_self (L);
+	uint32_t i = lua->decode;
+	do
+		i = i == UINT32_MAX ? i : lua->decodes[i].parent;
+	while (i != UINT32_MAX && type && strcmp (lua->decodes[i].type, type));
+	if (i == UINT32_MAX && type)
+		return luaL_error (L, "not within a decode of type %s", type);
+
+	struct app_lua_chunk *chunk = app_lua_chunk_new (L);
+	chunk->endianity = self->endianity;
+	if (i == UINT32_MAX)
+	{
+		chunk->offset = lua->data_offset;
+		chunk->len = lua->data_len;
+	}
+	else
+	{
+		chunk->offset = lua->decodes[i].offset;
+		chunk->len = lua->decodes[i].len;
+	}
+	return 1;
+}
+
+/// Detect and decode an object of the given type at the start of the chunk,
+/// and mark its extent, as far as the decoder has gone.
+static int
+app_lua_chunk_carve (lua_State *L)
+{
+	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
+	const char *type = luaL_checkstring (L, 2);
+
+	struct app_lua *lua = app_lua_self (L);
+	struct app_lua_coder *coder = str_map_find (&lua->coders, type);
+	if (!coder)
+		return luaL_error (L, "unknown type: %s", type);
+
+	if (coder->ref_detect != LUA_REFNIL)
+	{
+		lua_rawgeti (L, LUA_REGISTRYINDEX, coder->ref_detect);
+		lua_pushcfunction (L, app_lua_chunk_call);
+		lua_pushvalue (L, 1);
+		lua_call (L, 1, 1);
+
+		lua_call (L, 1, 1);
+		if (!lua_toboolean (L, -1))
+			return 0;
+		lua_pop (L, 1);
+	}
+
+	lua->mark_end = self->offset;
+	lua_pushcfunction (L, app_lua_chunk_decode);
+	lua_pushvalue (L, 1);
+	lua_pushvalue (L, 2);
+	lua_call (L, 2, 0);
+
+	if (lua->mark_end > self->offset)
+	{
+		char *desc = xstrdup_printf ("embedded %s", type);
+		app_lua_mark (L, self->offset, lua->mark_end - self->offset, desc);
+		free (desc);
+	}
+	lua_pushinteger (L, lua->mark_end - self->offset);
+	return 1;
+}
+
+/// Return a range of the data, or NULL when it lies outside of what is
+/// available, which happens to chunks passed along to a partial re-decode.
+/// Edited data is only pieced together where a range spans several pieces.
+static const uint8_t *
+app_lua_data (lua_State *L, int64_t offset, int64_t len)
+{
+	struct app_lua *lua = app_lua_self (L);
+	int64_t start = offset - lua->data_offset;
+	if (start < 0 || len < 0 || len > lua->data_len - start)
+		return NULL;
+	if (!lua->edited)
+		return lua->data + start;
+
+	static const uint8_t empty;
+	const uint8_t *data = len ? app_edited_view (lua->edited, start, len)
+		: &empty;
+	for (size_t i = 0; !data && i < lua->spills_len; i++)
+	{
+		const struct app_lua_spill *spill = &lua->spills[i];
+		if (spill->offset <= start
+		 && start + len <= spill->offset + spill->len)
+			data = spill->data + (start - spill->offset);
+	}
+	if (data)
+		return data;
+
+	uint8_t *copy = xmalloc (len);
+	(void) app_edited_read (lua->edited, start, copy, len);
+	ARRAY_RESERVE (lua->spills, 1);
+	lua->spills[lua->spills_len++] =
+		(struct app_lua_spill) { start, len, copy };
+	return copy;
+}
+
+static void
+app_lua_forget_spills (struct app_lua *self)
+{
+	while (self->spills_len)
+		free (self->spills[--self->spills_len].data);
+}
+
+static const uint8_t *
+app_lua_chunk_data (lua_State *L, const struct app_lua_chunk *self)
+{
+	return app_lua_data (L, self->offset, self->len);
+}
+
+static int
+app_lua_chunk_read (lua_State *L)
+{
+	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
+	struct app_lua *lua = app_lua_self (L);
+	lua_Integer len = luaL_checkinteger (L, 2);
+	if (len < 0)
+		return luaL_argerror (L, 2, "invalid read length");
+
+	int64_t start = self->offset + self->position;
+	const uint8_t *data = app_lua_data (L, start, len);
+	// XXX: or just return a shorter string in this case?
+	if (!data && start >= lua->data_offset)
+		return luaL_argerror (L, 2, "chunk is too short");
+	if (!data)
+		return luaL_error (L, "chunk is out of reach");
+
+	lua_pushlstring (L, (const char *) data, len);
+	self->position += len;
+	return 1;
+}
+
+/// Mark a field that has just been read from the chunk and advance position:
+///  - the second argument, if present, is a simple format string for marking;
+///  - the third argument, if present, is a filtering function.
+///
+/// I am aware of how ugly the implicit "string.format" is.  Convenience wins.
+static void
+app_lua_chunk_finish_read
+	(lua_State *L, struct app_lua_chunk *self, int64_t len)
+{
+	int n_args = lua_gettop (L) - 1;
+	if (n_args < 2)
+	{
+		self->position += len;
+		return;
+	}
+
+	// Prepare <string.format>, <format>, <value>
+	lua_rawgeti (L, LUA_REGISTRYINDEX, app_lua_self (L)->ref_format);
+	lua_pushvalue (L, 2);
+
+	int pre_filter_top = lua_gettop (L);
+	lua_pushvalue (L, -3);
+
+	// Transform the value if a filtering function is provided
+	if (n_args >= 3)
+	{
+		lua_pushvalue (L, 3);
+		lua_insert (L, -2);
+		lua_call (L, 1, LUA_MULTRET);
+		int n_ret = lua_gettop (L) - pre_filter_top;
+
+		// When no value has been returned, keep the old one
+		if (n_ret < 1)
+			lua_pushvalue (L, pre_filter_top - 2);
+
+		// Forward multiple return values to "string.format"
+		if (n_ret > 1)
+		{
+			lua_pushvalue (L, pre_filter_top - 1);
+			lua_insert (L, -n_ret - 1);
+			lua_call (L, n_ret, 1);
+		}
+	}
+
+	lua_call (L, 2, 1);
+	app_lua_mark (L, self->offset + self->position, len, lua_tostring (L, -1));
+	self->position += len;
+	lua_pop (L, 1);
+}
+
+static int
+app_lua_chunk_cstring (lua_State *L)
+{
+	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
+	const void *s = app_lua_data (L,
+		self->offset + self->position, self->len - self->position);
+	if (!s)
+		return luaL_error (L, "chunk is out of reach");
+
+	const void *nil;
+	if (!(nil = memchr (s, '\0', self->len - self->position)))
+		return luaL_error (L, "unexpected EOF");
+
+	lua_pushlstring (L, s, nil - s);
+	app_lua_chunk_finish_read (L, self, nil - s + 1);
+	return 1;
+}
+
+/// Decode "len" bytes as a number starting at the current position in "self"
+static uint64_t
+app_lua_chunk_decode_int (lua_State *L, struct app_lua_chunk *self, size_t len)
+{
+	if (self->position + (int64_t) len > self->len)
+		return luaL_error (L, "unexpected EOF");
+
+	const uint8_t *data = app_lua_data (L, self->offset + self->position, len);
+	if (!data)
+		return luaL_error (L, "chunk is out of reach");
+	return app_decode (data, len, self->endianity);
+}
+
+#define APP_LUA_CHUNK_INT(name, type)                                          \
+	static int                                                                 \
+	app_lua_chunk_ ## name (lua_State *L)                                      \
+	{                                                                          \
+		struct app_lua_chunk *self =                                           \
+			luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);                      \
+		type v = app_lua_chunk_decode_int (L, self, sizeof v);                 \
+		lua_pushinteger (L, v);                                                \
+		app_lua_chunk_finish_read (L, self, sizeof v);                         \
+		return 1;                                                              \
+	}
+
+APP_LUA_CHUNK_INT (u8,  uint8_t)  APP_LUA_CHUNK_INT (s8,  int8_t)
+APP_LUA_CHUNK_INT (u16, uint16_t) APP_LUA_CHUNK_INT (s16, int16_t)
+APP_LUA_CHUNK_INT (u32, uint32_t) APP_LUA_CHUNK_INT (s32, int32_t)
+APP_LUA_CHUNK_INT (u64, uint64_t) APP_LUA_CHUNK_INT (s64, int64_t)
+
+// Packet captures may hold tens of millions of records, which would take ages
+// to walk through from Lua, so their framing is indexed natively,
+// and plugins only get called back to decode payloads.
+
+/// Mark a range of data with a formatted description
+static void
+app_lua_markf (lua_State *L, int64_t offset, int64_t len, const char *fmt, ...)
+	ATTRIBUTE_PRINTF (4, 5);
+
+static void
+app_lua_markf (lua_State *L, int64_t offset, int64_t len, const char *fmt, ...)
+{
+	char buf[256];
+	va_list ap;
+	va_start (ap, fmt);
+	vsnprintf (buf, sizeof buf, fmt, ap);
+	va_end (ap);
+	app_lua_mark (L, offset, len, buf);
+}
+
+/// Format a capture timestamp, with the given number of fractional digits
+static void
+app_lua_pcap_time (char *buf, size_t size,
+	int64_t sec, uint64_t frac, int digits)
+{
+	struct tm tm = {};
+	time_t t = sec;
+	size_t len = 0;
+	if (gmtime_r (&t, &tm))
+		len = strftime (buf, size, "%F %T", &tm);
+	if (digits)
+		snprintf (buf + len, size - len, ".%0*" PRIu64, digits, frac);
+	else
+		buf[len] = 0;
+}
+
+/// Call the decoder at "idx", if any, with a packet's data
+static void
+app_lua_pcap_payload (lua_State *L, int idx, int64_t offset, int64_t len,
+	uint32_t link_type, int64_t index)
+{
+	if (lua_isnoneornil (L, idx))
+		return;
+
+	lua_pushvalue (L, idx);
+	struct app_lua_chunk *chunk = app_lua_chunk_new (L);
+	chunk->offset = offset;
+	chunk->len = len;
+	lua_pushinteger (L, link_type);
+	lua_pushinteger (L, index);
+	lua_call (L, 3, 0);
+}
+
+/// Walk libpcap records from the current position up to the end:
+///  - the second argument is the time zone correction in seconds;
+///  - the third argument is the link type of all records;
+///  - the fourth argument, if present, is a function to decode packet data,
+///    called with a chunk, the link type, and the record index;
+///  - the fifth argument, if present, is the index of the first record.
+/// Returns the number of records.
+static int
+app_lua_chunk_pcap_records (lua_State *L)
+{
+	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
+	lua_Integer zone = luaL_checkinteger (L, 2);
+	lua_Integer link_type = luaL_checkinteger (L, 3);
+	if (!lua_isnoneornil (L, 4))
+		luaL_checktype (L, 4, LUA_TFUNCTION);
+	int64_t first = luaL_optinteger (L, 5, 0);
+
+	enum endianity e = self->endianity;
+
+	char time[64];
+	int64_t i = first;
+	for (; self->position < self->len; i++)
+	{
+		int64_t p = self->position, offset = self->offset + p;
+		if (self->len - p < 16)
+			return luaL_error (L, "unexpected EOF");
+		const uint8_t *header = app_lua_data (L, offset, 16);
+		if (!header)
+			return luaL_error (L, "chunk is out of reach");
+
+		int64_t ts_sec = app_decode (header, 4, e);
+		uint32_t ts_usec = app_decode (header + 4, 4, e);
+		uint32_t incl_len = app_decode (header + 8, 4, e);
+		uint32_t orig_len = app_decode (header + 12, 4, e);
+
+		app_lua_markf (L, offset, 16, "PCAP record %" PRId64 " header", i);
+		app_lua_pcap_time (time, sizeof time, ts_sec + zone, ts_usec, 6);
+		app_lua_markf (L, offset, 8, "timestamp: %s", time);
+		app_lua_markf (L, offset + 8, 4,
+			"included record length: %" PRIu32, incl_len);
+		app_lua_markf (L, offset + 12, 4,
+			"original record length: %" PRIu32, orig_len);
+		if (incl_len > self->len - p - 16)
+			return luaL_error (L, "unexpected EOF");
+
+		app_lua_markf (L, offset + 16, incl_len,
+			"PCAP record %" PRId64 " data", i);
+		self->position = p + 16 + incl_len;
+		app_lua_pcap_payload (L, 4, offset + 16, incl_len, link_type, i);
+	}
+	lua_pushinteger (L, i - first);
+	return 1;
+}
+
+/// Skip up to the given number of libpcap records from the current position,
+/// or right to the end, if a record is cut short, so that decoding them
+/// reports the error.  Returns how many records have been skipped.
+static int
+app_lua_chunk_pcap_skip (lua_State *L)
+{
+	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
+	lua_Integer limit = luaL_checkinteger (L, 2);
+
+	lua_Integer i = 0;
+	for (; i < limit && self->position < self->len; i++)
+	{
+		int64_t p = self->position;
+		const uint8_t *length = self->len - p < 16
+			? NULL : app_lua_data (L, self->offset + p + 8, 4);
+		uint32_t incl_len = length ? app_decode (length, 4, self->endianity)
+			: UINT32_MAX;
+		if (incl_len > self->len - p - 16)
+			self->position = self->len;
+		else
+			self->position = p + 16 + incl_len;
+	}
+	lua_pushinteger (L, i);
+	return 1;
+}
+
+struct app_lua_pcapng_interface
+{
+	uint32_t link_type;                 ///< Link type of its packets
+	uint64_t resolution;                ///< Timestamp units per second
+};
+
+static const char *
+app_lua_pcapng_block_name (uint32_t type)
+{
+	switch (type)
+	{
+	case 0x0a0d0d0a: return "Section Header Block";
+	case 0x00000001: return "Interface Description Block";
+	case 0x00000003: return "Simple Packet Block";
+	case 0x00000004: return "Name Resolution Block";
+	case 0x00000005: return "Interface Statistics Block";
+	case 0x00000006: return "Enhanced Packet Block";
+	case 0x00000bad: return "Custom Block";
+	case 0x40000bad: return "Custom Block";
+	}
+	return NULL;
+}
+
+/// Decode the value of the if_tsresol option
+static uint64_t
+app_lua_pcapng_resolution (uint8_t tsresol)
+{
+	if (tsresol & 0x80)
+		return (uint64_t) 1 << MIN (tsresol & 0x7f, 63);
+
+	uint64_t resolution = 1;
+	for (int i = MIN (tsresol, 19); i--; )
+		resolution *= 10;
+	return resolution;
+}
+
+/// Format a timestamp, showing binary fractions of a second as nanoseconds
+static void
+app_lua_pcapng_time (char *buf, size_t size, uint64_t ts, uint64_t resolution)
+{
+	int digits = 0;
+	uint64_t power = 1;
+	while (power < resolution && power <= UINT64_MAX / 10)
+	{
+		power *= 10;
+		digits++;
+	}
+
+	uint64_t frac = ts % resolution;
+	if (power != resolution)
+	{
+		frac = (double) frac / resolution * 1e9;
+		digits = 9;
+	}
+	app_lua_pcap_time (buf, size, ts / resolution, frac, digits);
+}
+
+/// Mark options, which are padded to 32 bits, up to the end of a block
+static void
+app_lua_pcapng_options (lua_State *L, const uint8_t *p,
+	int64_t offset, int64_t len, enum endianity e)
+{
+	int64_t i = 0;
+	while (len - i >= 4)
+	{
+		uint16_t type = app_decode (p + i, 2, e);
+		uint16_t length = app_decode (p + i + 2, 2, e);
+		app_lua_markf (L, offset + i, 2, "option type: %u", type);
+		app_lua_markf (L, offset + i + 2, 2, "option length: %u", length);
+		i += 4;
+
+		int64_t padded = MIN (len - i, length + (-length & 3));
+		app_lua_markf (L, offset + i, padded, "option value");
+		i += padded;
+	}
+}
+
+/// Find the timestamp resolution within interface description options
+static uint64_t
+app_lua_pcapng_if_resolution (const uint8_t *p, int64_t len, enum endianity e)
+{
+	uint64_t resolution = 1000000;
+	int64_t i = 0;
+	while (len - i >= 4)
+	{
+		uint16_t type = app_decode (p + i, 2, e);
+		uint16_t length = app_decode (p + i + 2, 2, e);
+		i += 4;
+
+		int64_t padded = MIN (len - i, length + (-length & 3));
+		if (type == 9 /* if_tsresol */ && length && padded)
+			resolution = app_lua_pcapng_resolution (p[i]);
+		i += padded;
+	}
+	return resolution;
+}
+
+/// Walk pcapng blocks from the current position up to the end,
+/// marking their framing, and the fields of the most common ones:
+///  - the second argument is a table of link type names by their number;
+///  - the third argument, if present, is a function to decode packet data,
+///    called with a chunk, the link type, and the packet index;
+///  - the fourth argument, if present, lists interfaces described before
+///    the chunk, as filled in by chunk:pcapng_skip();
+///  - the fifth argument, if present, is the index of the first packet.
+/// Returns the number of packets.
+static int
+app_lua_chunk_pcapng_blocks (lua_State *L)
+{
+	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
+	luaL_checktype (L, 2, LUA_TTABLE);
+	if (!lua_isnoneornil (L, 3))
+		luaL_checktype (L, 3, LUA_TFUNCTION);
+	size_t known = 0;
+	if (!lua_isnoneornil (L, 4))
+	{
+		luaL_checktype (L, 4, LUA_TTABLE);
+		known = lua_rawlen (L, 4) / 2;
+	}
+	int64_t first = luaL_optinteger (L, 5, 0);
+
+	// Interfaces are kept within Lua, so that errors cannot leak them
+	size_t interfaces_len = 0, interfaces_alloc = MAX (known, 4);
+	struct app_lua_pcapng_interface *interfaces =
+		lua_newuserdata (L, interfaces_alloc * sizeof *interfaces);
+	int interfaces_idx = lua_gettop (L);
+	for (; interfaces_len < known; interfaces_len++)
+	{
+		struct app_lua_pcapng_interface *interface =
+			&interfaces[interfaces_len];
+		lua_rawgeti (L, 4, interfaces_len * 2 + 1);
+		lua_rawgeti (L, 4, interfaces_len * 2 + 2);
+		interface->link_type = lua_tointeger (L, -2);
+		interface->resolution = lua_tointeger (L, -1);
+		lua_pop (L, 2);
+	}
+
+	char time[64];
+	int64_t packets = first;
+	while (self->position < self->len)
+	{
+		// Blocks are looked up one by one, so that edited data
+		// doesn't need to be pieced together all at once
+		int64_t p = self->position, offset = self->offset + p;
+		if (self->len - p < 12)
+			return luaL_error (L, "unexpected EOF");
+		const uint8_t *block = app_lua_data (L, offset, 12);
+		if (!block)
+			return luaL_error (L, "chunk is out of reach");
+
+		// The section header block type is a palindrome,
+		// and the byte order of the whole section follows its length
+		uint32_t type = app_decode (block, 4, self->endianity);
+		if (type == 0x0a0d0d0a)
+		{
+			uint32_t magic = app_decode (block + 8, 4, ENDIANITY_LE);
+			if (magic == 0x1a2b3c4d)
+				self->endianity = ENDIANITY_LE;
+			else if (magic == 0x4d3c2b1a)
+				self->endianity = ENDIANITY_BE;
+			else
+				return luaL_error (L, "invalid byte-order magic");
+			interfaces_len = 0;
+		}
+
+		enum endianity e = self->endianity;
+		uint32_t len = app_decode (block + 4, 4, e);
+		const char *name = app_lua_pcapng_block_name (type);
+		if (name)
+			app_lua_markf (L, offset, 4, "PCAPNG block type: %s", name);
+		else
+			app_lua_markf (L, offset, 4,
+				"PCAPNG block type: unknown: %" PRIu32, type);
+		app_lua_markf (L, offset + 4, 4,
+			"PCAPNG block length: %" PRIu32, len);
+		if (len < 12 || len > self->len - p)
+			return luaL_error (L, "invalid block length");
+		if (!(block = app_lua_data (L, offset, len)))
+			return luaL_error (L, "chunk is out of reach");
+
+		app_lua_markf (L, offset + len - 4, 4,
+			"PCAPNG trailing block length: %" PRIu32,
+			(uint32_t) app_decode (block + len - 4, 4, e));
+		self->position = p + len;
+
+		const uint8_t *body = block + 8;
+		int64_t body_offset = offset + 8, body_len = len - 12;
+		struct app_lua_pcapng_interface *interface = NULL;
+		uint64_t ts = 0;
+		uint32_t id = 0, captured = 0;
+		switch (type)
+		{
+		case 0x0a0d0d0a:
+			if (body_len < 16)
+				break;
+
+			app_lua_markf (L, body_offset, 4, "byte-order magic: %s",
+				e == ENDIANITY_LE ? "little-endian" : "big-endian");
+			app_lua_markf (L, body_offset + 4, 4, "PCAPNG version: %u.%u",
+				(unsigned) app_decode (body + 4, 2, e),
+				(unsigned) app_decode (body + 6, 2, e));
+			app_lua_markf (L, body_offset + 8, 8, "section length: %" PRId64,
+				(int64_t) app_decode (body + 8, 8, e));
+			app_lua_pcapng_options (L, body + 16,
+				body_offset + 16, body_len - 16, e);
+			break;
+		case 0x00000001:
+			if (body_len < 8)
+				break;
+
+			if (interfaces_len == interfaces_alloc)
+			{
+				struct app_lua_pcapng_interface *old = interfaces;
+				interfaces = lua_newuserdata (L,
+					(interfaces_alloc <<= 1) * sizeof *interfaces);
+				memcpy (interfaces, old, interfaces_len * sizeof *interfaces);
+				lua_replace (L, interfaces_idx);
+			}
+
+			interface = &interfaces[interfaces_len++];
+			interface->link_type = app_decode (body, 2, e);
+			interface->resolution =
+				app_lua_pcapng_if_resolution (body + 8, body_len - 8, e);
+
+			if (lua_rawgeti (L, 2, interface->link_type) == LUA_TSTRING)
+				app_lua_markf (L, body_offset, 2, "link type: %s",
+					lua_tostring (L, -1));
+			else
+				app_lua_markf (L, body_offset, 2, "link type: unknown: %"
+					PRIu32, interface->link_type);
+			lua_pop (L, 1);
+
+			app_lua_markf (L, body_offset + 4, 4, "snapshot length: %"
+				PRIu32, (uint32_t) app_decode (body + 4, 4, e));
+			app_lua_pcapng_options (L, body + 8,
+				body_offset + 8, body_len - 8, e);
+			break;
+		case 0x00000003:
+			if (body_len < 4 || !interfaces_len)
+				break;
+
+			captured = app_decode (body, 4, e);
+			app_lua_markf (L, body_offset, 4,
+				"original packet length: %" PRIu32, captured);
+			captured = MIN (captured, body_len - 4);
+			app_lua_markf (L, body_offset + 4, captured,
+				"packet %" PRId64 " data", packets);
+			app_lua_pcap_payload (L, 3, body_offset + 4, captured,
+				interfaces[0].link_type, packets++);
+			break;
+		case 0x00000005:
+		case 0x00000006:
+			if (body_len < 12
+			 || (id = app_decode (body, 4, e)) >= interfaces_len)
+				break;
+
+			interface = &interfaces[id];
+			ts = app_decode (body + 4, 4, e) << 32
+				| app_decode (body + 8, 4, e);
+			app_lua_pcapng_time (time, sizeof time, ts, interface->resolution);
+			app_lua_markf (L, body_offset, 4, "interface ID: %" PRIu32, id);
+			app_lua_markf (L, body_offset + 4, 8, "timestamp: %s", time);
+			if (type == 0x00000005)
+			{
+				app_lua_pcapng_options (L, body + 12,
+					body_offset + 12, body_len - 12, e);
+				break;
+			}
+			if (body_len < 20)
+				break;
+
+			captured = app_decode (body + 12, 4, e);
+			app_lua_markf (L, body_offset + 12, 4,
+				"captured packet length: %" PRIu32, captured);
+			app_lua_markf (L, body_offset + 16, 4,
+				"original packet length: %" PRIu32,
+				(uint32_t) app_decode (body + 16, 4, e));
+
+			captured = MIN (captured, body_len - 20);
+			app_lua_markf (L, body_offset + 20, captured,
+				"packet %" PRId64 " data", packets);
+			app_lua_pcap_payload (L, 3, body_offset + 20, captured,
+				interface->link_type, packets++);
+
+			int64_t padded = MIN (body_len - 20, captured + (-captured & 3));
+			app_lua_pcapng_options (L, body + 20 + padded,
+				body_offset + 20 + padded, body_len - 20 - padded, e);
+		}
+	}
+	lua_pushinteger (L, packets - first);
+	return 1;
+}
+
+/// Skip up to the given number of pcapng blocks from the current position,
+/// or right to the end, if a block is cut short, so that decoding them
+/// reports the error.  Sections change the chunk's byte order, and
+/// the table in the third argument gets the link types and timestamp
+/// resolutions of interfaces appended, or emptied by a new section.
+/// Returns how many blocks and how many packets have been skipped.
+static int
+app_lua_chunk_pcapng_skip (lua_State *L)
+{
+	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
+	lua_Integer limit = luaL_checkinteger (L, 2);
+	luaL_checktype (L, 3, LUA_TTABLE);
+
+	lua_Integer i = 0, packets = 0;
+	size_t interfaces = lua_rawlen (L, 3) / 2;
+	for (; i < limit && self->position < self->len; i++)
+	{
+		int64_t p = self->position, offset = self->offset + p;
+		const uint8_t *block = self->len - p < 12
+			? NULL : app_lua_data (L, offset, 12);
+		if (!block)
+			break;
+
+		uint32_t type = app_decode (block, 4, self->endianity);
+		if (type == 0x0a0d0d0a)
+		{
+			uint32_t magic = app_decode (block + 8, 4, ENDIANITY_LE);
+			if (magic == 0x1a2b3c4d)
+				self->endianity = ENDIANITY_LE;
+			else if (magic == 0x4d3c2b1a)
+				self->endianity = ENDIANITY_BE;
+			else
+				break;
+
+			for (; interfaces; interfaces--)
+			{
+				lua_pushnil (L);
+				lua_rawseti (L, 3, interfaces * 2);
+				lua_pushnil (L);
+				lua_rawseti (L, 3, interfaces * 2 - 1);
+			}
+		}
+
+		// Only interface descriptions need to be read in whole
+		enum endianity e = self->endianity;
+		uint32_t len = app_decode (block + 4, 4, e);
+		if (len < 12 || len > self->len - p
+		 || (type == 0x00000001 && !(block = app_lua_data (L, offset, len))))
+			break;
+
+		uint32_t body_len = len - 12;
+		if (type == 0x00000001 && body_len >= 8)
+		{
+			interfaces++;
+			lua_pushinteger (L, app_decode (block + 8, 2, e));
+			lua_rawseti (L, 3, interfaces * 2 - 1);
+			lua_pushinteger (L, app_lua_pcapng_if_resolution
+				(block + 16, body_len - 8, e));
+			lua_rawseti (L, 3, interfaces * 2);
+		}
+		else if (type == 0x00000003 && body_len >= 4 && interfaces)
+			packets++;
+		else if (type == 0x00000006 && body_len >= 20
+		 && app_decode (block + 8, 4, e) < interfaces)
+			packets++;
+		self->position = p + len;
+	}
+	if (i < limit && self->position < self->len)
+	{
+		self->position = self->len;
+		i++;
+	}
+	lua_pushinteger (L, i);
+	lua_pushinteger (L, packets);
+	return 2;
+}
+
+// Symbol and string tables of debugging builds may contain millions of entries,
+// so plugins decode them natively, and only the slices being looked at.
+
+/// Mark all NUL-terminated strings that begin within the chunk.
+/// The second argument, if present, is the table it is a slice of,
+/// which strings crossing the end of the chunk may continue in.
+static int
+app_lua_chunk_cstrings (lua_State *L)
+{
+	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
+	struct app_lua_chunk *table = self;
+	if (!lua_isnoneornil (L, 2))
+		table = luaL_checkudata (L, 2, XLUA_CHUNK_METATABLE);
+	if (self->offset < table->offset
+	 || self->offset + self->len > table->offset + table->len)
+		return luaL_argerror (L, 2, "the chunk is not a part of the table");
+
+	const uint8_t *data = app_lua_chunk_data (L, table);
+	if (!data)
+		return luaL_error (L, "chunk is out of reach");
+
+	// A string can only begin at the start of the table, or after a NUL
+	int64_t i = self->offset - table->offset, end = i + self->len;
+	while (i && i < end && data[i - 1])
+		i++;
+
+	while (i < end)
+	{
+		const uint8_t *s = data + i;
+		const uint8_t *nil = memchr (s, 0, table->len - i);
+		int64_t len = nil ? nil - s : table->len - i;
+		app_lua_markf (L, table->offset + i, len + !!nil,
+			"string %" PRId64 ": %.*s", i, (int) MIN (len, 200), s);
+		i += len + 1;
+	}
+	return 0;
+}
+
+static const char *
+app_lua_elf_symbol_binding (uint8_t info)
+{
+	switch (info >> 4)
+	{
+	case 0:  return "local";
+	case 1:  return "global";
+	case 2:  return "weak";
+	case 10: return "unique";
+	}
+	return "unknown";
+}
+
+static const char *
+app_lua_elf_symbol_type (uint8_t info)
+{
+	switch (info & 0xf)
+	{
+	case 0:  return "unspecified";
+	case 1:  return "data object";
+	case 2:  return "code object";
+	case 3:  return "section";
+	case 4:  return "file";
+	case 5:  return "common data object";
+	case 6:  return "thread-local data object";
+	case 10: return "indirect code object";
+	}
+	return "unknown";
+}
+
+/// Mark ELF symbol table entries from the current position up to the end:
+///  - the second argument is the ELF class, 1 for 32-bit, 2 for 64-bit;
+///  - the third argument is the index of the first entry;
+///  - the fourth argument, if present, is the linked string table.
+static int
+app_lua_chunk_elf_symbols (lua_State *L)
+{
+	struct app_lua_chunk *self = luaL_checkudata (L, 1, XLUA_CHUNK_METATABLE);
+	lua_Integer class = luaL_checkinteger (L, 2);
+	int64_t index = luaL_checkinteger (L, 3);
+	struct app_lua_chunk *strings = NULL;
+	if (!lua_isnoneornil (L, 4))
+		strings = luaL_checkudata (L, 4, XLUA_CHUNK_METATABLE);
+	if (class != 1 && class != 2)
+		return luaL_argerror (L, 2, "invalid ELF class");
+
+	const uint8_t *data = app_lua_chunk_data (L, self);
+	if (!data)
+		return luaL_error (L, "chunk is out of reach");
+
+	// Names are left out when the string table lies past the data
+	const uint8_t *names = strings ? app_lua_chunk_data (L, strings) : NULL;
+
+	// The 64-bit layout is reordered for alignment
+	int wide = class * 4, size = class == 1 ? 16 : 24;
+	int value_at = class == 1 ? 4 : 8, size_at = value_at + wide;
+	int info_at = class == 1 ? 12 : 4;
+
+	enum endianity e = self->endianity;
+	for (; self->len - self->position >= size; index++)
+	{
+		const uint8_t *p = data + self->position;
+		int64_t offset = self->offset + self->position;
+		self->position += size;
+
+		uint32_t name = app_decode (p, 4, e);
+		const uint8_t *s = NULL, *nil = NULL;
+		if (names && name < strings->len)
+		{
+			s = names + name;
+			nil = memchr (s, 0, strings->len - name);
+		}
+		if (s && nil > s)
+			app_lua_markf (L, offset, size, "ELF symbol %" PRId64 " (%.*s)",
+				index, (int) MIN (nil - s, 200), s);
+		else
+			app_lua_markf (L, offset, size, "ELF symbol %" PRId64, index);
+
+		app_lua_markf (L, offset, 4, "name index: %" PRIu32, name);
+		app_lua_markf (L, offset + value_at, wide, "value: %#" PRIx64,
+			app_decode (p + value_at, wide, e));
+		app_lua_markf (L, offset + size_at, wide, "size: %" PRIu64,
+			app_decode (p + size_at, wide, e));
+
+		uint8_t info = p[info_at], other = p[info_at + 1];
+		app_lua_markf (L, offset + info_at, 1, "binding: %s, type: %s",
+			app_lua_elf_symbol_binding (info), app_lua_elf_symbol_type (info));
+
+		static const char *visibility[] =
+			{ "default", "internal", "hidden", "protected" };
+		app_lua_markf (L, offset + info_at + 1, 1, "visibility: %s",
+			visibility[other & 3]);
+
+		uint16_t section = app_decode (p + info_at + 2, 2, e);
+		if (section == 0)
+			app_lua_markf (L, offset + info_at + 2, 2, "section: undefined");
+		else if (section == 0xfff1)
+			app_lua_markf (L, offset + info_at + 2, 2, "section: absolute");
+		else if (section == 0xfff2)
+			app_lua_markf (L, offset + info_at + 2, 2, "section: common");
+		else
+			app_lua_markf (L, offset + info_at + 2, 2,
+				"section index: %u", section);
+	}
+	return 0;
+}
+
+static luaL_Reg app_lua_chunk_table[] =
 {
 	{ "__len",      app_lua_chunk_len      },
 	{ "__call",     app_lua_chunk_call     },
@@ -1184,183 +6058,1305 @@ static luaL_Reg app_lua_chunk_table[] =
 	{ "mark",       app_lua_chunk_mark     },
 	{ "identify",   app_lua_chunk_identify },
 	{ "decode",     app_lua_chunk_decode   },
+	{ "defer",      app_lua_chunk_defer    },
+	{ "enclosing",  app_lua_chunk_enclosing },
+
+	{ "read",       app_lua_chunk_read     },
+	{ "cstring",    app_lua_chunk_cstring  },
+	{ "u8",         app_lua_chunk_u8       },
+	{ "s8",         app_lua_chunk_s8       },
+	{ "u16",        app_lua_chunk_u16      },
+	{ "s16",        app_lua_chunk_s16      },
+	{ "u32",        app_lua_chunk_u32      },
+	{ "s32",        app_lua_chunk_s32      },
+	{ "u64",        app_lua_chunk_u64      },
+	{ "s64",        app_lua_chunk_s64      },
+
+	{ "pcap_records",  app_lua_chunk_pcap_records  },
+	{ "pcap_skip",     app_lua_chunk_pcap_skip     },
+	{ "pcapng_skip",   app_lua_chunk_pcapng_skip   },
+	{ "pcapng_blocks", app_lua_chunk_pcapng_blocks },
+	{ "cstrings",      app_lua_chunk_cstrings      },
+	{ "elf_symbols",   app_lua_chunk_elf_symbols   },
+	{ NULL,         NULL                   }
+};
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+static void
+app_lua_load_plugins (struct app_lua *self, const char *plugin_dir,
+	bool report_errors)
+{
+	DIR *dir;
+	if (!(dir = opendir (plugin_dir)))
+	{
+		if (errno != ENOENT && report_errors)
+			print_error ("cannot open directory `%s': %s",
+				plugin_dir, strerror (errno));
+		return;
+	}
+
+	lua_State *L = self->L;
+	lua_pushcfunction (L, app_lua_error_handler);
+
+	struct dirent *iter;
+	while ((errno = 0, iter = readdir (dir)))
+	{
+		const char *dot = strrchr (iter->d_name, '.');
+		if (!dot || strcmp (dot, ".lua"))
+			continue;
+
+		char *path = xstrdup_printf ("%s/%s", plugin_dir, iter->d_name);
+		if (luaL_loadfile (L, path)
+		 || lua_pcall (L, 0, 0, -2))
+		{
+			if (report_errors)
+				print_error ("%s: %s", path, lua_tostring (L, -1));
+			lua_pop (L, 1);
+		}
+		free (path);
+	}
+	if (errno)
+		exit_fatal ("readdir: %s", strerror (errno));
+	closedir (dir);
+
+	lua_pop (L, 1);
+}
+
+/// Create a new Lua state with all plugins loaded.  Only one of them needs
+/// to report errors, they would all be the same.
+static struct app_lua *
+app_lua_new (bool report_errors)
+{
+	struct app_lua *self = xcalloc (1, sizeof *self);
+#if LUA_VERSION_NUM >= 505
+	lua_State *L = self->L = lua_newstate (app_lua_alloc, NULL, 0);
+#else
+	lua_State *L = self->L = lua_newstate (app_lua_alloc, NULL);
+#endif
+	if (!L)
+		exit_fatal ("Lua initialization failed");
+
+	*(struct app_lua **) lua_getextraspace (L) = self;
+	self->coders = str_map_make (app_lua_coder_free);
+	ARRAY_INIT (self->decodes);
+	ARRAY_INIT (self->spills);
+	self->decode = UINT32_MAX;
+
+	lua_atpanic (L, app_lua_panic);
+	luaL_openlibs (L);
+	luaL_checkversion (L);
+
+	// I don't want to reimplement this and the C function is not exported
+	hard_assert (lua_getglobal (L, LUA_STRLIBNAME));
+	hard_assert (lua_getfield (L, -1, "format"));
+	self->ref_format = luaL_ref (L, LUA_REGISTRYINDEX);
+
+	luaL_newlib (L, app_lua_library);
+	lua_setglobal (L, PROGRAM_NAME);
+
+	luaL_newmetatable (L, XLUA_CHUNK_METATABLE);
+	luaL_setfuncs (L, app_lua_chunk_table, 0);
+	lua_pop (L, 1);
+
+	struct strv v = strv_make ();
+	get_xdg_data_dirs (&v);
+	for (size_t i = 0; i < v.len; i++)
+	{
+		char *path = xstrdup_printf
+			("%s/%s", v.vector[i], PROGRAM_NAME "/plugins");
+		app_lua_load_plugins (self, path, report_errors);
+		free (path);
+	}
+	strv_free (&v);
+	return self;
+}
+
+/// Load plugins into the main Lua state from a worker thread
+static void
+app_lua_load_execute (struct app_task *task, size_t worker, size_t job)
+{
+	(void) task;
+	(void) worker;
+	(void) job;
+
+	g.startup[STARTUP_PLUGINS].start = app_clock_usec ();
+	g.lua = app_lua_new (true);
+	g.startup[STARTUP_PLUGINS].end = app_clock_usec ();
+}
+
+static void
+app_lua_forget_decodes (struct app_lua *self, size_t len)
+{
+	while (self->decodes_len > len)
+	{
+		struct app_lua_decode *node = &self->decodes[--self->decodes_len];
+		luaL_unref (self->L, LUA_REGISTRYINDEX, node->ref_args);
+		free (node->type);
+	}
+}
+
+static void
+app_lua_destroy (struct app_lua *self)
+{
+	app_lua_forget_decodes (self, 0);
+	free (self->decodes);
+	app_lua_forget_spills (self);
+	free (self->spills);
+	str_map_free (&self->coders);
+	lua_close (self->L);
+	free (self);
+}
 
-	{ "read",       app_lua_chunk_read     },
-	{ "cstring",    app_lua_chunk_cstring  },
-	{ "u8",         app_lua_chunk_u8       },
-	{ "s8",         app_lua_chunk_s8       },
-	{ "u16",        app_lua_chunk_u16      },
-	{ "s16",        app_lua_chunk_s16      },
-	{ "u32",        app_lua_chunk_u32      },
-	{ "s32",        app_lua_chunk_s32      },
-	{ "u64",        app_lua_chunk_u64      },
-	{ "s64",        app_lua_chunk_s64      },
-	{ NULL,         NULL                   }
+/// Decode a range of the data, either as the given type, or autodetecting it,
+/// as if from within the decode "parent", with any remembered arguments
+static bool
+app_lua_decode_range (struct app_lua *self, int64_t offset, int64_t len,
+	const char *type, uint32_t parent, int ref_args, struct error **e)
+{
+	lua_State *L = self->L;
+	int handler = lua_gettop (L) + 1;
+	lua_pushcfunction (L, app_lua_error_handler);
+	lua_pushcfunction (L, app_lua_chunk_decode);
+
+	struct app_lua_chunk *chunk = app_lua_chunk_new (L);
+	chunk->offset = offset;
+	chunk->len = len;
+
+	if (type)
+		lua_pushstring (L, type);
+	else
+		lua_pushnil (L);
+
+	int n_args = app_lua_push_decode_args (L, ref_args);
+	self->decode = parent;
+	bool ok = !lua_pcall (L, 2 + n_args, 0, handler);
+	if (!ok)
+	{
+		error_set (e, "%s", lua_tostring (L, -1));
+		lua_pop (L, 1);
+	}
+	lua_pop (L, 1);
+	self->decode = parent;
+	return ok;
+}
+
+/// Decode all of the data, either as the given type, or autodetecting it
+static bool
+app_lua_decode_data (struct app_lua *self, const char *type, struct error **e)
+{
+	app_lua_forget_decodes (self, 0);
+	self->mark_end = self->data_offset;
+	return app_lua_decode_range (self,
+		self->data_offset, self->data_len, type, UINT32_MAX, LUA_NOREF, e);
+}
+
+/// Run all deferred decodes, including those deferred in the meantime,
+/// for when nothing is going to be viewed
+static bool
+app_lua_decode_deferred (struct app_lua *self, struct error **e)
+{
+	for (size_t i = 0; i < self->decodes_len; i++)
+	{
+		struct app_lua_decode node = self->decodes[i];
+		if (!node.deferred || node.dead)
+			continue;
+
+		self->decodes[i].dead = true;
+		if (!app_lua_decode_range (self, node.offset, node.len,
+			node.type, node.parent, node.ref_args, e))
+			return false;
+	}
+	return true;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// Carving looks for signatures of known formats anywhere within the data.
+// The data is split into blocks small enough to stay in cache while being
+// scanned for each signature in turn, and these are spread across threads.
+
+enum { CARVE_BLOCK_SIZE = 1 << 20 };
+
+struct app_carve_signature
+{
+	const struct str *magic;            ///< The signature
+	const char *type;                   ///< Name of the coder
+};
+
+struct app_carve_hit
+{
+	int64_t offset;                     ///< Offset of the signature
+	const char *type;                   ///< Name of the coder
+};
+
+struct app_carve_block
+{
+	ARRAY (struct app_carve_hit, hits)  ///< Sorted hits within the block
+};
+
+struct app_carve
+{
+	const uint8_t *data;                ///< Data to scan
+	int64_t data_len;                   ///< Length of the data
+	int64_t data_offset;                ///< Offset of the data within the file
+
+	ARRAY (struct app_carve_signature, signatures)
+	size_t magic_max;                   ///< Length of the longest signature
+
+	struct app_carve_block *blocks;     ///< Results for each block
+};
+
+static int
+app_carve_hit_cmp (const void *a, const void *b)
+{
+	const struct app_carve_hit *x = a, *y = b;
+	if (x->offset < y->offset) return -1;
+	if (x->offset > y->offset) return  1;
+	return 0;
+}
+
+static void
+app_carve_execute (struct app_task *task, size_t worker, size_t job)
+{
+	(void) worker;
+
+	struct app_carve *self = task->user_data;
+	struct app_carve_block *block = &self->blocks[job];
+	ARRAY_INIT (block->hits);
+
+	// Let the scanned range overlap with the next block by just enough
+	// for signatures starting in this one to be matched in full
+	int64_t start = (int64_t) job * CARVE_BLOCK_SIZE;
+	int64_t end = MIN (start + CARVE_BLOCK_SIZE, self->data_len);
+	int64_t scan_end = MIN (end + (int64_t) self->magic_max - 1,
+		self->data_len);
+
+	for (size_t i = 0; i < self->signatures_len; i++)
+	{
+		const struct app_carve_signature *sig = &self->signatures[i];
+		const uint8_t *p = self->data + start, *limit = self->data + scan_end;
+		while ((p = app_memmem (p, limit - p,
+			(const uint8_t *) sig->magic->str, sig->magic->len))
+			&& p < self->data + end)
+		{
+			ARRAY_RESERVE (block->hits, 1);
+			block->hits[block->hits_len++] = (struct app_carve_hit)
+				{ self->data_offset + (p - self->data), sig->type };
+			p++;
+		}
+	}
+	qsort (block->hits, block->hits_len, sizeof *block->hits,
+		app_carve_hit_cmp);
+}
+
+/// Try to decode the object a signature has been found for, returning
+/// the extent of its marks, or zero if that has failed
+static int64_t
+app_lua_carve_hit (struct app_lua *self, const struct app_carve_hit *hit)
+{
+	lua_State *L = self->L;
+	lua_pushcfunction (L, app_lua_error_handler);
+	lua_pushcfunction (L, app_lua_chunk_carve);
+
+	struct app_lua_chunk *chunk = app_lua_chunk_new (L);
+	chunk->offset = hit->offset;
+	chunk->len = self->data_offset + self->data_len - hit->offset;
+	lua_pushstring (L, hit->type);
+
+	int64_t len = 0;
+	self->decode = UINT32_MAX;
+	if (lua_pcall (L, 2, 1, -4))
+		print_debug ("carving %s at %" PRId64 " failed: %s",
+			hit->type, hit->offset, lua_tostring (L, -1));
+	else
+		len = lua_tointeger (L, -1);
+	lua_pop (L, 2);
+	return len;
+}
+
+/// Find and decode objects of known types embedded anywhere within the data
+static void
+app_lua_carve (struct app_lua *self, size_t threads)
+{
+	struct app_carve carve =
+	{
+		.data = self->data,
+		.data_len = self->data_len,
+		.data_offset = self->data_offset,
+	};
+	ARRAY_INIT (carve.signatures);
+
+	struct str_map_iter iter = str_map_iter_make (&self->coders);
+	struct app_lua_coder *coder;
+	while ((coder = str_map_iter_next (&iter)))
+		for (size_t i = 0; i < coder->magic_len; i++)
+		{
+			ARRAY_RESERVE (carve.signatures, 1);
+			carve.signatures[carve.signatures_len++] =
+				(struct app_carve_signature)
+				{ &coder->magic[i], iter.link->key };
+			carve.magic_max = MAX (carve.magic_max, coder->magic[i].len);
+		}
+
+	size_t blocks_len = (self->data_len + CARVE_BLOCK_SIZE - 1)
+		/ CARVE_BLOCK_SIZE;
+	carve.blocks = xcalloc (blocks_len, sizeof *carve.blocks);
+	if (carve.signatures_len)
+	{
+		struct app_task task =
+			{ .execute = app_carve_execute, .user_data = &carve };
+		app_task_start (&task, blocks_len, threads);
+		app_task_wait (&task);
+	}
+
+	// Objects found within carved objects have most likely been processed
+	// by their decoders already; the one at the very start certainly has,
+	// and so has everything that the main decode has marked
+	int64_t covered = MAX (self->data_offset + 1, self->mark_end);
+	for (size_t i = 0; i < blocks_len; i++)
+	{
+		struct app_carve_block *block = &carve.blocks[i];
+		for (size_t k = 0; k < block->hits_len; k++)
+		{
+			struct app_carve_hit *hit = &block->hits[k];
+			if (hit->offset < covered)
+				continue;
+
+			int64_t len = app_lua_carve_hit (self, hit);
+			if (len)
+				covered = hit->offset + len;
+		}
+		free (block->hits);
+	}
+	free (carve.blocks);
+	free (carve.signatures);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+// Decodes form a tree, each node of which knows what part of the data it has
+// covered, and as which type.  Marks simply move along with edited data,
+// and only the innermost decode enclosing all changes needs to run again,
+// over a snapshot of the data as edited, while the user interface stays live.
+// Plugins split large formats into nested decodes, so that this stays cheap.
+// The initial decode of everything runs in the background as well,
+// and so do decodes deferred by plugins, once they come into view.
+
+enum { REDECODE_POLL_MS = 10 };
+
+struct app_redecode
+{
+	struct app_task task;               ///< Background decoding
+	struct poller_timer timer;          ///< Polls for completion
+	bool running;                       ///< The task is running
+
+	int64_t dirty_start;                ///< Start of changed data, or -1
+	int64_t dirty_end;                  ///< End of changed data
+
+	bool full;                          ///< Decode everything from scratch
+	char *full_type;                    ///< Forced type for "full"
+	bool carve;                         ///< Also carve with "full"
+
+	uint32_t node;                      ///< The decode being repeated
+	size_t decodes_len;                 ///< Number of decodes before it ran
+	int64_t offset;                     ///< Offset of the decoded range
+	int64_t len;                        ///< Length of the decoded range
+	char *type;                         ///< Type to decode it as, if known
+	uint32_t parent;                    ///< Decode enclosing it
+	int ref_args;                       ///< Arguments to decode it with
+
+	const uint8_t *data;                ///< The data available to decoders
+	int64_t data_offset;                ///< Offset of the available data
+	int64_t data_len;                   ///< Length of the available data
+	uint8_t *copy;                      ///< Copy of edited data, if needed
+	struct app_edited *edited;          ///< Edited data, instead of "data"
+	ARRAY (struct mark, marks)          ///< Marks it has produced
+	struct str mark_strings;            ///< Storage for mark descriptions
+	char *error;                        ///< Decoding error, if any
+};
+
+static void
+app_redecode_mark (void *user_data,
+	int64_t offset, int64_t len, uint32_t decode, const char *desc)
+{
+	struct app_redecode *self = user_data;
+	ARRAY_RESERVE (self->marks, 1);
+	self->marks[self->marks_len++] =
+		(struct mark) { offset, len, self->mark_strings.len, decode };
+
+	str_append (&self->mark_strings, desc);
+	str_append_c (&self->mark_strings, 0);
+}
+
+static void
+app_redecode_execute (struct app_task *task, size_t worker, size_t job)
+{
+	(void) worker;
+	(void) job;
+
+	// Nothing else touches the main Lua state while this is running
+	struct app_redecode *self = task->user_data;
+	struct app_lua *lua = g.lua;
+	lua->data = self->data;
+	lua->data_len = self->data_len;
+	lua->data_offset = self->data_offset;
+	lua->edited = self->edited;
+	lua->on_mark = app_redecode_mark;
+	lua->user_data = self;
+
+	struct error *e = NULL;
+	bool ok = self->full
+		? app_lua_decode_data (lua, self->type, &e)
+		: app_lua_decode_range (lua, self->offset, self->len,
+			self->type, self->parent, self->ref_args, &e);
+	if (!ok)
+	{
+		self->error = xstrdup (e->message);
+		error_free (e);
+	}
+	else if (self->full && self->carve)
+		app_lua_carve (lua, app_cpu_count ());
+
+	app_lua_forget_spills (lua);
+	lua->edited = NULL;
+}
+
+/// Move decodes along with the data, and extend the changed range
+static void
+app_redecode_apply (struct app_redecode *self, const struct app_splice *s)
+{
+	struct app_lua *lua = g.lua;
+	for (size_t i = 0; i < lua->decodes_len; i++)
+	{
+		struct app_lua_decode *node = &lua->decodes[i];
+		if (node->offset <= s->offset + s->remove
+		 && s->offset <= node->offset + node->len)
+			node->failed = false;
+
+		int64_t end = app_splice_map (s, node->offset + node->len);
+		node->offset = app_splice_map (s, node->offset);
+		node->len = end - node->offset;
+	}
+
+	// Removals also affect whatever they have left adjacent
+	int64_t start = s->offset, end = s->offset + s->insert;
+	if (!s->insert)
+	{
+		start--;
+		end++;
+	}
+	if (self->dirty_start >= 0)
+	{
+		start = MIN (start, app_splice_map (s, self->dirty_start));
+		end = MAX (end, app_splice_map (s, self->dirty_end));
+	}
+	self->dirty_start = start;
+	self->dirty_end = end;
+}
+
+static void
+app_redecode_select (struct app_redecode *self, size_t i)
+{
+	struct app_lua_decode *node = &g.lua->decodes[i];
+	self->node = i;
+	self->offset = node->offset;
+	self->len = node->len;
+	cstr_set (&self->type, xstrdup (node->type));
+	self->parent = node->parent;
+	self->ref_args = node->ref_args;
+}
+
+/// Find the innermost live decode enclosing the changed range, if any
+static bool
+app_redecode_find (struct app_redecode *self)
+{
+	if (self->dirty_start < 0)
+		return false;
+
+	int64_t start = MAX (self->dirty_start, g.data_offset);
+	int64_t end = MIN (self->dirty_end, g.data_offset + g.data_len);
+	self->dirty_start = self->dirty_end = -1;
+
+	// Nested decodes always come after those enclosing them
+	struct app_lua *lua = g.lua;
+	size_t i = lua->decodes_len;
+	while (i--)
+	{
+		struct app_lua_decode *node = &lua->decodes[i];
+		if (!node->dead
+		 && node->offset <= start && end <= node->offset + node->len)
+			break;
+	}
+	if (i == SIZE_MAX)
+		return false;
+
+	app_redecode_select (self, i);
+	return true;
+}
+
+/// Find a deferred decode that has come into view, if any
+static bool
+app_redecode_find_deferred (struct app_redecode *self)
+{
+	int64_t start = g.view_top;
+	int64_t end = g.view_top + app_visible_rows () * ROW_SIZE;
+
+	struct app_lua *lua = g.lua;
+	for (size_t i = 0; i < lua->decodes_len; i++)
+	{
+		struct app_lua_decode *node = &lua->decodes[i];
+		if (node->deferred && !node->failed && !node->dead
+		 && node->offset < end && start < node->offset + node->len)
+		{
+			app_redecode_select (self, i);
+			return true;
+		}
+	}
+	return false;
+}
+
+static void
+app_redecode_start (struct app_redecode *self)
+{
+	if (self->full)
+	{
+		self->dirty_start = self->dirty_end = -1;
+		self->node = UINT32_MAX;
+		self->offset = g.data_offset;
+		self->len = g.data_len;
+		cstr_set (&self->type,
+			self->full_type ? xstrdup (self->full_type) : NULL);
+		self->ref_args = LUA_NOREF;
+	}
+	else if (!app_redecode_find (self) && !app_redecode_find_deferred (self))
+		return;
+
+	// Unless edited, the data can be decoded right where it has been loaded.
+	// Otherwise, decoders read through a snapshot of the piece table,
+	// except for carving, which needs all of the data in one piece.
+	// Either way, all of it stays available, as plugins may need it.
+	self->decodes_len = g.lua->decodes_len;
+	self->data = NULL;
+	self->data_offset = g.data_offset;
+	self->data_len = g.data_len;
+	if (!g.edits_done)
+		self->data = g.data;
+	else if (self->full && self->carve)
+	{
+		self->data = self->copy = xmalloc (MAX (g.data_len, 1));
+		app_edit_read (0, self->copy, g.data_len);
+	}
+	else
+		self->edited = app_edited_snapshot ();
+
+	self->marks_len = 0;
+	str_reset (&self->mark_strings);
+	cstr_set (&self->error, NULL);
+
+	self->task.execute = app_redecode_execute;
+	self->task.user_data = self;
+	app_task_start (&self->task, 1, 1);
+	self->running = true;
+	poller_timer_set (&self->timer, REDECODE_POLL_MS);
+}
+
+/// Drop descriptions of marks that are gone, once they take up most of
+/// the storage, as each re-decode appends descriptions of its own
+static void
+app_redecode_compact (void)
+{
+	struct str compacted = str_make ();
+	str_reserve (&compacted, g.mark_strings.len - g.mark_strings_dead);
+	for (size_t i = 0; i < g.marks_len; i++)
+	{
+		const char *desc = g.mark_strings.str + g.marks[i].description;
+		g.marks[i].description = compacted.len;
+		str_append_data (&compacted, desc, strlen (desc) + 1);
+	}
+
+	str_free (&g.mark_strings);
+	g.mark_strings = compacted;
+	g.mark_strings_dead = 0;
+	app_memory_set (MEMORY_MARK_STRINGS, g.mark_strings.alloc, 1);
+}
+
+/// Replace marks of the repeated decode and everything nested within it
+static void
+app_redecode_merge (struct app_redecode *self)
+{
+	struct app_lua *lua = g.lua;
+	if (g.fields)
+		app_field_index_stop (g.fields);
+	if (self->node == UINT32_MAX)
+	{
+		g.marks_len = 0;
+		str_reset (&g.mark_strings);
+		g.mark_strings_dead = 0;
+	}
+	else
+	{
+		// Plugins may have made nested decodes outside of the repeated
+		// one's range only to reuse their results, which stay as they are
+		const struct app_lua_decode *repeated = &lua->decodes[self->node];
+		size_t n = self->decodes_len - self->node;
+		bool *nested = xcalloc (n, sizeof *nested);
+		nested[0] = lua->decodes[self->node].dead = true;
+		for (size_t i = 1; i < n; i++)
+		{
+			struct app_lua_decode *node = &lua->decodes[self->node + i];
+			if (node->parent == UINT32_MAX || node->parent < self->node
+			 || !nested[node->parent - self->node])
+				continue;
+
+			nested[i] = true;
+			if (repeated->offset <= node->offset && node->offset + node->len
+				<= repeated->offset + repeated->len)
+				node->dead = true;
+		}
+		free (nested);
+	}
+
+	size_t kept = 0;
+	for (size_t i = 0; i < g.marks_len; i++)
+	{
+		uint32_t decode = g.marks[i].decode;
+		if (decode == UINT32_MAX || !lua->decodes[decode].dead)
+			g.marks[kept++] = g.marks[i];
+		else
+			g.mark_strings_dead += strlen (g.mark_strings.str
+				+ g.marks[i].description) + 1;
+	}
+	g.marks_len = kept;
+
+	// Both sets are sorted, so they can be merged from the back in place
+	qsort (self->marks, self->marks_len, sizeof *self->marks, app_mark_cmp);
+	size_t base = g.mark_strings.len, alloc = g.mark_strings.alloc;
+	str_append_data (&g.mark_strings,
+		self->mark_strings.str, self->mark_strings.len);
+	if (g.mark_strings.alloc != alloc)
+		app_memory_grown (MEMORY_MARK_STRINGS,
+			g.mark_strings.str, g.mark_strings.alloc);
+
+	APP_ARRAY_RESERVE (MEMORY_MARKS, g.marks, self->marks_len);
+	size_t i = g.marks_len, k = self->marks_len;
+	g.marks_len += self->marks_len;
+	for (size_t out = g.marks_len; k; )
+	{
+		if (i && app_mark_cmp (&g.marks[i - 1], &self->marks[k - 1]) > 0)
+			g.marks[--out] = g.marks[--i];
+		else
+		{
+			g.marks[--out] = self->marks[--k];
+			g.marks[out].description += base;
+		}
+	}
+
+	if (g.mark_strings_dead > g.mark_strings.len / 2)
+		app_redecode_compact ();
+}
+
+static void
+app_redecode_reindex (void)
+{
+	app_index_marks ();
+	if (g.fields)
+	{
+		app_field_index_start (g.fields);
+		g.field_results_len = 0;
+	}
+	xui_invalidate ();
+}
+
+static void
+app_on_redecode_timer (void *user_data)
+{
+	struct app_redecode *self = user_data;
+	if (!app_task_jobs_done (&self->task))
+	{
+		poller_timer_set (&self->timer, REDECODE_POLL_MS);
+		return;
+	}
+
+	app_task_wait (&self->task);
+	self->running = false;
+	free (self->copy);
+	self->copy = NULL;
+	if (self->edited)
+		app_edited_destroy (self->edited);
+	self->edited = NULL;
+
+	// Further changes have made the results obsolete, so try again
+	if (g.splices_len)
+	{
+		app_lua_forget_decodes (g.lua, self->decodes_len);
+		if (!self->full)
+		{
+			self->dirty_start = self->offset;
+			self->dirty_end = self->offset + self->len;
+		}
+		poller_idle_set (&g.redecode_event);
+		return;
+	}
+
+	if (self->error && self->full)
+		print_error ("decoding failed: %s", self->error);
+	else if (self->error)
+		print_debug ("re-decoding %s at %" PRId64 " failed: %s",
+			self->type, self->offset, self->error);
+
+	// Failed deferred decodes are kept as they are, to be retried later
+	struct app_lua_decode *node = self->node == UINT32_MAX
+		? NULL : &g.lua->decodes[self->node];
+	if (self->error && node && node->deferred)
+	{
+		node->failed = true;
+		app_lua_forget_decodes (g.lua, self->decodes_len);
+		poller_idle_set (&g.redecode_event);
+		return;
+	}
+
+	if (self->full)
+	{
+		self->full = false;
+		if (!g.startup[STARTUP_DECODE].end)
+			g.startup[STARTUP_DECODE].end = app_clock_usec ();
+	}
+	app_redecode_merge (self);
+	app_redecode_reindex ();
+
+	// More deferred decodes may be in view
+	poller_idle_set (&g.redecode_event);
+}
+
+static struct app_redecode *
+app_redecode_get (void)
+{
+	struct app_redecode *self = g.redecode;
+	if (!self)
+	{
+		self = g.redecode = xcalloc (1, sizeof *self);
+		self->timer = poller_timer_make (&g.poller);
+		self->timer.dispatcher = app_on_redecode_timer;
+		self->timer.user_data = self;
+		self->dirty_start = self->dirty_end = -1;
+		ARRAY_INIT (self->marks);
+		self->mark_strings = str_make ();
+	}
+	return self;
+}
+
+static void
+app_redecode_free (void)
+{
+	struct app_redecode *self = g.redecode;
+	if (!self)
+		return;
+
+	if (self->running)
+		app_task_cancel (&self->task);
+	poller_timer_reset (&self->timer);
+	free (self->full_type);
+	free (self->type);
+	free (self->copy);
+	if (self->edited)
+		app_edited_destroy (self->edited);
+	free (self->marks);
+	str_free (&self->mark_strings);
+	free (self->error);
+	free (self);
+	g.redecode = NULL;
+}
+
+static void
+app_on_redecode (void *user_data)
+{
+	(void) user_data;
+	poller_idle_reset (&g.redecode_event);
+
+	// Marks have already been moved, but they need to be laid out again.
+	// Otherwise, this has only been triggered by the view having changed.
+	struct app_redecode *self = app_redecode_get ();
+	if (g.splices_len)
+		app_redecode_reindex ();
+	if (self->running)
+		return;
+
+	for (size_t i = 0; i < g.splices_len; i++)
+		app_redecode_apply (self, &g.splices[i]);
+	g.splices_len = 0;
+	app_redecode_start (self);
+}
+
+/// Decode all of the data in the background, either as the given type,
+/// or autodetecting it
+static void
+app_redecode_everything (const char *type, bool carve)
+{
+	struct app_redecode *self = app_redecode_get ();
+	self->full = true;
+	cstr_set (&self->full_type, type ? xstrdup (type) : NULL);
+	self->carve = carve;
+
+	g.startup[STARTUP_DECODE].start = app_clock_usec ();
+	poller_idle_set (&g.redecode_event);
+}
+
+// --- Batch mode --------------------------------------------------------------
+
+struct app_batch_directory
+{
+	dev_t dev;                          ///< Device of the directory
+	ino_t ino;                          ///< Inode of the directory
 };
 
-// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+struct app_batch
+{
+	struct strv paths;                  ///< Input files
+	/// Directories descended into, so that symlinks cannot form loops
+	ARRAY (struct app_batch_directory, directories)
+	const char *type;                   ///< Forced type, if any
+	int64_t offset;                     ///< Offset within each file
+	int64_t size_limit;                 ///< Size limit for each file
+
+	enum dump_format format;            ///< Output format
+	const char *output_dir;             ///< Per-file outputs go here, if set
+	bool carve;                         ///< Look for embedded objects
+
+	struct app_lua **lua;               ///< Lua states by worker
+	bool *failed;                       ///< Processing failures by job
+};
+
+static int
+app_batch_strcmp (const void *a, const void *b)
+{
+	return strcmp (*(const char **) a, *(const char **) b);
+}
 
+/// Collect input files, descending into directories, in a stable order
 static void
-app_lua_load_plugins (const char *plugin_dir)
+app_batch_collect (struct app_batch *self, const char *path)
 {
-	DIR *dir;
-	if (!(dir = opendir (plugin_dir)))
+	struct stat st = {};
+	if (stat (path, &st))
 	{
-		if (errno != ENOENT)
-			print_error ("cannot open directory `%s': %s",
-				plugin_dir, strerror (errno));
+		print_error ("cannot stat `%s': %s", path, strerror (errno));
+		return;
+	}
+	if (!S_ISDIR (st.st_mode))
+	{
+		strv_append (&self->paths, path);
 		return;
 	}
+	for (size_t i = 0; i < self->directories_len; i++)
+		if (self->directories[i].dev == st.st_dev
+		 && self->directories[i].ino == st.st_ino)
+			return;
 
-	lua_pushcfunction (g.L, app_lua_error_handler);
+	ARRAY_RESERVE (self->directories, 1);
+	self->directories[self->directories_len++] =
+		(struct app_batch_directory) { st.st_dev, st.st_ino };
 
-	struct dirent *iter;
-	while ((errno = 0, iter = readdir (dir)))
+	DIR *dir;
+	if (!(dir = opendir (path)))
 	{
-		const char *dot = strrchr (iter->d_name, '.');
-		if (!dot || strcmp (dot, ".lua"))
-			continue;
-
-		char *path = xstrdup_printf ("%s/%s", plugin_dir, iter->d_name);
-		if (luaL_loadfile (g.L, path)
-		 || lua_pcall (g.L, 0, 0, -2))
-		{
-			print_error ("%s: %s", path, lua_tostring (g.L, -1));
-			lua_pop (g.L, 1);
-		}
-		free (path);
+		print_error ("cannot open directory `%s': %s", path, strerror (errno));
+		return;
 	}
+
+	struct strv children = strv_make ();
+	struct dirent *iter;
+	while ((errno = 0, iter = readdir (dir)))
+		if (strcmp (iter->d_name, ".") && strcmp (iter->d_name, ".."))
+			strv_append_owned (&children,
+				xstrdup_printf ("%s/%s", path, iter->d_name));
 	if (errno)
-		exit_fatal ("readdir: %s", strerror (errno));
+		print_error ("readdir: %s", strerror (errno));
 	closedir (dir);
 
-	lua_pop (g.L, 1);
+	qsort (children.vector, children.len, sizeof *children.vector,
+		app_batch_strcmp);
+	for (size_t i = 0; i < children.len; i++)
+		app_batch_collect (self, children.vector[i]);
+	strv_free (&children);
 }
 
-static void
-app_lua_init (void)
+static FILE *
+app_batch_open_output (struct app_batch *self, const char *path)
 {
-#if LUA_VERSION_NUM >= 505
-	g.L = lua_newstate (app_lua_alloc, NULL, 0);
-#else
-	g.L = lua_newstate (app_lua_alloc, NULL);
-#endif
-	if (!g.L)
-		exit_fatal ("Lua initialization failed");
+	struct str name = str_make ();
+	str_append_printf (&name, "%s/", self->output_dir);
+	while (*path == '/')
+		path++;
+	for (; *path; path++)
+		str_append_c (&name, *path == '/' ? '_' : *path);
+	str_append (&name, self->format == DUMP_JSON ? ".jsonl" : ".tsv");
+
+	FILE *fp = fopen (name.str, "w");
+	if (!fp)
+		print_error ("cannot open `%s': %s", name.str, strerror (errno));
+	str_free (&name);
+	return fp;
+}
 
-	g.coders = str_map_make (app_lua_coder_free);
+static bool
+app_batch_process (struct app_batch *self, struct app_lua *lua,
+	const char *path, struct error **e)
+{
+	int fd = open (path, O_RDONLY);
+	if (fd < 0)
+	{
+		error_set (e, "cannot open: %s", strerror (errno));
+		return false;
+	}
 
-	lua_atpanic (g.L, app_lua_panic);
-	luaL_openlibs (g.L);
-	luaL_checkversion (g.L);
+	struct app_mapping mapping = {};
+	struct str buf = str_make ();
+	bool ok = app_map_file (fd, self->offset, self->size_limit, &mapping)
+		|| app_read_fd (fd, self->offset, self->size_limit, &buf, e);
+	close (fd);
+	if (!ok)
+		goto out;
 
-	// I don't want to reimplement this and the C function is not exported
-	hard_assert (lua_getglobal (g.L, LUA_STRLIBNAME));
-	hard_assert (lua_getfield (g.L, -1, "format"));
-	g.ref_format = luaL_ref (g.L, LUA_REGISTRYINDEX);
+	struct app_dump dump =
+		{ .format = self->format, .fp = stdout, .buf = str_make () };
+	if (self->output_dir)
+	{
+		if (!(dump.fp = app_batch_open_output (self, path)))
+			ok = false;
+	}
+	else
+		dump.filename = path;
+
+	lua->data = mapping.address ? mapping.data : (uint8_t *) buf.str;
+	lua->data_len = mapping.address ? mapping.data_len : (int64_t) buf.len;
+	lua->data_offset = self->offset;
+	lua->on_mark = app_dump_mark;
+	lua->user_data = &dump;
+
+	if (ok)
+		ok = app_lua_decode_data (lua, self->type, e);
+	if (ok && self->carve)
+		app_lua_carve (lua, 1);
+	if (ok)
+		ok = app_lua_decode_deferred (lua, e);
+	if (dump.fp && dump.fp != stdout && fclose (dump.fp))
+		print_error ("%s: %s", path, strerror (errno));
+	str_free (&dump.buf);
+
+	lua->data = NULL;
+	lua->data_len = 0;
+out:
+	if (mapping.address)
+		munmap (mapping.address, mapping.len);
+	str_free (&buf);
+	return ok;
+}
 
-	luaL_newlib (g.L, app_lua_library);
-	lua_setglobal (g.L, PROGRAM_NAME);
+static void
+app_batch_execute (struct app_task *task, size_t worker, size_t job)
+{
+	struct app_batch *self = task->user_data;
 
-	luaL_newmetatable (g.L, XLUA_CHUNK_METATABLE);
-	luaL_setfuncs (g.L, app_lua_chunk_table, 0);
-	lua_pop (g.L, 1);
+	// Each worker gets its own Lua state, which is then reused for all files
+	struct app_lua **lua = &self->lua[worker];
+	if (!*lua)
+		*lua = app_lua_new (false);
 
-	struct strv v = strv_make ();
-	get_xdg_data_dirs (&v);
-	for (size_t i = 0; i < v.len; i++)
+	struct error *e = NULL;
+	const char *path = self->paths.vector[job];
+	if (!app_batch_process (self, *lua, path, &e))
 	{
-		char *path = xstrdup_printf
-			("%s/%s", v.vector[i], PROGRAM_NAME "/plugins");
-		app_lua_load_plugins (path);
-		free (path);
+		self->failed[job] = true;
+		if (e)
+		{
+			print_error ("%s: %s", path, e->message);
+			error_free (e);
+		}
 	}
-	strv_free (&v);
+}
+
+/// Decode all the given files in parallel, returning false on any failure
+static bool
+app_batch_run (struct app_batch *self, size_t threads)
+{
+	self->lua = xcalloc (threads, sizeof *self->lua);
+	self->failed = xcalloc (self->paths.len, sizeof *self->failed);
+
+	// The main thread's Lua state has already been loaded, make use of it
+	self->lua[0] = g.lua;
+
+	struct app_task task =
+		{ .execute = app_batch_execute, .user_data = self };
+	app_task_start (&task, self->paths.len, threads);
+	app_task_wait (&task);
+
+	for (size_t i = 1; i < threads; i++)
+		if (self->lua[i])
+			app_lua_destroy (self->lua[i]);
+	free (self->lua);
+
+	bool ok = true;
+	for (size_t i = 0; i < self->paths.len; i++)
+		ok &= !self->failed[i];
+	free (self->failed);
+
+	if (fflush (stdout))
+		exit_fatal ("cannot write output: %s", strerror (errno));
+	return ok;
 }
 
 #endif // WITH_LUA
 
 // --- Actions -----------------------------------------------------------------
 
-/// Checks what items are visible and returns if fixes were needed
 static bool
-app_fix_view_range (void)
+app_jump_to_marks (ssize_t i)
 {
-	int64_t data_view_start = g.data_offset / ROW_SIZE * ROW_SIZE;
-	if (g.view_top < data_view_start)
-	{
-		g.view_top = data_view_start;
-		xui_invalidate ();
+	if (i < 0 || (size_t) i >= g.marks_by_offset_len)
 		return false;
-	}
 
-	// If the contents are at least as long as the screen, always fill it
-	int64_t last_byte = g.data_offset + g.data_len - 1;
-	int64_t max_view_top =
-		(last_byte / ROW_SIZE - app_visible_rows () + 1) * ROW_SIZE;
-	// But don't let that suggest a negative offset
-	max_view_top = MAX (max_view_top, 0);
+	g.view_cursor = g.marks_by_offset[i].offset;
+	g.view_skip_nibble = false;
+	xui_invalidate ();
+	app_ensure_selection_visible ();
+	return true;
+}
 
-	if (g.view_top > max_view_top)
+static void
+app_jump_to (int64_t offset)
+{
+	g.view_cursor = offset;
+	g.view_skip_nibble = false;
+	xui_invalidate ();
+	app_ensure_selection_visible ();
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+/// Move the cursor to the closest match in the given direction, wrapping
+/// around.  Returns false if that can't be decided until more data is searched.
+static bool
+app_search_step (struct app_search *self, bool forward)
+{
+	int64_t cursor = g.view_cursor - g.data_offset;
+	int64_t known = self->running
+		? (int64_t) self->chunks_merged * SEARCH_CHUNK : self->data_len;
+
+	int64_t target = -1;
+	bool wrapped = false;
+	if (forward)
 	{
-		g.view_top = max_view_top;
-		xui_invalidate ();
-		return false;
+		size_t i = app_search_lower_bound (self, cursor + 1);
+		if (i < self->matches_len)
+			target = self->matches[i];
+		else if (self->running)
+			return false;
+		else if ((wrapped = self->matches_len))
+			target = self->matches[0];
+	}
+	else
+	{
+		size_t i = app_search_lower_bound (self, cursor);
+		if (known < cursor)
+			return false;
+		if (i)
+			target = self->matches[i - 1];
+		else if (self->running)
+			return false;
+		else if ((wrapped = self->matches_len))
+			target = self->matches[self->matches_len - 1];
+	}
+
+	if (target < 0)
+		print_status ("Pattern not found");
+	else
+	{
+		app_jump_to (g.data_offset + target);
+		if (wrapped)
+			print_status ("Search wrapped around");
 	}
 	return true;
 }
 
-/// Scroll down (positive) or up (negative) @a n items
-static bool
-app_scroll (int n)
+/// Jump in the given direction now, or as soon as it becomes possible
+static void
+app_search_jump (struct app_search *self, bool forward)
 {
-	g.view_top += n * ROW_SIZE;
-	xui_invalidate ();
-	return app_fix_view_range ();
+	self->pending = false;
+	if (!app_search_step (self, forward))
+	{
+		self->pending = true;
+		self->pending_forward = forward;
+	}
 }
 
 static void
-app_ensure_selection_visible (void)
+app_on_search_timer (void *user_data)
 {
-	int too_high = g.view_top / ROW_SIZE - g.view_cursor / ROW_SIZE;
-	if (too_high > 0)
-		app_scroll (-too_high);
+	struct app_search *self = user_data;
+	bool finished = app_task_jobs_done (&self->task) == self->chunks_len;
+	size_t matches_len = self->matches_len;
+	app_search_merge (self);
+	if (self->matches_len != matches_len)
+		g.generation++;
+
+	if (finished)
+	{
+		app_task_wait (&self->task);
+		self->running = false;
+	}
+	else
+		poller_timer_set (&self->timer, SEARCH_POLL_MS);
 
-	int too_low = g.view_cursor / ROW_SIZE - g.view_top / ROW_SIZE
-		- app_visible_rows () + 1;
-	if (too_low > 0)
-		app_scroll (too_low);
+	if (self->pending)
+		app_search_jump (self, self->pending_forward);
+	xui_invalidate ();
 }
 
-static bool
-app_move_cursor_by_rows (int diff)
+/// Replace the last search with a new one, and start running it
+static void
+app_search_start (struct app_search *self, bool forward)
 {
-	// TODO: disallow partial up/down movement
-	int64_t fixed = g.view_cursor += diff * ROW_SIZE;
-	fixed = MAX (fixed, g.data_offset);
-	fixed = MIN (fixed, g.data_offset + g.data_len - 1);
+	if (g.search)
+		app_search_free (g.search);
 
-	bool result = g.view_cursor == fixed;
-	g.view_cursor = fixed;
-	xui_invalidate ();
+	g.search = self;
+	g.generation++;
+	self->forward = forward;
 
-	app_ensure_selection_visible ();
-	return result;
+	self->timer.dispatcher = app_on_search_timer;
+	self->timer.user_data = self;
+
+	if (self->chunks_len)
+	{
+		self->task.execute = app_search_execute;
+		self->task.user_data = self;
+		app_task_start (&self->task, self->chunks_len, app_cpu_count ());
+		self->running = true;
+		poller_timer_set (&self->timer, SEARCH_POLL_MS);
+	}
+	app_search_jump (self, forward);
 }
 
+/// Parse a value search query, such as "u32 0x1f400" or "f64 3.14 0.01",
+/// into needles for both endianities, or a float with a tolerance
 static bool
-app_jump_to_marks (ssize_t i)
+app_search_parse_value (struct app_search *self, const char *query)
 {
-	if (i < 0 || (size_t) i >= g.marks_by_offset_len)
+	char type = 0, *end = NULL;
+	int bits = 0, n = 0;
+	if (sscanf (query, " %c%d %n", &type, &bits, &n) < 2 || !n
+	 || (bits != 8 && bits != 16 && bits != 32 && bits != 64))
 		return false;
 
-	g.view_cursor = g.marks_by_offset[i].offset;
-	g.view_skip_nibble = false;
-	xui_invalidate ();
-	app_ensure_selection_visible ();
+	const char *value = query + n;
+	self->match_len = bits / 8;
+	errno = 0;
+	if (type == 'f')
+	{
+		self->value = strtod (value, &end);
+		self->tolerance = fabs (self->value) * 1e-6;
+		if (end != value && *end)
+			self->tolerance = strtod (end, &end);
+		return !errno && end != value && !*end && bits >= 32
+			&& self->tolerance >= 0;
+	}
+
+	uint64_t u = 0;
+	if (type == 'u' && *value != '-')
+	{
+		u = strtoull (value, &end, 0);
+		if (bits < 64 && u >> bits)
+			return false;
+	}
+	else if (type == 's')
+	{
+		int64_t i = strtoll (value, &end, 0);
+		if (bits < 64 && (i < -(INT64_C (1) << (bits - 1))
+		 || i >= INT64_C (1) << (bits - 1)))
+			return false;
+		u = i;
+	}
+	else
+		return false;
+	if (errno || end == value || *end)
+		return false;
+
+	// The inverse of app_decode(), for both endianities
+	for (int i = 0; i < self->match_len; i++)
+		str_append_c (&self->needles[0], u >> (8 * i));
+	for (int i = self->match_len; i--; )
+		str_append_c (&self->needles[1], u >> (8 * i));
+	self->needles_len = memcmp (self->needles[0].str,
+		self->needles[1].str, self->match_len) ? 2 : 1;
 	return true;
 }
 
+static void
+app_search_submit (void)
+{
+	// An empty pattern repeats the last search, possibly reversing it
+	bool forward = g.prompt != '?';
+	if (!g.prompt_text.len)
+	{
+		if (g.search)
+		{
+			g.search->forward = forward;
+			app_search_jump (g.search, forward);
+		}
+		return;
+	}
+
+	struct app_search *self = app_search_new ();
+	bool ok = true;
+	if (g.prompt == '=')
+	{
+		if (!(ok = app_search_parse_value (self, g.prompt_text.str)))
+			print_error ("invalid value, use e.g. u32 1234 or f64 3.14 0.01");
+	}
+	else if (g.prompt_hex && !(ok = app_decode_hex (g.prompt_text.str,
+		&self->needles[0]) && self->needles[0].len))
+		print_error ("invalid hex byte string");
+	else if (!g.prompt_hex)
+		str_append_str (&self->needles[0], &g.prompt_text);
+
+	if (g.prompt != '=')
+	{
+		self->needles_len = 1;
+		self->match_len = self->needles[0].len;
+	}
+	if (ok)
+		app_search_start (self, forward);
+	else
+		app_search_free (self);
+}
+
+static void
+app_extract_submit (void)
+{
+	int64_t start = 0, end = 0;
+	if (!g.prompt_text.len)
+		print_error ("no file name given");
+	else if (!app_extract_range (&start, &end))
+		print_error ("nothing to extract");
+	else
+	{
+		struct error *e = NULL;
+		if (!app_extract (g.prompt_text.str,
+			start - g.data_offset, end - start, &e))
+		{
+			print_error ("extraction failed: %s", e->message);
+			error_free (e);
+		}
+		else
+		{
+			print_status ("Extracted %" PRId64 " bytes", end - start);
+			g.view_anchor = -1;
+		}
+	}
+}
+
 // --- User input handling -----------------------------------------------------
 
 enum action
@@ -1374,6 +7370,13 @@ enum action
 	ACTION_ROW_START, ACTION_ROW_END,
 	ACTION_FIELD_PREVIOUS, ACTION_FIELD_NEXT,
 
+	ACTION_SEARCH_FORWARD, ACTION_SEARCH_BACKWARD, ACTION_SEARCH_VALUE,
+	ACTION_SEARCH_NEXT, ACTION_SEARCH_PREVIOUS, ACTION_FIND_FIELD,
+	ACTION_DIFF_NEXT, ACTION_DIFF_PREVIOUS,
+	ACTION_EDIT_REPLACE, ACTION_EDIT_INSERT, ACTION_DELETE,
+	ACTION_UNDO, ACTION_REDO, ACTION_SAVE,
+	ACTION_SELECT, ACTION_EXTRACT, ACTION_TOGGLE_MEMORY,
+
 	ACTION_COUNT
 };
 
@@ -1382,11 +7385,15 @@ enum action
 static bool
 app_process_action (enum action action)
 {
+	if (action != ACTION_SCROLL_UP && action != ACTION_SCROLL_DOWN
+	 && action != ACTION_UP && action != ACTION_DOWN)
+		app_flush_movement ();
+
 	switch (action)
 	{
 		// XXX: these should rather be parametrized
-	case ACTION_SCROLL_UP:   app_scroll (-1); break;
-	case ACTION_SCROLL_DOWN: app_scroll  (1); break;
+	case ACTION_SCROLL_UP:   app_hold_movement (&g.pending_scroll, -1); break;
+	case ACTION_SCROLL_DOWN: app_hold_movement (&g.pending_scroll,  1); break;
 
 	case ACTION_GOTO_TOP:
 		g.view_cursor = g.data_offset;
@@ -1413,8 +7420,8 @@ app_process_action (enum action action)
 		app_move_cursor_by_rows (app_visible_rows ());
 		break;
 
-	case ACTION_UP:   app_move_cursor_by_rows (-1); break;
-	case ACTION_DOWN: app_move_cursor_by_rows  (1); break;
+	case ACTION_UP:   app_hold_movement (&g.pending_rows, -1); break;
+	case ACTION_DOWN: app_hold_movement (&g.pending_rows,  1); break;
 
 	case ACTION_LEFT:
 		if (g.view_skip_nibble)
@@ -1462,22 +7469,133 @@ app_process_action (enum action action)
 		new = MAX (new, g.data_offset);
 		new = MIN (new, g.data_offset + g.data_len - 1);
 
-		g.view_cursor = new;
-		g.view_skip_nibble = false;
+		g.view_cursor = new;
+		g.view_skip_nibble = false;
+		xui_invalidate ();
+		break;
+	}
+
+	case ACTION_FIELD_PREVIOUS:
+	{
+		ssize_t i = app_find_marks (g.view_cursor);
+		if (i >= 0 && (size_t) i < g.marks_by_offset_len
+		 && g.marks_by_offset[i].offset == g.view_cursor)
+			i--;
+		return app_jump_to_marks (i);
+	}
+	case ACTION_FIELD_NEXT:
+		return app_jump_to_marks (app_find_marks (g.view_cursor) + 1);
+
+	case ACTION_SEARCH_FORWARD:
+		g.prompt = '/';
+		str_reset (&g.prompt_text);
+		xui_invalidate ();
+		break;
+	case ACTION_SEARCH_BACKWARD:
+		g.prompt = '?';
+		str_reset (&g.prompt_text);
+		xui_invalidate ();
+		break;
+	case ACTION_SEARCH_VALUE:
+		g.prompt = '=';
+		str_reset (&g.prompt_text);
+		xui_invalidate ();
+		break;
+	case ACTION_EDIT_REPLACE:
+		if (!g.data_len)
+			return false;
+
+		g.edit_mode = EDIT_REPLACE;
+		xui_invalidate ();
+		break;
+	case ACTION_EDIT_INSERT:
+		g.edit_mode = EDIT_INSERT;
+		g.view_skip_nibble = false;
+		xui_invalidate ();
+		break;
+	case ACTION_DELETE:
+		if (g.view_cursor < g.data_offset
+		 || g.view_cursor >= g.data_offset + g.data_len)
+			return false;
+
+		app_edit (g.view_cursor - g.data_offset, 1, NULL, 0);
+		app_jump_to (MAX (g.data_offset,
+			MIN (g.view_cursor, g.data_offset + g.data_len - 1)));
+		break;
+	case ACTION_UNDO:
+	case ACTION_REDO:
+	{
+		int64_t offset = app_edit_undo (action == ACTION_REDO);
+		if (offset < 0)
+			return false;
+
+		app_jump_to (MAX (g.data_offset,
+			MIN (g.data_offset + offset, g.data_offset + g.data_len - 1)));
+		break;
+	}
+	case ACTION_SAVE:
+	{
+		struct error *e = NULL;
+		if (!app_save (&e))
+		{
+			print_error ("saving failed: %s", e->message);
+			error_free (e);
+		}
+		else
+			print_status ("Saved");
+		xui_invalidate ();
+		break;
+	}
+	case ACTION_SELECT:
+		g.view_anchor = g.view_anchor < 0 ? g.view_cursor : -1;
+		xui_invalidate ();
+		break;
+	case ACTION_TOGGLE_MEMORY:
+		if (!g_debug_mode)
+			return false;
+
+		g.memory_overlay = !g.memory_overlay;
+		xui_invalidate ();
+		break;
+	case ACTION_EXTRACT:
+	{
+		int64_t start = 0, end = 0;
+		if (!app_extract_range (&start, &end))
+			return false;
+
+		g.prompt = 'e';
+		str_reset (&g.prompt_text);
 		xui_invalidate ();
 		break;
 	}
 
-	case ACTION_FIELD_PREVIOUS:
+	case ACTION_DIFF_NEXT:
+	case ACTION_DIFF_PREVIOUS:
 	{
-		ssize_t i = app_find_marks (g.view_cursor);
-		if (i >= 0 && (size_t) i < g.marks_by_offset_len
-		 && g.marks_by_offset[i].offset == g.view_cursor)
-			i--;
-		return app_jump_to_marks (i);
+		int64_t target = app_diff_find (action == ACTION_DIFF_NEXT);
+		if (target < 0)
+			return false;
+
+		app_jump_to (target);
+		break;
 	}
-	case ACTION_FIELD_NEXT:
-		return app_jump_to_marks (app_find_marks (g.view_cursor) + 1);
+	case ACTION_FIND_FIELD:
+		if (!g.marks_len)
+			return false;
+
+		g.prompt = 'f';
+		str_reset (&g.prompt_text);
+		app_field_filter ("", app_visible_rows ());
+		xui_invalidate ();
+		break;
+	case ACTION_SEARCH_NEXT:
+	case ACTION_SEARCH_PREVIOUS:
+		if (!g.search)
+			return false;
+
+		app_search_jump (g.search,
+			g.search->forward == (action == ACTION_SEARCH_NEXT));
+		break;
 
 	case ACTION_QUIT:
 		app_quit ();
@@ -1501,11 +7619,34 @@ app_process_action (enum action action)
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 
+static bool
+app_process_overview_click (int y)
+{
+	int rows = app_visible_rows ();
+	if (!g.overview || !rows)
+		return false;
+
+	size_t from = 0, to = 0;
+	app_overview_segment (y, rows, &from, &to);
+	int64_t target = g.data_offset + from * g.overview->block_size;
+	if (target >= g.data_offset + g.data_len)
+		return false;
+
+	g.view_cursor = target;
+	g.view_skip_nibble = false;
+	g.view_top = target / ROW_SIZE * ROW_SIZE;
+	app_fix_view_range ();
+	xui_invalidate ();
+	return true;
+}
+
 static bool
 app_process_left_mouse_click (struct widget *w, int x, int y)
 {
 	if (w->widget_id == WIDGET_ENDIANITY)
 		return app_process_action (ACTION_TOGGLE_ENDIANITY);
+	if (w->widget_id == WIDGET_OVERVIEW)
+		return app_process_overview_click (w->userdata);
 
 	// XXX: This is really ugly.
 	x = x / g.digitw - 2;
@@ -1548,11 +7689,35 @@ app_find_widget (struct widget *list, int x, int y)
 	return target;
 }
 
+enum { INPUT_COALESCE_USEC = 50000 };
+
+/// Pull in any input that has already arrived, so that the UI library handles
+/// whole bursts of key repeats before laying out once, rather than after each
+/// read from a slow link.  A deadline keeps it from lagging behind the keys.
+static void
+app_coalesce_input (void)
+{
+	int fd = g_xui.tk ? termo_get_fd (g_xui.tk) : -1;
+	if (fd < 0)
+		return;
+
+	int64_t now = app_clock_usec ();
+	if (!g.input_deadline)
+		g.input_deadline = now + INPUT_COALESCE_USEC;
+	if (now >= g.input_deadline)
+		return;
+
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	if (poll (&pfd, 1, 0) > 0 && (pfd.revents & POLLIN))
+		termo_advisereadable (g_xui.tk);
+}
+
 static bool
 app_process_mouse (termo_mouse_event_t type, int x, int y, int button,
 	int modifiers)
 {
 	(void) modifiers;
+	app_coalesce_input ();
 
 	// TODO: when holding a mouse button over a mark string,
 	//   go to a locked mode that highlights that entire mark
@@ -1564,6 +7729,7 @@ app_process_mouse (termo_mouse_event_t type, int x, int y, int button,
 	if (button == 5)
 		return app_process_action (ACTION_SCROLL_DOWN);
 
+	app_flush_movement ();
 	struct widget *target = app_find_widget (g_xui.widgets, x, y);
 	if (!target)
 		return false;
@@ -1621,6 +7787,24 @@ g_default_bindings[] =
 
 	{ "C-y",        ACTION_SCROLL_UP,          {}},
 	{ "C-e",        ACTION_SCROLL_DOWN,        {}},
+
+	{ "/",          ACTION_SEARCH_FORWARD,     {}},
+	{ "?",          ACTION_SEARCH_BACKWARD,    {}},
+	{ "=",          ACTION_SEARCH_VALUE,       {}},
+	{ "n",          ACTION_SEARCH_NEXT,        {}},
+	{ "N",          ACTION_SEARCH_PREVIOUS,    {}},
+	{ "f",          ACTION_FIND_FIELD,         {}},
+	{ "]",          ACTION_DIFF_NEXT,          {}},
+	{ "R",          ACTION_EDIT_REPLACE,       {}},
+	{ "i",          ACTION_EDIT_INSERT,        {}},
+	{ "x",          ACTION_DELETE,             {}},
+	{ "u",          ACTION_UNDO,               {}},
+	{ "C-r",        ACTION_REDO,               {}},
+	{ "W",          ACTION_SAVE,               {}},
+	{ "v",          ACTION_SELECT,             {}},
+	{ "e",          ACTION_EXTRACT,            {}},
+	{ "M",          ACTION_TOGGLE_MEMORY,      {}},
+	{ "[",          ACTION_DIFF_PREVIOUS,      {}},
 };
 
 static int
@@ -1643,19 +7827,371 @@ app_init_bindings (void)
 		sizeof *g_default_bindings, app_binding_cmp);
 }
 
+/// The field prompt filters marks as it is being typed into,
+/// and the arrow keys select among the results
+static bool
+app_process_field_prompt_event (termo_key_t *event)
+{
+	if (event->type != TERMO_TYPE_KEYSYM || event->modifiers)
+		return false;
+
+	switch (event->code.sym)
+	{
+	case TERMO_SYM_UP:
+		if (!g.field_selected)
+			return false;
+		g.field_selected--;
+		return true;
+	case TERMO_SYM_DOWN:
+		if (g.field_selected + 1 >= g.field_results_len)
+			return false;
+		g.field_selected++;
+		return true;
+	case TERMO_SYM_ENTER:
+		if (g.field_results_len)
+			app_jump_to (g.marks[g.field_results[g.field_selected]].offset);
+		g.prompt = 0;
+		return true;
+	default:
+		return false;
+	}
+}
+
+/// The search prompt is a trivial line editor, Tab switches it between
+/// looking for text and for hex byte strings
+static bool
+app_process_prompt_event (termo_key_t *event)
+{
+	xui_invalidate ();
+	if (g.prompt == 'f' && app_process_field_prompt_event (event))
+		return true;
+	if (event->type == TERMO_TYPE_KEY && !event->modifiers)
+	{
+		str_append (&g.prompt_text, event->multibyte);
+		if (g.prompt == 'f')
+			app_field_filter (g.prompt_text.str, app_visible_rows ());
+		return true;
+	}
+	if (event->type != TERMO_TYPE_KEYSYM || event->modifiers)
+		return false;
+
+	switch (event->code.sym)
+	{
+	case TERMO_SYM_ESCAPE:
+		g.prompt = 0;
+		break;
+	case TERMO_SYM_ENTER:
+		if (g.prompt == 'e')
+			app_extract_submit ();
+		else
+			app_search_submit ();
+		g.prompt = 0;
+		break;
+	case TERMO_SYM_TAB:
+		if (g.prompt == '=' || g.prompt == 'f' || g.prompt == 'e')
+			return false;
+		g.prompt_hex = !g.prompt_hex;
+		break;
+	case TERMO_SYM_BACKSPACE:
+	case TERMO_SYM_DEL:
+	{
+		// Remove a whole UTF-8 sequence, the locale is likely to be UTF-8
+		struct str *s = &g.prompt_text;
+		while (s->len && (s->str[s->len - 1] & 0xC0) == 0x80)
+			s->len--;
+		if (s->len)
+			s->len--;
+		s->str[s->len] = '\0';
+		if (g.prompt == 'f')
+			app_field_filter (s->str, app_visible_rows ());
+		break;
+	}
+	default:
+		return false;
+	}
+	return true;
+}
+
+/// Overwrite or insert a nibble at the cursor, and move past it
+static bool
+app_edit_nibble (int digit)
+{
+	int64_t offset = g.view_cursor - g.data_offset;
+	if (offset < 0 || offset > g.data_len)
+		return false;
+
+	// Inserting starts with the high nibble of a new byte
+	uint8_t byte = 0;
+	bool insert = g.edit_mode == EDIT_INSERT && !g.view_skip_nibble;
+	if (!insert && !app_edit_read (offset, &byte, 1))
+		return false;
+
+	if (g.view_skip_nibble)
+		byte = (byte & 0xf0) | digit;
+	else
+		byte = (byte & 0x0f) | digit << 4;
+	app_edit (offset, !insert, &byte, 1);
+
+	// Only inserting may move the cursor past the end, so as to append
+	if (!g.view_skip_nibble)
+		g.view_skip_nibble = true;
+	else if (offset + 1 < g.data_len || g.edit_mode == EDIT_INSERT)
+	{
+		g.view_cursor++;
+		g.view_skip_nibble = false;
+	}
+	app_ensure_selection_visible ();
+	xui_invalidate ();
+	return true;
+}
+
+static bool
+app_process_edit_event (termo_key_t *event)
+{
+	if (event->type == TERMO_TYPE_KEY && !event->modifiers
+	 && event->code.codepoint < 128
+	 && isxdigit_ascii (event->code.codepoint))
+	{
+		const char *digits = "0123456789abcdef";
+		return app_edit_nibble (strchr (digits,
+			tolower_ascii (event->code.codepoint)) - digits);
+	}
+	if (event->type != TERMO_TYPE_KEYSYM || event->modifiers)
+		return false;
+
+	int64_t offset = g.view_cursor - g.data_offset;
+	switch (event->code.sym)
+	{
+	case TERMO_SYM_ESCAPE:
+		g.edit_mode = EDIT_NONE;
+		app_jump_to (MAX (g.data_offset,
+			MIN (g.view_cursor, g.data_offset + g.data_len - 1)));
+		return true;
+	case TERMO_SYM_BACKSPACE:
+		if (g.edit_mode != EDIT_INSERT || offset <= 0)
+			return false;
+
+		app_edit (offset - 1, 1, NULL, 0);
+		app_jump_to (g.view_cursor - 1);
+		return true;
+	default:
+		return false;
+	}
+}
+
 static bool
 app_process_termo_event (termo_key_t *event)
 {
+	app_coalesce_input ();
+	if (g.edit_mode || g.prompt)
+		app_flush_movement ();
+	if (g.edit_mode && event->type != TERMO_TYPE_FOCUS
+	 && app_process_edit_event (event))
+		return true;
+
+	if (g.prompt && event->type != TERMO_TYPE_FOCUS)
+		return app_process_prompt_event (event);
+
 	struct binding dummy = { NULL, 0, *event }, *binding =
 		bsearch (&dummy, g_default_bindings, N_ELEMENTS (g_default_bindings),
 			sizeof *g_default_bindings, app_binding_cmp);
 	if (binding)
 		return app_process_action (binding->action);
-
-	// TODO: once we become an editor, use 0-9 a-f to overwrite nibbles
 	return event->type == TERMO_TYPE_FOCUS;
 }
 
+// --- Frame timing ------------------------------------------------------------
+
+// The UI library renders the widget tree right after calling app_layout(),
+// so to measure that as well, we wrap its render function.
+
+enum
+{
+	REPLAY_ROWS = 50,                   ///< Height of the replay terminal
+	REPLAY_COLS = 120                   ///< Width of the replay terminal
+};
+
+static void
+app_render_timed (void)
+{
+	int64_t start = app_clock_usec ();
+	g.real_ui->render ();
+	g.frame.render_usec = app_clock_usec () - start;
+	g.last_frame = g.frame;
+
+	if (g.replay)
+	{
+		ARRAY_RESERVE (g.frames, 1);
+		g.frames[g.frames_len++] = g.frame;
+		poller_idle_set (&g.replay_event);
+	}
+}
+
+static void
+app_on_replay (void *user_data)
+{
+	(void) user_data;
+	poller_idle_reset (&g.replay_event);
+
+	const char *p = g.replay + strspn (g.replay, " ");
+	size_t len = strcspn (p, " ");
+	if (!len)
+	{
+		g.polling = false;
+		return;
+	}
+
+	char *name = xstrndup (p, len);
+	g.replay = p + len;
+
+	termo_key_t event;
+	const char *end = termo_strpkey_utf8 (g_xui.tk,
+		name, &event, TERMO_FORMAT_ALTISMETA);
+	if (!end || *end)
+	{
+		print_error ("cannot replay key: %s", name);
+		g.polling = false;
+	}
+	else
+		app_process_termo_event (&event);
+	free (name);
+
+	// Each key produces a frame, even if it changes nothing
+	xui_invalidate ();
+}
+
+static void *
+app_pty_drain (void *user_data)
+{
+	int fd = (intptr_t) user_data;
+	char buf[8192];
+	ssize_t n;
+	while ((n = read (fd, buf, sizeof buf)) > 0 || (n < 0 && errno == EINTR))
+		;
+	return NULL;
+}
+
+/// Replace standard input and output with a pseudoterminal of our own,
+/// so that frame times depend neither on a terminal, nor on its size
+static bool
+app_private_pty (unsigned short rows, unsigned short cols, struct error **e)
+{
+	int master = posix_openpt (O_RDWR | O_NOCTTY), slave = -1;
+	if (master < 0 || grantpt (master) || unlockpt (master)
+	 || (slave = open (ptsname (master), O_RDWR | O_NOCTTY)) < 0)
+	{
+		error_set (e, "cannot open a pseudoterminal: %s", strerror (errno));
+		if (master >= 0)
+			close (master);
+		return false;
+	}
+
+	struct winsize size = { .ws_row = rows, .ws_col = cols };
+	(void) ioctl (slave, TIOCSWINSZ, &size);
+	fflush (stdout);
+	if (dup2 (slave, STDIN_FILENO) < 0 || dup2 (slave, STDOUT_FILENO) < 0)
+		exit_fatal ("dup2: %s", strerror (errno));
+	close (slave);
+
+	// Leave all signal handling to the main thread
+	sigset_t all, old;
+	sigfillset (&all);
+	pthread_sigmask (SIG_BLOCK, &all, &old);
+	pthread_t drain;
+	int err = pthread_create
+		(&drain, NULL, app_pty_drain, (void *) (intptr_t) master);
+	if (err)
+		exit_fatal ("%s: %s", "pthread_create", strerror (err));
+	pthread_detach (drain);
+	pthread_sigmask (SIG_SETMASK, &old, NULL);
+	return true;
+}
+
+static void
+app_frame_timing_start (void)
+{
+	g.real_ui = g_xui.ui;
+	g.timed_ui = *g.real_ui;
+	g.timed_ui.render = app_render_timed;
+	g_xui.ui = &g.timed_ui;
+
+	g.replay_event = poller_idle_make (&g.poller);
+	g.replay_event.dispatcher = app_on_replay;
+}
+
+static void
+app_frame_timing_stop (void)
+{
+	g_xui.ui = g.real_ui;
+	poller_idle_reset (&g.replay_event);
+}
+
+static void
+app_report_frame_metric (const char *name, int64_t *values, size_t len)
+{
+	qsort (values, len, sizeof *values, app_int64_cmp);
+	printf ("%-8s", name);
+
+	static const int percentiles[] = { 50, 90, 99, 100 };
+	for (size_t i = 0; i < N_ELEMENTS (percentiles); i++)
+	{
+		int64_t value = values[(len - 1) * percentiles[i] / 100];
+		printf ("  p%-3d %8.3f ms", percentiles[i], value / 1000.);
+	}
+	printf ("\n");
+}
+
+/// Log when each phase of starting up began and ended, relative to the start
+static void
+app_report_startup (void)
+{
+	static const char *names[STARTUP_COUNT] =
+		{ "plugins", "read", "ui", "decode" };
+	for (int i = 0; i < STARTUP_COUNT; i++)
+	{
+		const struct app_phase *phase = &g.startup[i];
+		if (!phase->start)
+			continue;
+		if (!phase->end)
+			print_debug ("startup: %-7s %9.1f ms, unfinished", names[i],
+				(phase->start - g.started) / 1000.);
+		else
+			print_debug ("startup: %-7s %9.1f ms to %9.1f ms", names[i],
+				(phase->start - g.started) / 1000.,
+				(phase->end - g.started) / 1000.);
+	}
+}
+
+/// Print percentiles of frame times recorded while replaying
+static void
+app_report_frames (void)
+{
+	if (!g.frames_len)
+		return;
+
+	int64_t *layout = xcalloc (g.frames_len, sizeof *layout);
+	int64_t *render = xcalloc (g.frames_len, sizeof *render);
+	int64_t *total = xcalloc (g.frames_len, sizeof *total);
+	uint64_t widgets = 0;
+	for (size_t i = 0; i < g.frames_len; i++)
+	{
+		layout[i] = g.frames[i].layout_usec;
+		render[i] = g.frames[i].render_usec;
+		total[i] = layout[i] + render[i];
+		widgets += g.frames[i].widgets;
+	}
+
+	printf ("%zu frames at %dx%d, %" PRIu64 " widgets on average\n",
+		g.frames_len, g_xui.width, g_xui.height, widgets / g.frames_len);
+	app_report_frame_metric ("layout", layout, g.frames_len);
+	app_report_frame_metric ("render", render, g.frames_len);
+	app_report_frame_metric ("total", total, g.frames_len);
+
+	free (layout);
+	free (render);
+	free (total);
+}
+
 // --- Signals -----------------------------------------------------------------
 
 static int g_signal_pipe[2];            ///< A pipe used to signal... signals
@@ -1776,6 +8312,20 @@ app_log_handler (void *user_data, const char *quote, const char *fmt,
 {
 	(void) user_data;
 
+	// Worker threads may only write directly to the standard error output
+	if (!pthread_equal (pthread_self (), g.main_thread))
+	{
+		if (g_debug_mode && !isatty (STDERR_FILENO))
+		{
+			struct str message = str_make ();
+			str_append (&message, quote);
+			str_append_vprintf (&message, fmt, ap);
+			fprintf (stderr, "%s\n", message.str);
+			str_free (&message);
+		}
+		return;
+	}
+
 	// We certainly don't want to end up in a possibly infinite recursion
 	static bool in_processing;
 	if (in_processing)
@@ -1814,6 +8364,11 @@ app_init_poller_events (void)
 
 	g.message_timer = poller_timer_make (&g.poller);
 	g.message_timer.dispatcher = app_on_message_timer;
+
+#ifdef WITH_LUA
+	g.redecode_event = poller_idle_make (&g.poller);
+	g.redecode_event.dispatcher = app_on_redecode;
+#endif // WITH_LUA
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -1847,6 +8402,17 @@ decode_size (const char *s, int64_t *out)
 	return true;
 }
 
+/// Map regular files in directly, so that the page cache is the only copy
+static void
+app_load_data (int input_fd, int64_t size_limit)
+{
+	app_load (input_fd, g.data_offset, size_limit, &g.mapping,
+		&g.data, &g.data_len);
+	g.original_len = g.saved_len = g.data_len;
+	app_memory_set (MEMORY_DATA,
+		g.mapping.address ? g.mapping.len : (size_t) g.data_len, 1);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -1858,20 +8424,35 @@ main (int argc, char *argv[])
 #endif  // WITH_X11
 		{ 'h', "help", NULL, 0, "display this help and exit" },
 		{ 'V', "version", NULL, 0, "output version information and exit" },
+		{ 'R', "replay", "KEYS", 0, "replay keys, then report frame times" },
+		{ 'S', "stats", NULL, 0, "report memory use on exit" },
 
 		{ 'o', "offset", "OFFSET", 0, "offset within the file" },
 		{ 's', "size", "SIZE", 0, "size limit (1G by default)" },
+		{ 'E', "export", NULL, 0,
+		  "write an annotated hex dump to standard output and exit" },
 #ifdef WITH_LUA
 		{ 't', "type", "TYPE", 0, "force interpretation as the given type" },
+		{ 'D', "dump", "FORMAT", 0,
+		  "write marks to standard output as \"json\" or \"tsv\" and exit" },
+		{ 'O', "output-dir", "DIR", 0, "dump marks for each file into DIR" },
+		{ 'j', "jobs", "N", 0, "number of files to process in parallel" },
+		{ 'c', "carve", NULL, 0, "look for embedded objects everywhere" },
 #endif // WITH_LUA
 		{ 0, NULL, NULL, 0, NULL }
 	};
 
 	bool requested_x11 = false;
-	struct opt_handler oh = opt_handler_make (argc, argv, opts, "[FILE]",
+	struct opt_handler oh = opt_handler_make (argc, argv, opts, "[FILE]...",
 		"Interpreting hex viewer.");
 	int64_t size_limit = 1 << 30;
 	const char *forced_type = NULL;
+	enum dump_format dump_format = DUMP_NONE;
+	const char *output_dir = NULL;
+	unsigned long jobs = app_cpu_count ();
+	char *end = NULL;
+	bool carve = false;
+	bool export_hex = false;
 
 	int c;
 	while ((c = opt_handler_get (&oh)) != -1)
@@ -1883,6 +8464,12 @@ main (int argc, char *argv[])
 	case 'x':
 		requested_x11 = true;
 		break;
+	case 'R':
+		g.replay = optarg;
+		break;
+	case 'S':
+		g.memory_stats = true;
+		break;
 	case 'h':
 		opt_handler_usage (&oh, stdout);
 		exit (EXIT_SUCCESS);
@@ -1898,9 +8485,32 @@ main (int argc, char *argv[])
 		if (!decode_size (optarg, &size_limit))
 			exit_fatal ("invalid size limit specified");
 		break;
+	case 'E':
+		export_hex = true;
+		break;
 	case 't':
 		forced_type = optarg;
 		break;
+	case 'D':
+		if (!strcmp (optarg, "json"))
+			dump_format = DUMP_JSON;
+		else if (!strcmp (optarg, "tsv"))
+			dump_format = DUMP_TSV;
+		else
+			exit_fatal ("unknown dump format: %s", optarg);
+		break;
+	case 'O':
+		output_dir = optarg;
+		break;
+	case 'c':
+		carve = true;
+		break;
+	case 'j':
+		errno = 0;
+		jobs = strtoul (optarg, &end, 10);
+		if (errno || *end || !jobs)
+			exit_fatal ("invalid number of jobs specified");
+		break;
 	default:
 		print_error ("wrong options");
 		opt_handler_usage (&oh, stderr);
@@ -1909,24 +8519,66 @@ main (int argc, char *argv[])
 
 	argc -= optind;
 	argv += optind;
+	if (dump_format && export_hex)
+		exit_fatal ("dumping and exporting are mutually exclusive");
 
+	g.started = app_clock_usec ();
+	g.main_thread = pthread_self ();
 #ifdef WITH_LUA
-	// We do it at this questionable location to catch plugin failure before
-	// we read potentially hundreds of megabytes of data in
-	app_lua_init ();
+	// Plugins get compiled while the input is being read in
+	struct app_task plugins = { .execute = app_lua_load_execute };
+	app_task_start (&plugins, 1, 1);
 
 	if (forced_type && !strcmp (forced_type, "list"))
 	{
-		struct str_map_iter iter = str_map_iter_make (&g.coders);
+		app_task_wait (&plugins);
+		struct str_map_iter iter = str_map_iter_make (&g.lua->coders);
 		while (str_map_iter_next (&iter))
 			puts (iter.link->key);
 		exit (EXIT_SUCCESS);
 	}
+
+	// Several files, or whole directories, can only be processed in batch
+	struct stat st = {};
+	if (output_dir && !dump_format)
+		exit_fatal ("an output directory only makes sense when dumping");
+	if (dump_format && (argc > 1 || output_dir
+	 || (argc == 1 && !stat (argv[0], &st) && S_ISDIR (st.st_mode))))
+	{
+		if (!argc)
+			exit_fatal ("no input files specified");
+		opt_handler_free (&oh);
+		app_task_wait (&plugins);
+
+		struct app_batch batch =
+		{
+			.paths = strv_make (),
+			.type = forced_type,
+			.offset = g.data_offset,
+			.size_limit = size_limit,
+			.format = dump_format,
+			.output_dir = output_dir,
+			.carve = carve,
+		};
+		ARRAY_INIT (batch.directories);
+		for (int i = 0; i < argc; i++)
+			app_batch_collect (&batch, argv[i]);
+		free (batch.directories);
+
+		bool ok = app_batch_run (&batch, jobs);
+		strv_free (&batch.paths);
+		app_memory_print ();
+		app_lua_destroy (g.lua);
+		return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
 #endif // WITH_LUA
 
-	// When no filename is given, read from stdin and replace it with the tty
+	// When no filename is given, read from stdin and replace it with the tty,
+	// unless we're not going to start the user interface at all
 	int input_fd;
-	if (argc == 0)
+	if (argc == 0 && (dump_format || export_hex))
+		input_fd = STDIN_FILENO;
+	else if (argc == 0)
 	{
 		if ((input_fd = dup (STDIN_FILENO)) < 0)
 			exit_fatal ("cannot read input: %s", strerror (errno));
@@ -1934,7 +8586,7 @@ main (int argc, char *argv[])
 		if (open ("/dev/tty", O_RDWR) != STDIN_FILENO)
 			exit_fatal ("cannot open the terminal: %s", strerror (errno));
 	}
-	else if (argc == 1)
+	else if (argc == 1 || (argc == 2 && !dump_format && !export_hex))
 	{
 		g.filename = xstrdup (argv[0]);
 		if ((input_fd = open (argv[0], O_RDONLY)) < 0)
@@ -1947,34 +8599,13 @@ main (int argc, char *argv[])
 	}
 	opt_handler_free (&oh);
 
-	// Seek in the file or pipe however we can
-	static char seek_buf[8192];
-	if (lseek (input_fd, g.data_offset, SEEK_SET) == (off_t) -1)
-		for (uint64_t remaining = g.data_offset; remaining; )
-		{
-			ssize_t n_read = read (input_fd,
-				seek_buf, MIN (remaining, sizeof seek_buf));
-			if (n_read <= 0)
-				exit_fatal ("cannot seek: %s", strerror (errno));
-			remaining -= n_read;
-		}
-
-	// Read up to "size_limit" bytes of data into a buffer
-	struct str buf = str_make ();
-	while (buf.len < (size_t) size_limit)
-	{
-		str_reserve (&buf, 8192);
-		ssize_t n_read = read (input_fd, buf.str + buf.len,
-			MIN (size_limit - buf.len, buf.alloc - buf.len));
-		if (!n_read)
-			break;
-		if (n_read == -1)
-			exit_fatal ("cannot read input: %s", strerror (errno));
-		buf.len += n_read;
-	}
-
-	g.data = (uint8_t *) buf.str;
-	g.data_len = buf.len;
+	g.startup[STARTUP_READ].start = app_clock_usec ();
+	app_load_data (input_fd, size_limit);
+	int readahead_fd = g.mapping.address ? dup (input_fd) : -1;
+	close (input_fd);
+	if (argc == 2)
+		g.diff = app_diff_new (argv[1], size_limit);
+	g.startup[STARTUP_READ].end = app_clock_usec ();
 
 	g.view_top = g.data_offset / ROW_SIZE * ROW_SIZE;
 	g.view_cursor = g.data_offset;
@@ -1985,31 +8616,67 @@ main (int argc, char *argv[])
 
 	app_init_context ();
 #ifdef WITH_LUA
-	// TODO: eventually we should do this in a separate thread after load
-	//   as it may take a long time (-> responsivity) and once we allow the user
-	//   to edit the file, each change will need a background rescan
-	lua_pushcfunction (g.L, app_lua_error_handler);
-	lua_pushcfunction (g.L, app_lua_chunk_decode);
-
-	struct app_lua_chunk *chunk = app_lua_chunk_new (g.L);
-	chunk->offset = g.data_offset;
-	chunk->len = g.data_len;
-
-	if (forced_type)
-		lua_pushstring (g.L, forced_type);
-	else
-		lua_pushnil (g.L);
-	if (lua_pcall (g.L, 2, 0, -4))
-		exit_fatal ("Lua: decoding failed: %s", lua_tostring (g.L, -1));
+	app_task_wait (&plugins);
+	if (dump_format || export_hex)
+	{
+		struct app_dump dump =
+			{ .format = dump_format, .fp = stdout, .buf = str_make () };
+		g.lua->data = g.data;
+		g.lua->data_len = g.data_len;
+		g.lua->data_offset = g.data_offset;
+		g.lua->on_mark = dump_format ? app_dump_mark : app_add_mark;
+		g.lua->user_data = &dump;
+
+		struct error *e = NULL;
+		if (!app_lua_decode_data (g.lua, forced_type, &e))
+			exit_fatal ("Lua: decoding failed: %s", e->message);
+		if (carve)
+			app_lua_carve (g.lua, app_cpu_count ());
+		if (!app_lua_decode_deferred (g.lua, &e))
+			exit_fatal ("Lua: decoding failed: %s", e->message);
+		str_free (&dump.buf);
+	}
+#endif // WITH_LUA
+	if (dump_format || export_hex)
+	{
+		struct error *e = NULL;
+		if (export_hex)
+		{
+			qsort (g.marks, g.marks_len, sizeof *g.marks, app_mark_cmp);
+			app_index_marks ();
+			if (!app_export (stdout, &e))
+				exit_fatal ("%s", e->message);
+		}
+		else if (fflush (stdout))
+			exit_fatal ("cannot write output: %s", strerror (errno));
 
-	lua_pop (g.L, 1);
+		if (readahead_fd != -1)
+			close (readahead_fd);
+		app_memory_print ();
+		app_free_context ();
+#ifdef WITH_LUA
+		app_lua_destroy (g.lua);
 #endif // WITH_LUA
-	app_flatten_marks ();
+		return 0;
+	}
 
+	g.startup[STARTUP_UI].start = app_clock_usec ();
 	app_load_configuration ();
 	signals_setup_handlers ();
 	app_init_poller_events ();
 
+	// Replays shouldn't take over the terminal, which may not even exist,
+	// and the report needs to end up where standard output used to go
+	int report_fd = -1;
+	if (g.replay && !requested_x11)
+	{
+		struct error *e = NULL;
+		if ((report_fd = dup (STDOUT_FILENO)) < 0)
+			exit_fatal ("dup: %s", strerror (errno));
+		if (!app_private_pty (REPLAY_ROWS, REPLAY_COLS, &e))
+			exit_fatal ("%s", e->message);
+	}
+
 	xui_preinit ();
 	app_init_bindings ();
 	xui_start (&g.poller,
@@ -2023,17 +8690,53 @@ main (int argc, char *argv[])
 	// Redirect all messages from liberty so that they don't disrupt display
 	g_log_message_real = app_log_handler;
 
+	if (g_debug_mode || g.replay)
+		app_frame_timing_start ();
+	if (readahead_fd != -1)
+		app_readahead_start (readahead_fd);
+	if (g.data_len)
+		app_overview_start ();
+	if (g.diff)
+		app_diff_start (g.diff);
+#ifdef WITH_LUA
+	// The user interface doesn't need to wait for marks
+	app_redecode_everything (forced_type, carve);
+#endif // WITH_LUA
+
 	g.polling = true;
 	while (g.polling)
 		poller_run (&g.poller);
 
+	app_readahead_free ();
+	app_overview_free ();
+	if (g.search)
+		app_search_free (g.search);
+	if (g.fields)
+		app_field_index_free (g.fields);
+	if (g.diff)
+		app_diff_free (g.diff);
+#ifdef WITH_LUA
+	app_redecode_free ();
+	poller_idle_reset (&g.redecode_event);
+#endif // WITH_LUA
+	if (g_debug_mode || g.replay)
+		app_frame_timing_stop ();
 	xui_stop ();
 	g_log_message_real = log_message_stdio;
+	if (report_fd != -1)
+	{
+		fflush (stdout);
+		if (dup2 (report_fd, STDOUT_FILENO) < 0)
+			exit_fatal ("dup2: %s", strerror (errno));
+		close (report_fd);
+	}
+	app_report_startup ();
+	app_report_frames ();
+	app_memory_print ();
 	app_free_context ();
 
 #ifdef WITH_LUA
-	str_map_free (&g.coders);
-	lua_close (g.L);
+	app_lua_destroy (g.lua);
 #endif // WITH_LUA
 
 	return 0;
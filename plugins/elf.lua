@@ -129,6 +129,83 @@ local decode_sh = function (elf, c)
 	return sh
 end
 
+-- Tables may hold millions of entries in debugging builds, so their contents
+-- are only decoded once they come into view, a slice at a time
+local SLICE_ENTRIES = 1024
+local SLICE_BYTES = 16384
+
+-- String tables are passed as offsets and sizes within the enclosing decode,
+-- which edits move along, unlike chunks
+
+local decode_symbols = function (c, first, class, endianity, offset, size)
+	c.endianity = endianity
+	local strings = offset and c:enclosing () (offset + 1, offset + size)
+	c:elf_symbols (class, first, strings)
+end
+
+local decode_strings = function (c, offset, size)
+	-- Edits within the slice may have made it reach past the table
+	local elf = c:enclosing ()
+	local from = c.offset - elf.offset + 1
+	c:cstrings (elf (math.min (offset + 1, from),
+		math.max (offset + size, from + #c - 1)))
+end
+
+local decode_relocations = function (c, first, class, endianity, addend)
+	c.endianity = endianity
+	local uwide = class == 1 and c.u32 or c.u64
+	local swide = class == 1 and c.s32 or c.s64
+	local size = class * 4 * (addend and 3 or 2)
+
+	local i = first
+	while #c - c.position + 1 >= size do
+		c (c.position, c.position + size - 1):mark ("ELF relocation %d", i)
+		uwide (c, "offset: %#x")
+		uwide (c, "info: %s", function (info)
+			if class == 1 then
+				return "symbol %d, type %d", info >> 8, info & 0xff
+			end
+			return "symbol %d, type %d", info >> 32, info & 0xffffffff
+		end)
+		if addend then swide (c, "addend: %d") end
+		i = i + 1
+	end
+end
+
+local defer_entries = function (c, size, type, ...)
+	local slice = SLICE_ENTRIES * size
+	for from = 1, #c, slice do
+		c (from, from + slice - 1):defer (type, (from - 1) // size, ...)
+	end
+end
+
+local defer_contents = function (elf, c, shs, sh)
+	local contents = c (sh.offset + 1, sh.offset + sh.size)
+	if sh.type == 2 or sh.type == 11 then
+		if sh.entsize ~= (elf.class == 1 and 16 or 24) then return end
+
+		local linked = shs[sh.link + 1]
+		if linked and linked.type == 3 then
+			defer_entries (contents, sh.entsize, "elf-symbols",
+				elf.class, c.endianity, linked.offset, linked.size)
+		else
+			defer_entries (contents, sh.entsize, "elf-symbols",
+				elf.class, c.endianity)
+		end
+	elseif sh.type == 3 then
+		for from = 1, #contents, SLICE_BYTES do
+			contents (from, from + SLICE_BYTES - 1):defer ("elf-strings",
+				sh.offset, sh.size)
+		end
+	elseif sh.type == 4 or sh.type == 9 then
+		local addend = sh.type == 4
+		if sh.entsize ~= elf.class * 4 * (addend and 3 or 2) then return end
+
+		defer_entries (contents, sh.entsize, "elf-relocations",
+			elf.class, c.endianity, addend)
+	end
+end
+
 local abi_table = {
 	[0]   = "UNIX System V ABI",
 	[1]   = "HP-UX operating system",
@@ -441,7 +518,11 @@ local decode = function (c)
 		else
 			schunk:mark ("ELF section header %d", i - 1)
 		end
+		defer_contents (elf, c, shs, sh)
 	end
 end
 
-hex.register { type="elf", detect=detect, decode=decode }
+hex.register { type="elf", detect=detect, decode=decode, magic="\x7FELF" }
+hex.register { type="elf-symbols", decode=decode_symbols }
+hex.register { type="elf-strings", decode=decode_strings }
+hex.register { type="elf-relocations", decode=decode_relocations }
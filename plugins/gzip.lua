@@ -19,37 +19,30 @@ local detect = function (c)
 	return #c >= 2 and c:read (2) == "\x1f\x8b"
 end
 
+-- Appending to a string character by character would take quadratic time
 local function latin1_to_utf8 (s)
-	local u = ""
-	for _, c in ipairs (table.pack (s:byte (1, #s))) do
-		if c < 0x80 then
-			u = u .. string.char (c)
-		else
-			u = u .. string.char (0xc0 | c >> 6, 0x80 | c & 0x3f)
-		end
-	end
-	return u
+	return (s:gsub ("[\x80-\xff]", function (c)
+		local b = c:byte ()
+		return string.char (0xc0 | b >> 6, 0x80 | b & 0x3f)
+	end))
 end
 
 -- Everything here is based on RFC 1952 and some bits of dictzip
-local crc32_table = function ()
-	local table = {}
-	for n = 0, 255 do
-		local c = n
-		for k = 0, 7 do
-			if c & 1 ~= 0 then
-				c = 0xedb88320 ~ (c >> 1)
-			else
-				c = c >> 1
-			end
+local crc32_table = {}
+for n = 0, 255 do
+	local c = n
+	for k = 0, 7 do
+		if c & 1 ~= 0 then
+			c = 0xedb88320 ~ (c >> 1)
+		else
+			c = c >> 1
 		end
-		table[n] = c
 	end
-	return table
+	crc32_table[n] = c
 end
 
 local crc32 = function (s)
-	local table, c = crc32_table (), 0xffffffff
+	local table, c = crc32_table, 0xffffffff
 	for n = 1, #s do c = table[(c ~ s:byte (n)) & 0xff] ~ (c >> 8) end
 	return c ~ 0xffffffff
 end
@@ -154,7 +147,7 @@ local decode = function (c)
 	if hcrc then
 		c:u16 ("CRC-16: %s", function (u16)
 			local crc = 0xffff & crc32 (c (start):read (c.position - 1))
-			if crc == u16 then check = "ok" else check = "failed" end
+			local check = crc == u16 and "ok" or "failed"
 			return "%#06x (%s)", u16, check
 		end)
 	end
@@ -181,4 +174,4 @@ local decode = function (c)
 	end
 end
 
-hex.register { type="gzip", detect=detect, decode=decode }
+hex.register { type="gzip", detect=detect, decode=decode, magic="\x1f\x8b\x08" }
@@ -142,6 +142,114 @@ local link_types = {
 	[266] = "USB_DARWIN"
 }
 
+-- - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+
+local decode_udp = function (c)
+	if #c < 8 then return end
+
+	c (1, 8):mark ("UDP header")
+	c:u16 ("source port: %d")
+	c:u16 ("destination port: %d")
+	local length = c:u16 ("length: %d")
+	c:u16 ("checksum: 0x%04x")
+	if length > 8 then c (9, length):mark ("UDP payload") end
+end
+
+local ip_protocols = {
+	[1]   = "ICMP",
+	[2]   = "IGMP",
+	[6]   = "TCP",
+	[17]  = "UDP",
+	[41]  = "IPv6",
+	[47]  = "GRE",
+	[50]  = "ESP",
+	[51]  = "AH",
+	[58]  = "IPv6-ICMP",
+	[132] = "SCTP"
+}
+
+-- As described by RFC 791
+local decode_ipv4 = function (c)
+	if #c < 20 then return end
+
+	local version_ihl = c:u8 ()
+	local ihl = (version_ihl & 0xf) * 4
+	if version_ihl >> 4 ~= 4 or ihl < 20 or ihl > #c then return end
+
+	c (1, ihl):mark ("IPv4 header")
+	c (1, 1):mark ("version: 4, header length: %d", ihl)
+	c:u8 ("DSCP and ECN: 0x%02x")
+	local total = c:u16 ("total length: %d")
+	c:u16 ("identification: 0x%04x")
+	local fragment = c:u16 ("fragment offset: %s", function (u16)
+		local flags = ""
+		if u16 & 0x4000 ~= 0 then flags = flags .. ", don't fragment" end
+		if u16 & 0x2000 ~= 0 then flags = flags .. ", more fragments" end
+		return "%d%s", (u16 & 0x1fff) * 8, flags
+	end)
+	c:u8 ("time to live: %d")
+	local protocol = c:u8 ("protocol: %s", function (u8)
+		local name = ip_protocols[u8]
+		if name then return name end
+		return "unknown: %d", u8
+	end)
+	c:u16 ("header checksum: 0x%04x")
+	c (13, 16):mark ("source address: %d.%d.%d.%d", c:read (4):byte (1, 4))
+	c (17, 20):mark ("destination address: %d.%d.%d.%d",
+		c:read (4):byte (1, 4))
+	if ihl > 20 then c (21, ihl):mark ("options") end
+
+	-- Only the first fragment starts with the transport header
+	local payload = c (ihl + 1, total)
+	if protocol == 17 and fragment & 0x3fff == 0 then decode_udp (payload) end
+end
+
+local ether_types = {
+	[0x0800] = "IPv4",
+	[0x0806] = "ARP",
+	[0x8100] = "IEEE 802.1Q",
+	[0x86dd] = "IPv6",
+	[0x88cc] = "LLDP"
+}
+
+local decode_ethernet = function (c)
+	if #c < 14 then return end
+
+	c.endianity = "be"
+	local mac = function (s)
+		return ("%02x:%02x:%02x:%02x:%02x:%02x"):format (s:byte (1, 6))
+	end
+	c (1, 14):mark ("Ethernet header")
+	c (1, 6):mark ("destination: %s", mac (c:read (6)))
+	c (7, 12):mark ("source: %s", mac (c:read (6)))
+	local ether_type = c:u16 ("EtherType: %s", function (u16)
+		local name = ether_types[u16]
+		if name then return name end
+		return "unknown: 0x%04x", u16
+	end)
+	if ether_type == 0x0800 then decode_ipv4 (c (15)) end
+end
+
+-- Payload decoders by link type, called with a chunk of packet data
+-- TODO: also decode record contents as per the huge table
+local payload_decoders = {
+	[1] = decode_ethernet
+}
+
+local decode_payload = function (c, link_type, index)
+	local decoder = payload_decoders[link_type]
+	if decoder then decoder (c, link_type, index) end
+end
+
+-- Records are decoded in runs of this many, only once they come into view,
+-- as there may be millions of them, and so that edits only repeat one
+local RECORD_RUN = 4096
+
+local decode_records = function (c, endianity, zone, network, first)
+	c.endianity = endianity
+	c:pcap_records (zone, network, payload_decoders[network], first)
+end
+
 -- As described by https://wiki.wireshark.org/Development/LibpcapFileFormat
 local decode = function (c)
 	if not detect (c ()) then error ("not a PCAP file") end
@@ -162,93 +270,49 @@ local decode = function (c)
 	local snaplen = c:u32 ("max. length of captured packets: %d")
 
 	local network = c:u32 ("data link type: %s", function (u32)
-		name = link_types[u32]
+		local name = link_types[u32]
 		if name then return name end
 		return "unknown: %d", u32
 	end)
 
-	local i = 0
-	while not c.eof do
-		c (c.position, c.position + 15):mark ("PCAP record %d header", i)
-
-		local p, ts_sec, ts_usec = c.position, c:u32 (), c:u32 ()
-		c (p, c.position - 1):mark ("timestamp: %s.%06d",
-			os.date ("!%F %T", ts_sec + zone), ts_usec)
-		local incl_len = c:u32 ("included record length: %d")
-		local orig_len = c:u32 ("original record length: %d")
-
-		local p = c.position
-		c.position = c.position + incl_len
-		-- TODO: also decode record contents as per the huge table
-		c (p, c.position - 1):mark ("PCAP record %d data", i)
-		i = i + 1
+	-- Records are walked natively, there may be millions of them
+	local first = 0
+	while c.position <= #c do
+		local from = c.position
+		local count = c:pcap_skip (RECORD_RUN)
+		c (from, c.position - 1):defer ("pcap-records",
+			c.endianity, zone, network, first)
+		first = first + count
 	end
 end
 
-hex.register { type="pcap", detect=detect, decode=decode }
-
-local block_types = {
-	[0x0a0d0d0a] = "Section Header Block",
-	[0x00000001] = "Interface Description Block",
-	[0x00000003] = "Simple Packet Block",
-	[0x00000004] = "Name Resolution Block",
-	[0x00000005] = "Interface Statistics Block",
-	[0x00000006] = "Enhanced Packet Block",
-
-	[0x00000BAD] = "Custom Block",
-	[0x40000BAD] = "Custom Block"
-}
-
-local decode_shb = function (c)
-	local magic = c:u32 ()
-	local p, vmajor, vminor = c.position, c:u16 (), c:u16 ()
-	c (p, c.position - 1):mark ("PCAPNG version: %d.%d", vmajor, vminor)
-	-- XXX: what exactly does section_len mean?
-	local section_len = c:u64 ("section length: %d")
-
-	while not c.eof do
-		-- TODO: decode the meaning of options as well
-		local type = c:u16 ("option type: %d")
-		local length = c:u16 ("option length: %d")
-
-		local p = c.position
-		c.position = c.position + length + (-length & 3)
-		c (p, c.position - 1):mark ("option value")
-	end
-end
-
-local block_decoders = {
-	-- TODO: also decode other types of blocks
-	[0x0a0d0d0a] = decode_shb
-}
+hex.register { type="pcap", detect=detect, decode=decode,
+	magic={ "\xd4\xc3\xb2\xa1", "\xa1\xb2\xc3\xd4" } }
+hex.register { type="pcap-records", decode=decode_records }
 
 -- As described by https://github.com/pcapng/pcapng
 local decode_ng = function (c)
 	assert (c.position == 1)
 	if not detect_ng (c ()) then error ("not a PCAPNG file") end
 
-	c.endianity = "le"
-	c (9):u32 ("byte-order magic: %s", function (u32)
-		if u32 == 0x1a2b3c4d then return "little-endian" end
-
-		c.endianity = "be"
-		return "big-endian"
-	end)
-
-	while not c.eof do
-		local block_start = c.position
-		local block_type = c:u32 ("PCAPNG block type: %s", function (u32)
-			local name = block_types[u32]
-			if name then return name end
-			return "unknown: %d", u32
-		end)
-		local block_len = c:u32 ("PCAPNG block length: %d")
-		local data_start = c.position
-		c.position = block_start + block_len - 4
-		local decoder = block_decoders[block_type]
-		if decoder then decoder (c (data_start, c.position - 1)) end
-		c:u32 ("PCAPNG trailing block length: %d")
+	-- Blocks are walked natively, including their byte order,
+	-- and each run starts out knowing the interfaces described before it
+	local first, interfaces = 0, {}
+	while c.position <= #c do
+		local from, endianity = c.position, c.endianity
+		local known = table.move (interfaces, 1, #interfaces, 1, {})
+		local _, count = c:pcapng_skip (RECORD_RUN, interfaces)
+		c (from, c.position - 1):defer ("pcapng-blocks",
+			endianity, known, first)
+		first = first + count
 	end
 end
 
-hex.register { type="pcapng", detect=detect_ng, decode=decode_ng }
+local decode_blocks = function (c, endianity, interfaces, first)
+	c.endianity = endianity
+	c:pcapng_blocks (link_types, decode_payload, interfaces, first)
+end
+
+hex.register { type="pcapng", detect=detect_ng, decode=decode_ng,
+	magic="\x0a\x0d\x0d\x0a" }
+hex.register { type="pcapng-blocks", decode=decode_blocks }
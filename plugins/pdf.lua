@@ -439,6 +439,79 @@ local read_all_xrefs = function (c, start_offset)
 	return result
 end
 
+-- Return the sorted offsets of all objects found in xref tables
+local object_offsets = function (xref)
+	local offsets = {}
+	for _, bin in pairs (xref) do
+		for _, entry in ipairs (bin) do
+			if entry.t == 1 then table.insert (offsets, entry.o) end
+		end
+	end
+	table.sort (offsets)
+	return offsets
+end
+
+-- Find where an object at an offset ends at the latest,
+-- which is right before any object that follows it
+local object_bound = function (c, offsets, offset)
+	local lo, hi = 1, #offsets + 1
+	while lo < hi do
+		local mid = (lo + hi) // 2
+		if offsets[mid] <= offset then lo = mid + 1 else hi = mid end
+	end
+	return offsets[lo] or #c
+end
+
+-- Objects are decoded on their own, so that edits only need to repeat one.
+-- Decodes only get plain data, as edits move them around, so they share
+-- the document "state" with xref tables and a cache of objects by offset,
+-- and find the document itself as the decode enclosing them.
+local read_object, deref
+
+local decode_object = function (c, state, offset)
+	local doc = c:enclosing ("pdf")
+	local resolve = function (x) return deref (doc, state, x) end
+	local lex, stack = Lexer:new (c), {}
+	repeat
+		local object = get_object (lex, stack, resolve)
+		if not object then error ("object doesn't end") end
+		table.insert (stack, object)
+	until object.type == 'object'
+
+	local object = table.remove (stack)
+	state.cache[offset] = object
+	c (object.start, object.stop):mark ("object " .. object.n .. " " ..
+		object.gen)
+end
+
+-- We have to make sure that we don't decode objects twice as that would
+-- duplicate all marks, so we simply cache all objects by offset.
+-- This may be quite the memory load but it seems to be the best thing.
+read_object = function (doc, state, offset)
+	if not state.cache[offset] then
+		local bound = object_bound (doc, state.offsets, offset)
+		doc (1 + offset, bound):decode ("pdf-object", state, offset)
+	end
+	return state.cache[offset]
+end
+
+-- Resolve an object -- if it's a reference, look it up in "xref",
+-- otherwise just return the object as it was passed
+deref = function (doc, state, x)
+	if not x or x.type ~= 'reference' then return x end
+	local n, gen = x.value[1], x.value[2]
+
+	-- TODO: we should also ignore object numbers >= trailer /Size
+	local bin = state.xref[n]
+	if not bin then return nil end
+	local entry = bin[1]
+	if not entry or entry.t ~= 1 or entry.g ~= gen then return nil end
+
+	local object = read_object (doc, state, entry.o)
+	if not object or object.n ~= n or object.gen ~= gen then return nil end
+	return object.value
+end
+
 local decode = function (c)
 	assert (c.position == 1)
 	if not detect (c ()) then error ("not a PDF file") end
@@ -456,51 +529,13 @@ local decode = function (c)
 	-- We need to decode xref sections in order to be able to resolve indirect
 	-- references to stream lengths
 	local xref = read_all_xrefs (c, math.tointeger (xref_loc))
-	local deref
-
-	-- We have to make sure that we don't decode objects twice as that would
-	-- duplicate all marks, so we simply cache all objects by offset.
-	-- This may be quite the memory load but it seems to be the best thing.
-	local cache = {}
-	local read_object = function (offset)
-		if cache[offset] then return cache[offset] end
-
-		local lex, stack = Lexer:new (c (1 + offset, #c)), {}
-		repeat
-			local object = get_object (lex, stack, deref)
-			if not object then error ("object doesn't end") end
-			table.insert (stack, object)
-		until object.type == 'object'
-
-		local object = table.remove (stack)
-		cache[offset] = object
-		c (offset + object.start, offset + object.stop)
-			:mark ("object " .. object.n .. " " .. object.gen)
-		return object
-	end
-
-	-- Resolve an object -- if it's a reference, look it up in "xref",
-	-- otherwise just return the object as it was passed
-	deref = function (x)
-		if not x or x.type ~= 'reference' then return x end
-		local n, gen = x.value[1], x.value[2]
-
-		-- TODO: we should also ignore object numbers >= trailer /Size
-		local bin = xref[n]
-		if not bin then return nil end
-		local entry = bin[1]
-		if not entry or entry.t ~= 1 or entry.g ~= gen then return nil end
-
-		local object = read_object (entry.o)
-		if not object or object.n ~= n or object.gen ~= gen then return nil end
-		return object.value
-	end
+	local state = { xref=xref, offsets=object_offsets (xref), cache={} }
 
 	-- Read all objects accessible from the current version of the document
 	for n, bin in pairs (xref) do
 		local entry = bin[1]
 		if entry and entry.t == 1 then
-			read_object (entry.o)
+			read_object (c, state, entry.o)
 		end
 	end
 
@@ -510,4 +545,5 @@ local decode = function (c)
 	--   The version information needs to be propagated everywhere.
 end
 
-hex.register { type="pdf", detect=detect, decode=decode }
+hex.register { type="pdf", detect=detect, decode=decode, magic="%PDF-" }
+hex.register { type="pdf-object", decode=decode_object }
@@ -51,4 +51,4 @@ local decode = function (c)
 	-- TODO: decode all entries as well
 end
 
-hex.register { type="xcursor", detect=detect, decode=decode }
+hex.register { type="xcursor", detect=detect, decode=decode, magic="Xcur" }
@@ -25,6 +25,36 @@ local detect = function (c)
 	end
 end
 
+local decode_cd_record = function (c)
+	c.endianity = "le"
+	c:u32 ("CD file header magic: %#x")
+	c:u16 ("version made by: %d")
+	c:u16 ("version needed to extract: %d")
+	c:u16 ("general purpose bit flag: %#x")
+	c:u16 ("compression method: %d")
+	c:u16 ("file last modification time: %d")
+	c:u16 ("file last modification date: %d")
+	c:u32 ("CRC-32: %#x")
+	c:u32 ("compressed size: %d")
+	c:u32 ("uncompressed size: %d")
+	local filename_len = c:u16 ("file name length: %d")
+	local extra_len = c:u16 ("extra field length: %d")
+	local comment_len = c:u16 ("file comment length: %d")
+	c:u16 ("disk # where file starts: %d")
+	c:u16 ("internal file attributes: %#x")
+	c:u32 ("external file attributes: %#x")
+	c:u32 ("offset of (start of local file header - start of archive): %d")
+
+	c (c.position, c.position + filename_len - 1):mark ("filename")
+	c.position = c.position + filename_len
+
+	c (c.position, c.position + extra_len - 1):mark ("extra field")
+	c.position = c.position + extra_len
+
+	c (c.position, c.position + comment_len - 1):mark ("file comment")
+	c.position = c.position + comment_len
+end
+
 local decode = function (c)
 	local eocd = detect (c ())
 	if not eocd then error ("not a ZIP file") end
@@ -44,38 +74,19 @@ local decode = function (c)
 	-- TODO: decode the fields better
 	--   https://stackoverflow.com/a/30028491/76313
 	-- TODO: also mark actual file data if someone wants to put in the effort
+	-- Each record is decoded on its own, so that edits only repeat one
 	c.position = cd_offset + 1
 	for i = 1, cd_len do
 		local p, magic = c.position, c:u32 ()
 		if magic ~= 0x02014b50 then break end
-		c (p, c.position - 1):mark ("CD file header magic: %#x", magic)
-		c:u16 ("version made by: %d")
-		c:u16 ("version needed to extract: %d")
-		c:u16 ("general purpose bit flag: %#x")
-		c:u16 ("compression method: %d")
-		c:u16 ("file last modification time: %d")
-		c:u16 ("file last modification date: %d")
-		c:u32 ("CRC-32: %#x")
-		c:u32 ("compressed size: %d")
-		c:u32 ("uncompressed size: %d")
-		local filename_len = c:u16 ("file name length: %d")
-		local extra_len = c:u16 ("extra field length: %d")
-		local comment_len = c:u16 ("file comment length: %d")
-		c:u16 ("disk # where file starts: %d")
-		c:u16 ("internal file attributes: %#x")
-		c:u32 ("external file attributes: %#x")
-		c:u32 ("offset of (start of local file header - start of archive): %d")
-
-		c (c.position, c.position + filename_len - 1):mark ("filename")
-		c.position = c.position + filename_len
-
-		c (c.position, c.position + extra_len - 1):mark ("extra field")
-		c.position = c.position + extra_len
 
-		c (c.position, c.position + comment_len - 1):mark ("file comment")
-		c.position = c.position + comment_len
+		c.position = p + 28
+		local len = 46 + c:u16 () + c:u16 () + c:u16 ()
+		c (p, p + len - 1):decode ("zip-cd-record")
+		c.position = p + len
 	end
 end
 
-hex.register { type="zip", detect=detect, decode=decode }
+hex.register { type="zip", detect=detect, decode=decode, magic="PK\3\4" }
+hex.register { type="zip-cd-record", decode=decode_cd_record }
 